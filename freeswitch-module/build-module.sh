@@ -11,7 +11,7 @@ docker build -f Dockerfile.build -t freeswitch-module-builder .
 
 # Run container and extract the compiled module
 docker run --rm -v "$(pwd)":/output freeswitch-module-builder sh -c "
-    gcc -fPIC -O2 -I/usr/include/freeswitch -shared -o /tmp/mod_nova_sonic.so /tmp/mod_nova_sonic.c && \
+    gcc -fPIC -O2 -I/usr/include/freeswitch -shared -o /tmp/mod_nova_sonic.so /tmp/mod_nova_sonic.c -lssl -lcrypto -lm && \
     cp /tmp/mod_nova_sonic.so /output/
 "
 
@@ -5,10 +5,10 @@ echo "Building mod_nova_sonic (v3 - direct frame loop)..."
 
 # Compile
 gcc -fPIC -O3 -I/usr/local/freeswitch/include/freeswitch \
-    -c src/mod_nova_sonic_v3.c -o mod_nova_sonic.o
+    -c src/mod_nova_sonic.c -o mod_nova_sonic.o
 
 # Link
-gcc -shared -o mod_nova_sonic.so mod_nova_sonic.o
+gcc -shared -o mod_nova_sonic.so mod_nova_sonic.o -lssl -lcrypto -lm
 
 # Create tarball
 tar -czf mod_nova_sonic_v3.tar.gz mod_nova_sonic.so
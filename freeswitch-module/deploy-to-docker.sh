@@ -19,13 +19,14 @@ docker run --name freeswitch-builder -d safarov/freeswitch:latest tail -f /dev/n
 
 # Copy source first
 docker cp src/mod_nova_sonic.c freeswitch-builder:/tmp/
+docker cp src/nova_mediad.h freeswitch-builder:/tmp/
 
 # Install build tools and build module
 docker exec freeswitch-builder sh -c "
-  apk add --no-cache gcc g++ make musl-dev linux-headers && \
+  apk add --no-cache gcc g++ make musl-dev linux-headers openssl-dev && \
   cd /tmp && \
-  gcc -fPIC -O2 -I/usr/include/freeswitch -I/usr/local/include/freeswitch -shared -o mod_nova_sonic.so mod_nova_sonic.c 2>&1 || \
-  gcc -fPIC -O2 -shared -o mod_nova_sonic.so mod_nova_sonic.c 2>&1
+  gcc -fPIC -O2 -I/usr/include/freeswitch -I/usr/local/include/freeswitch -shared -o mod_nova_sonic.so mod_nova_sonic.c -lssl -lcrypto -lm 2>&1 || \
+  gcc -fPIC -O2 -shared -o mod_nova_sonic.so mod_nova_sonic.c -lssl -lcrypto -lm 2>&1
 "
 
 # Extract compiled module
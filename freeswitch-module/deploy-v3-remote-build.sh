@@ -6,7 +6,7 @@ SSH_KEY="/Users/yasser/freeswitch.pem"
 MODULE_NAME="mod_nova_sonic"
 
 echo "📤 Uploading source to FreeSWITCH..."
-scp -i "$SSH_KEY" src/mod_nova_sonic_v3.c admin@$FREESWITCH_HOST:/tmp/
+scp -i "$SSH_KEY" src/mod_nova_sonic.c src/nova_mediad.h src/nova_mediad.c admin@$FREESWITCH_HOST:/tmp/
 
 echo ""
 echo "🔨 Building on FreeSWITCH server..."
@@ -15,18 +15,22 @@ cd /tmp
 
 echo "Compiling module..."
 sudo gcc -fPIC -O3 -I/usr/local/freeswitch/include/freeswitch \
-    -c mod_nova_sonic_v3.c -o mod_nova_sonic.o
+    -c mod_nova_sonic.c -o mod_nova_sonic.o
 
 echo "Linking module..."
-sudo gcc -shared -o mod_nova_sonic.so mod_nova_sonic.o
+sudo gcc -shared -o mod_nova_sonic.so mod_nova_sonic.o -lssl -lcrypto -lm
+
+echo "Building media sidecar..."
+sudo gcc -O2 -o nova-mediad nova_mediad.c -lssl -lcrypto -lpthread
 
 echo "Installing module..."
 sudo mv mod_nova_sonic.so /usr/local/freeswitch/mod/
 sudo chown freeswitch:freeswitch /usr/local/freeswitch/mod/mod_nova_sonic.so
 sudo chmod 755 /usr/local/freeswitch/mod/mod_nova_sonic.so
+sudo mv nova-mediad /usr/local/bin/
 
 echo "Cleaning up..."
-sudo rm -f /tmp/mod_nova_sonic.o /tmp/mod_nova_sonic_v3.c
+sudo rm -f /tmp/mod_nova_sonic.o /tmp/mod_nova_sonic.c /tmp/nova_mediad.h /tmp/nova_mediad.c
 
 echo "Module built and installed"
 EOF
@@ -1,515 +1,6713 @@
 /*
- * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
- * Copyright (C) 2025, Amazon Web Services
+ * mod_nova_sonic - FreeSWITCH module for Amazon Nova Sonic integration
  *
- * mod_nova_sonic.c -- Amazon Nova Sonic Audio Proxy Module
+ * This module provides a nova_ai_session application that:
+ * - Answers the call
+ * - Connects to Java gateway via TCP
+ * - Runs the call's audio through one of three media engines, chosen per
+ *   call: a direct frame read/write loop (frame, the default), a media bug
+ *   the application waits on (bug), or a media bug left running while the
+ *   dialplan continues (background). Transport, framing, codecs, buffers
+ *   and metrics below are shared by all three.
+ * - Streams bidirectional audio with Nova Sonic
+ * - Optionally defers the gateway session until the caller starts speaking
+ *   (lazy start), replaying a short pre-roll so the first syllable is kept
+ * - Optionally pauses caller streaming while hold music is detected
+ * - Optionally tees decoded caller/bot audio to extra consumers (audio fork)
+ * - Optionally mirrors sampled calls to a listen-only canary gateway (shadow)
+ * - Optionally stops sending RTP toward the caller while the bot is silent,
+ *   with RFC 3389 comfort-noise updates where CN was negotiated (DTX)
+ * - Optionally exports OpenTelemetry spans for each session phase, with the
+ *   call UUID as trace ID propagated to the gateway (OTLP/HTTP JSON)
+ * - Scores call quality as it goes (E-model R factor and MOS estimate from
+ *   playout underruns, dropped bot audio, delay and responsiveness)
+ * - Samples the caller leg's RTP statistics next to its own metrics, so
+ *   network trouble can be told apart from gateway or model slowness
+ * - Exports configured channel variables in the handshake and as they change
+ * - Optionally encrypts the gateway hop with TLS handed off to kernel TLS
+ * - Optionally leaves gateway connections to the nova-mediad sidecar,
+ *   exchanging audio over shared-memory rings
+ * - Carves per-session audio state from one hugepage-backed arena
+ * - Writes caller audio and the control messages around it to the gateway
+ *   in one call, and reports frames per write per connection
+ * - Picks among several gateways by measured RTT and load
+ * - Optionally hedges a slow session start by racing a second gateway
+ * - Keeps repeated bot utterances in a shared cache the gateway can replay
+ *   by content hash instead of resending the audio
+ * - Sheds optional stages along a configured ladder when the box runs
+ *   short of CPU, and stops admitting calls as the last step
+ * - Serves all gateway sockets from a few epoll I/O workers (optionally
+ *   pinned, real-time, with NUMA-local session slots), whose timer wheels
+ *   also pace bot audio playback for every session
  *
- * This module acts as an audio proxy between FreeSWITCH and the Java Nova Gateway.
- * It captures audio from FreeSWITCH channels and streams it via TCP to the Java
- * gateway, which handles Nova Sonic integration, tools, and recording.
+ * nova_ai_session [frame|bug[:mode]|background[:mode]] picks the engine
+ * (default: nova_engine channel variable, then default-engine); nova_sonic
+ * is the same application under the name the earlier media-bug and
+ * frame-loop builds registered.
  *
- * Architecture:
- *   FreeSWITCH (SIP/RTP) <-> mod_nova_sonic (audio proxy) <-> Java Gateway <-> Nova Sonic
+ * nova_ai_session_bg [replace|mix|listen|assist] runs the same session from a
+ * media bug and returns to the dialplan immediately; assist streams both legs
+ * of a bridged call as stereo with per-leg VAD. Sessions in either mode are
+ * controlled with the nova_sonic API:
+ *   nova_sonic status
+ *   nova_sonic <uuid> status|stop|pause|resume
  *
- * Features:
- * - Real-time bidirectional audio streaming via TCP
- * - L16 PCM audio format (8kHz, 16-bit, mono)
- * - Media bug for efficient audio capture
- * - Simple TCP protocol (no encoding needed)
- *
- * Usage:
- *   <action application="nova_sonic" data="gateway_host=localhost,gateway_port=8085"/>
+ * nova_sonic conference <room>[@profile] start|stop joins one Nova session to
+ * a mod_conference room as a member (through a loopback channel), so a whole
+ * room shares a single gateway session instead of one per leg.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <switch.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <math.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "nova_mediad.h"
 
-/* Module interface */
 SWITCH_MODULE_LOAD_FUNCTION(mod_nova_sonic_load);
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_nova_sonic_shutdown);
 SWITCH_MODULE_DEFINITION(mod_nova_sonic, mod_nova_sonic_load, mod_nova_sonic_shutdown, NULL);
 
+#define NOVA_FRAME_SAMPLES 160   /* 20ms at 8kHz */
+#define NOVA_FRAME_BYTES   320   /* 20ms at 8kHz, 16-bit */
+#define NOVA_FRAME_MS      20
+
+/*
+ * Module → gateway framing, announced as "framing":"typed" in the
+ * handshake: after the handshake line every message is a type byte, a
+ * 4-byte big-endian payload length and the payload, so caller audio and
+ * control messages are told apart without looking at the audio. The
+ * gateway → module direction is unchanged.
+ */
+#define NOVA_MSG_AUDIO     0x01  /* PCM16, 320 bytes per channel */
+#define NOVA_MSG_CONTROL   0x02  /* JSON */
+#define NOVA_MSG_HEADER    5
+
+static inline void nova_msg_header(uint8_t *hdr, uint8_t type, uint32_t len) {
+    hdr[0] = type;
+    hdr[1] = (uint8_t)(len >> 24);
+    hdr[2] = (uint8_t)(len >> 16);
+    hdr[3] = (uint8_t)(len >> 8);
+    hdr[4] = (uint8_t)len;
+}
+
+#define NOVA_EVENT_QUALITY "nova_sonic::quality"
+
+/* Stages the degradation ladder can shed, in whatever order it is configured */
+typedef enum {
+    NOVA_SHED_HOLD_DETECT,          /* music detector on live calls */
+    NOVA_SHED_SHADOW,               /* canary mirror for new calls */
+    NOVA_SHED_RESAMPLER,            /* cheapest resampler for new background sessions */
+    NOVA_SHED_ADMISSION,            /* refuse new sessions */
+    NOVA_SHED_COUNT
+} nova_shed_t;
+
+static const char *nova_shed_names[NOVA_SHED_COUNT] = { "hold-detect", "shadow", "resampler", "admission" };
+
 /* Configuration */
 static struct {
     char *gateway_host;
     int gateway_port;
-    int sample_rate;
-    int channels;
-    int bits_per_sample;
-    switch_memory_pool_t *pool;
+
+    /* Gateway pool (gateways=): new sessions go to the lowest RTT + load score */
+    struct nova_gateway *gateways;
+    int gateway_count;
+    switch_mutex_t *gateways_mutex;
+    int probe_interval_ms;
+    int probe_timeout_ms;
+    double rtt_alpha;               /* EWMA weight of a new RTT sample */
+    int load_weight_us;             /* RTT-equivalent cost of one active session */
+    switch_thread_t *probe_thread;
+    volatile int probe_running;
+
+    /* Lazy start: open the gateway session on first caller speech */
+    switch_bool_t lazy_start;
+    int lazy_preroll_ms;
+
+    /* Energy VAD used to detect caller speech */
+    int vad_threshold_db;
+    int vad_onset_ms;
+    int vad_hangover_ms;
+
+    /* Hold/music detection: pause caller streaming during hold music */
+    switch_bool_t hold_detect;
+    int hold_detect_ms;
+    float hold_flatness_max;
+    float hold_periodicity_min;
+
+    /* Audio fork: default targets when nova_fork is not set on the channel */
+    char *fork_targets;
+
+    /* Shadow traffic: mirror sampled calls to a canary gateway */
+    char *shadow_host;
+    int shadow_port;
+    int shadow_sample_percent;
+    int shadow_queue_frames;
+
+    /* Active sessions by call UUID, for the nova_sonic API */
+    switch_hash_t *sessions;
+    switch_mutex_t *sessions_mutex;
+
+    /* Gateway I/O workers */
+    int io_workers;
+    char *io_cpus;                  /* comma separated, worker i pinned to entry i mod n */
+    int io_sched;                   /* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+    int io_priority;
+    int io_slab_sessions;           /* NUMA-local session slots per worker */
+    struct nova_io_worker *workers;
+
+    /* Media engine for nova_ai_session without an argument or nova_engine */
+    char *default_engine;
+
+    /* Channel variables sent in the handshake and, when changed, as "vars" messages */
+    char **export_vars;
+    int export_count;
+    int export_poll_ms;
+
+    /* Gateway hop encryption; records are handed to kernel TLS after the handshake */
+    switch_bool_t tls;
+    char *tls_ca;
+    switch_bool_t tls_verify;
+
+    /* Gateway connections owned by the nova-mediad sidecar, empty keeps them in-process */
+    char *mediad_socket;
+    int mediad_timeout_ms;          /* per connect attempt */
+    int mediad_retries;
+    switch_bool_t mediad_fallback;  /* connect directly while the sidecar is down */
+
+    /* Session blocks in the shared arena, 0 allocates from session pools */
+    int arena_sessions;
+    switch_bool_t arena_hugepages;
+
+    /* Bot audio level, overridable with nova_egress_gain_db */
+    double egress_gain_db;
+
+    /* Caller frames and the gateway writes that carried them */
+    uint64_t tx_frames;
+    uint64_t tx_writes;
+
+    /* Caller-leg RTP statistics sampling, 0 disables */
+    int rtp_stats_interval_sec;
+
+    /* Span export (OTLP/HTTP JSON), empty endpoint disables */
+    char *otlp_endpoint;
+    char *otlp_service;
+    int otlp_queue_spans;
+    int otlp_batch_spans;
+    int otlp_flush_ms;
+
+    /* Hedged start: second gateway raced after hedge_after_ms without "ready" */
+    char *hedge_host;
+    int hedge_port;
+    int hedge_after_ms;
+    int hedge_giveup_ms;
+    uint64_t hedge_sessions;
+    uint64_t hedge_fired;
+    uint64_t hedge_wins;            /* the hedge was ready first */
+    uint64_t hedge_primary_wins;    /* hedged, but the primary was ready first */
+    uint64_t ready_count;
+    uint64_t ready_total_ms;
+    uint32_t ready_max_ms;
+
+    /* Shared cache of bot utterances, 0 disables */
+    int egress_cache_mb;
+
+    /* Egress DTX toward the caller while the bot is silent */
+    switch_bool_t dtx;
+    int dtx_threshold_db;
+    int dtx_hangover_ms;
+    int dtx_sid_interval_ms;
+
+    /* Degradation ladder: the first degrade_level entries are shed */
+    nova_shed_t degrade_ladder[NOVA_SHED_COUNT];
+    int degrade_steps;
+    volatile int degrade_level;
+    int degrade_lateness_us;        /* step down above this average tick lateness */
+    int degrade_cpu_idle_pct;       /* ... or below this much idle CPU */
+    int degrade_recover_sec;        /* healthy seconds before stepping back up */
+    uint32_t degrade_last_lateness_us;
+    int degrade_last_idle_pct;
+    switch_thread_t *degrade_thread;
+    volatile int degrade_running;
 } globals;
 
-/* Audio buffer for streaming */
+/*
+ * μ-law decoder (PCMU → PCM16)
+ * Converts 8-bit μ-law to 16-bit linear PCM
+ */
+static inline int16_t ulaw2linear(uint8_t u) {
+    u = ~u;
+    int t = ((u & 0x0F) << 3) + 0x84;
+    t <<= ((unsigned)u & 0x70) >> 4;
+    return (u & 0x80) ? (int16_t)(0x84 - t) : (int16_t)(t - 0x84);
+}
+
+static void ulaw_to_pcm16(const uint8_t *in, size_t samples, int16_t *out) {
+    for (size_t i = 0; i < samples; i++) {
+        out[i] = ulaw2linear(in[i]);
+    }
+}
+
+/*
+ * μ-law encoder (PCM16 → PCMU)
+ * Converts 16-bit linear PCM to 8-bit μ-law (PCMU)
+ */
+static inline uint8_t linear2ulaw(int16_t sample) {
+    const int cBias = 0x84;  // 132
+    const int cClip = 32635;
+    int sign = (sample >> 8) & 0x80;
+    if (sign) sample = (sample == INT16_MIN) ? INT16_MAX : -sample;
+    if (sample > cClip) sample = cClip;
+    sample += cBias;
+    int exponent = 7;
+    for (int expMask = 0x4000; (sample & expMask) == 0 && exponent > 0; expMask >>= 1) exponent--;
+    int mantissa = (sample >> ((exponent == 0) ? 4 : (exponent + 3))) & 0x0F;
+    return ~(sign | (exponent << 4) | mantissa);
+}
+
+/*
+ * A-law encoder (PCM16 → PCMA)
+ * Converts 16-bit linear PCM to 8-bit A-law (G.711, even bits inverted)
+ */
+static inline uint8_t linear2alaw(int16_t sample) {
+    int pcm = sample >> 3;
+    int mask = 0xD5;
+    if (pcm < 0) {
+        mask = 0x55;
+        pcm = -pcm - 1;
+    }
+    int seg = 0;
+    for (int end = 0x1F; pcm > end && seg < 8; end = (end << 1) | 1) seg++;
+    if (seg >= 8) return (uint8_t)(0x7F ^ mask);
+    int aval = seg << 4;
+    aval |= (seg < 2) ? (pcm >> 1) & 0x0F : (pcm >> seg) & 0x0F;
+    return (uint8_t)(aval ^ mask);
+}
+
+/*
+ * G.711 encode tables
+ * μ-law is defined on 14-bit samples and A-law on 13-bit ones, so both fit in
+ * 24KB and stay in L1 while a batch of frames is encoded. linear2ulaw groups
+ * negative samples by magnitude (-4k-3 .. -4k), not by sample >> 2, so they
+ * are looked up one below their value; -32768 clips like -32767 does. Both
+ * tables match the scalar encoders for every input.
+ */
+static uint8_t ulaw_lut[1 << 14];
+static uint8_t alaw_lut[1 << 13];
+
+static inline uint8_t ulaw_encode(int16_t sample) {
+    int v = sample + (sample >> 15);
+    return ulaw_lut[(uint16_t)(v < INT16_MIN ? INT16_MIN : v) >> 2];
+}
+
+static void g711_tables_init(void) {
+    for (int i = 0; i < (1 << 14); i++) {
+        ulaw_lut[i] = linear2ulaw((int16_t)((i << 2) + ((i & 0x2000) ? 1 : 0)));
+    }
+    for (int i = 0; i < (1 << 13); i++) {
+        alaw_lut[i] = linear2alaw((int16_t)(i << 3));
+    }
+}
+
+/*
+ * Pre-roll ring of decoded caller frames
+ * Holds the most recent frames while no gateway session is open so the
+ * start of the caller's first utterance can be replayed once it is.
+ */
+typedef struct {
+    int16_t *frames;     /* capacity * NOVA_FRAME_SAMPLES */
+    uint32_t capacity;
+    uint32_t head;       /* index of the oldest frame */
+    uint32_t count;
+} preroll_ring_t;
+
+static preroll_ring_t *preroll_ring_create(switch_memory_pool_t *pool, int preroll_ms) {
+    preroll_ring_t *ring = switch_core_alloc(pool, sizeof(preroll_ring_t));
+
+    ring->capacity = preroll_ms > 0 ? (uint32_t)(preroll_ms / NOVA_FRAME_MS) : 0;
+    if (ring->capacity == 0) {
+        ring->capacity = 1;
+    }
+    ring->frames = switch_core_alloc(pool, ring->capacity * NOVA_FRAME_BYTES);
+
+    return ring;
+}
+
+static void preroll_ring_push(preroll_ring_t *ring, const int16_t *pcm) {
+    uint32_t slot;
+
+    if (ring->count == ring->capacity) {
+        /* Full: overwrite the oldest frame */
+        slot = ring->head;
+        ring->head = (ring->head + 1) % ring->capacity;
+    } else {
+        slot = (ring->head + ring->count) % ring->capacity;
+        ring->count++;
+    }
+
+    memcpy(ring->frames + (size_t)slot * NOVA_FRAME_SAMPLES, pcm, NOVA_FRAME_BYTES);
+}
+
+/*
+ * Energy VAD
+ * Flags speech after vad_onset_ms of frames above the threshold and
+ * releases it after vad_hangover_ms below it.
+ */
+typedef struct {
+    int64_t threshold;       /* mean-square energy per sample */
+    int onset_frames;
+    int hangover_frames;
+    int speech_run;
+    int silence_run;
+    switch_bool_t active;
+} nova_vad_t;
+
+static void vad_init(nova_vad_t *vad, int threshold_db, int onset_ms, int hangover_ms) {
+    /* Full-scale mean-square is 32768^2; threshold is relative to that */
+    vad->threshold = (int64_t)(1073741824.0 * pow(10.0, threshold_db / 10.0));
+    vad->onset_frames = onset_ms > NOVA_FRAME_MS ? onset_ms / NOVA_FRAME_MS : 1;
+    vad->hangover_frames = hangover_ms > NOVA_FRAME_MS ? hangover_ms / NOVA_FRAME_MS : 1;
+    vad->speech_run = 0;
+    vad->silence_run = 0;
+    vad->active = SWITCH_FALSE;
+}
+
+static switch_bool_t vad_process(nova_vad_t *vad, const int16_t *pcm, size_t samples) {
+    int64_t energy = 0;
+
+    for (size_t i = 0; i < samples; i++) {
+        energy += (int32_t)pcm[i] * pcm[i];
+    }
+    energy /= (int64_t)samples;
+
+    if (energy >= vad->threshold) {
+        vad->silence_run = 0;
+        if (!vad->active && ++vad->speech_run >= vad->onset_frames) {
+            vad->active = SWITCH_TRUE;
+        }
+    } else {
+        vad->speech_run = 0;
+        if (vad->active && ++vad->silence_run >= vad->hangover_frames) {
+            vad->active = SWITCH_FALSE;
+        }
+    }
+
+    return vad->active;
+}
+
+/*
+ * Hold music detector
+ * Cheap per-frame features: spectral flatness over a few Goertzel bands and
+ * pitch-range periodicity (normalized autocorrelation). Music is continuous
+ * and tonal for seconds at a time, while speech leaves gaps, so a frame is
+ * classified over a one second window of those features.
+ */
+#define MUSIC_BANDS   16
+#define MUSIC_WINDOW  50     /* frames (1s) */
+
+typedef struct {
+    float coeff[MUSIC_BANDS];    /* Goertzel 2*cos(w) per band */
+    float flatness_max;
+    float periodicity_min;
+    int64_t energy_floor;        /* mean-square energy of an active frame */
+    uint8_t active_hist[MUSIC_WINDOW];
+    uint8_t tonal_hist[MUSIC_WINDOW];
+    int hist_pos;
+    int active_count;
+    int tonal_count;
+    int music_run;
+    int detect_frames;
+} nova_music_t;
+
+static void music_detect_init(nova_music_t *md, int64_t energy_floor, int detect_ms,
+                              float flatness_max, float periodicity_min) {
+    memset(md, 0, sizeof(*md));
+
+    /* Linearly spaced bands from 250Hz to 3250Hz at 8kHz */
+    for (int b = 0; b < MUSIC_BANDS; b++) {
+        float freq = 250.0f + b * (3000.0f / (MUSIC_BANDS - 1));
+        md->coeff[b] = 2.0f * cosf(2.0f * (float)M_PI * freq / 8000.0f);
+    }
+
+    md->energy_floor = energy_floor;
+    md->detect_frames = detect_ms > NOVA_FRAME_MS ? detect_ms / NOVA_FRAME_MS : 1;
+    md->flatness_max = flatness_max;
+    md->periodicity_min = periodicity_min;
+}
+
+static float music_flatness(const nova_music_t *md, const int16_t *pcm, size_t samples) {
+    float log_sum = 0.0f, sum = 0.0f;
+
+    for (int b = 0; b < MUSIC_BANDS; b++) {
+        float s1 = 0.0f, s2 = 0.0f;
+        for (size_t i = 0; i < samples; i++) {
+            float s0 = pcm[i] + md->coeff[b] * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+        float power = s1 * s1 + s2 * s2 - md->coeff[b] * s1 * s2 + 1.0f;
+        log_sum += logf(power);
+        sum += power;
+    }
+
+    /* Geometric mean over arithmetic mean: ~0 for tones, ~1 for noise */
+    return expf(log_sum / MUSIC_BANDS) / (sum / MUSIC_BANDS);
+}
+
+static float music_periodicity(const int16_t *pcm, size_t samples) {
+    float x[NOVA_FRAME_SAMPLES / 2];
+    size_t n = samples / 2;
+    float best = 0.0f;
+
+    /* Decimate to 4kHz; lags 10..40 cover 100-400Hz with >= half-frame overlap */
+    for (size_t i = 0; i < n; i++) {
+        x[i] = (float)pcm[2 * i] + (float)pcm[2 * i + 1];
+    }
+
+    for (size_t lag = 10; lag <= n / 2; lag++) {
+        float xy = 0.0f, xx = 0.0f, yy = 0.0f;
+        for (size_t i = 0; i + lag < n; i++) {
+            xy += x[i] * x[i + lag];
+            xx += x[i] * x[i];
+            yy += x[i + lag] * x[i + lag];
+        }
+        if (xx > 0.0f && yy > 0.0f) {
+            float r = xy / sqrtf(xx * yy);
+            if (r > best) best = r;
+        }
+    }
+
+    return best;
+}
+
+/*
+ * Returns true once the last hold_detect_ms of audio looked like music,
+ * and false again as soon as the window stops looking like music.
+ */
+static switch_bool_t music_detect_process(nova_music_t *md, const int16_t *pcm, size_t samples) {
+    int64_t energy = 0;
+    uint8_t active, tonal = 0;
+
+    for (size_t i = 0; i < samples; i++) {
+        energy += (int32_t)pcm[i] * pcm[i];
+    }
+    active = (energy / (int64_t)samples) >= md->energy_floor;
+
+    if (active) {
+        tonal = music_flatness(md, pcm, samples) <= md->flatness_max ||
+                music_periodicity(pcm, samples) >= md->periodicity_min;
+    }
+
+    md->active_count += active - md->active_hist[md->hist_pos];
+    md->tonal_count += tonal - md->tonal_hist[md->hist_pos];
+    md->active_hist[md->hist_pos] = active;
+    md->tonal_hist[md->hist_pos] = tonal;
+    md->hist_pos = (md->hist_pos + 1) % MUSIC_WINDOW;
+
+    /* Continuous (>=95% active) and mostly tonal over the last second */
+    if (md->active_count * 20 >= MUSIC_WINDOW * 19 && md->tonal_count * 2 >= MUSIC_WINDOW) {
+        md->music_run++;
+    } else {
+        md->music_run = 0;
+    }
+
+    return md->music_run >= md->detect_frames;
+}
+
+/*
+ * Gateway TLS
+ * The handshake runs in OpenSSL on the blocking socket; with
+ * SSL_OP_ENABLE_KTLS it installs the record keys on the socket with
+ * setsockopt(SOL_TLS) as the handshake finishes, and the SSL object is
+ * then dropped so every later send, writev and recv on the descriptor is
+ * the same plain call as without TLS. A connection the kernel could not
+ * take over (no tls module, cipher not offloadable) is refused rather than
+ * sent in the clear.
+ *
+ * The version is capped at TLS 1.2: under TLS 1.3 the server sends
+ * session tickets (and may send key updates) after the handshake, which
+ * a plain recv on a kTLS socket cannot consume. Ciphers are limited to
+ * AES-GCM, which every kTLS kernel offloads. The last session to each
+ * gateway is kept for resumption, which skips the key exchange.
+ */
+#define NOVA_TLS_SESSIONS 16
+
 typedef struct {
-    switch_buffer_t *audio_buffer;
+    char key[160];                  /* host:port */
+    SSL_SESSION *session;
+} nova_tls_cached_t;
+
+static struct {
+    SSL_CTX *ctx;
     switch_mutex_t *mutex;
-    switch_thread_cond_t *cond;
-    int finished;
-} audio_stream_t;
+    nova_tls_cached_t cache[NOVA_TLS_SESSIONS];
+    uint32_t next;                  /* cache slot replaced next */
+    uint64_t full;
+    uint64_t resumed;
+    uint64_t full_us;
+    uint64_t resumed_us;
+    uint64_t failures;
+} tls;
+
+static switch_status_t nova_tls_start(switch_memory_pool_t *pool) {
+    if (!globals.tls) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if (!(tls.ctx = SSL_CTX_new(TLS_client_method()))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Gateway TLS context not created\n");
+        return SWITCH_STATUS_FALSE;
+    }
+    SSL_CTX_set_min_proto_version(tls.ctx, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(tls.ctx, TLS1_2_VERSION);
+    SSL_CTX_set_cipher_list(tls.ctx, "ECDHE+AESGCM");
+    SSL_CTX_set_options(tls.ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+    SSL_CTX_set_session_cache_mode(tls.ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+
+    if (globals.tls_verify) {
+        if (!zstr(globals.tls_ca) ? !SSL_CTX_load_verify_locations(tls.ctx, globals.tls_ca, NULL)
+                                  : !SSL_CTX_set_default_verify_paths(tls.ctx)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                "Gateway TLS CA '%s' not loaded\n", zstr(globals.tls_ca) ? "(system)" : globals.tls_ca);
+            SSL_CTX_free(tls.ctx);
+            tls.ctx = NULL;
+            return SWITCH_STATUS_FALSE;
+        }
+        SSL_CTX_set_verify(tls.ctx, SSL_VERIFY_PEER, NULL);
+    }
+
+    switch_mutex_init(&tls.mutex, SWITCH_MUTEX_NESTED, pool);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void nova_tls_stop(void) {
+    for (int i = 0; i < NOVA_TLS_SESSIONS; i++) {
+        if (tls.cache[i].session) {
+            SSL_SESSION_free(tls.cache[i].session);
+            tls.cache[i].session = NULL;
+        }
+    }
+    if (tls.ctx) {
+        SSL_CTX_free(tls.ctx);
+        tls.ctx = NULL;
+    }
+}
+
+/*
+ * Cached session for key, with a reference for the caller, or NULL
+ */
+static SSL_SESSION *nova_tls_cache_get(const char *key) {
+    SSL_SESSION *session = NULL;
+
+    switch_mutex_lock(tls.mutex);
+    for (int i = 0; i < NOVA_TLS_SESSIONS; i++) {
+        if (tls.cache[i].session && !strcmp(tls.cache[i].key, key)) {
+            session = tls.cache[i].session;
+            SSL_SESSION_up_ref(session);
+            break;
+        }
+    }
+    switch_mutex_unlock(tls.mutex);
+
+    return session;
+}
+
+/*
+ * Remember session (the caller's reference) for key
+ */
+static void nova_tls_cache_put(const char *key, SSL_SESSION *session) {
+    nova_tls_cached_t *slot = NULL;
+
+    switch_mutex_lock(tls.mutex);
+    for (int i = 0; i < NOVA_TLS_SESSIONS && !slot; i++) {
+        if (tls.cache[i].session && !strcmp(tls.cache[i].key, key)) {
+            slot = &tls.cache[i];
+        }
+    }
+    if (!slot) {
+        slot = &tls.cache[tls.next];
+        tls.next = (tls.next + 1) % NOVA_TLS_SESSIONS;
+        switch_snprintf(slot->key, sizeof(slot->key), "%s", key);
+    }
+    if (slot->session) {
+        SSL_SESSION_free(slot->session);
+    }
+    slot->session = session;
+    switch_mutex_unlock(tls.mutex);
+}
+
+/*
+ * TLS handshake on a connected socket, leaving it a kTLS socket
+ */
+static switch_status_t nova_tls_wrap(int sock, const char *host, int port) {
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    switch_time_t started = switch_time_now();
+    SSL_SESSION *cached;
+    char key[160], reason[256] = "";
+    int one = 1;
+    SSL *ssl;
+
+    switch_snprintf(key, sizeof(key), "%s:%d", host, port);
+
+    /* Handshake flights are small writes; Nagle against delayed ACK costs ~40ms */
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (!(ssl = SSL_new(tls.ctx))) {
+        goto done;
+    }
+    SSL_set_fd(ssl, sock);
+    SSL_set_tlsext_host_name(ssl, host);
+    if (globals.tls_verify) {
+        SSL_set1_host(ssl, host);
+    }
+    if ((cached = nova_tls_cache_get(key))) {
+        SSL_set_session(ssl, cached);
+        SSL_SESSION_free(cached);
+    }
+
+    if (SSL_connect(ssl) != 1) {
+        ERR_error_string_n(ERR_peek_last_error(), reason, sizeof(reason));
+        if (SSL_get_verify_result(ssl) != X509_V_OK) {
+            switch_snprintf(reason, sizeof(reason), "%s", X509_verify_cert_error_string(SSL_get_verify_result(ssl)));
+        }
+        goto done;
+    }
+    if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) || !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+        switch_snprintf(reason, sizeof(reason), "kernel TLS not available for %s (is the tls module loaded?)",
+            SSL_get_cipher_name(ssl));
+        goto done;
+    }
+
+    if (SSL_session_reused(ssl)) {
+        __atomic_add_fetch(&tls.resumed, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&tls.resumed_us, (uint64_t)(switch_time_now() - started), __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&tls.full, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&tls.full_us, (uint64_t)(switch_time_now() - started), __ATOMIC_RELAXED);
+        nova_tls_cache_put(key, SSL_get1_session(ssl));
+    }
+    status = SWITCH_STATUS_SUCCESS;
+
+done:
+    if (status != SWITCH_STATUS_SUCCESS) {
+        __atomic_add_fetch(&tls.failures, 1, __ATOMIC_RELAXED);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+            "TLS to gateway %s failed: %s\n", key, reason[0] ? reason : "handshake error");
+    }
+    ERR_clear_error();
+    /* The socket BIO does not own the descriptor; keys stay in the kernel.
+     * Marking it shut down keeps SSL_free from invalidating the session. */
+    if (ssl) {
+        SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        SSL_free(ssl);
+    }
+    return status;
+}
 
-/* Nova session context */
+static void nova_tls_status(switch_stream_handle_t *stream) {
+    if (!tls.ctx) {
+        return;
+    }
+    stream->write_function(stream, "gateway-tls: kTLS full=%llu (avg %.1fms) resumed=%llu (avg %.1fms) failures=%llu\n",
+        (unsigned long long)tls.full, tls.full ? tls.full_us / 1000.0 / tls.full : 0.0,
+        (unsigned long long)tls.resumed, tls.resumed ? tls.resumed_us / 1000.0 / tls.resumed : 0.0,
+        (unsigned long long)tls.failures);
+}
+
+/*
+ * Media sidecar
+ * With mediad-socket set, nova-mediad opens the gateway connections rather
+ * than FreeSWITCH (see nova_mediad.h). A link stands in for a gateway
+ * socket: its descriptor is the down ring's eventfd, so an I/O worker polls
+ * it like a socket, and the nova_link_* calls replace send, writev, recv,
+ * shutdown and close wherever a descriptor may be a gateway connection;
+ * any other descriptor passes straight through. While the sidecar is not
+ * reachable, connections are made in-process if mediad-fallback is set. If
+ * it goes away, its links read as closed and their calls end as they would
+ * on a gateway hangup; a sidecar upgrade (--takeover) is not seen here.
+ */
 typedef struct {
-    switch_core_session_t *session;
-    switch_channel_t *channel;
+    nova_link_shm_t *shm;
+    uint32_t id;
+    int memfd;
+    int up_efd;
+    int down_efd;
+    volatile int lock;              /* up ring producers: session thread, I/O worker */
+    volatile int shut;              /* nova_link_shutdown: blocked readers return */
+} nova_link_t;
+
+#define NOVA_LINK_UNAVAILABLE -2    /* sidecar not connected; caller may connect directly */
+
+static struct {
+    int sock;                       /* SOCK_SEQPACKET connection to nova-mediad */
+    switch_mutex_t *mutex;          /* sock and the link table */
+    nova_link_t **links;            /* by down eventfd */
+    int max_fd;
+    uint32_t next_id;
+    switch_thread_t *thread;
+    volatile int running;
+    uint32_t active;
+    uint64_t opened;
+    uint64_t failed;
+    uint64_t fallback;
+    uint64_t lost;                  /* links closed because the sidecar went away */
+    uint64_t connects;
+} mediad = { .sock = -1 };
+
+static inline nova_link_t *nova_link_get(int fd) {
+    return fd >= 0 && fd < mediad.max_fd ? mediad.links[fd] : NULL;
+}
+
+static void nova_link_signal(int efd) {
+    uint64_t one = 1;
+
+    if (write(efd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Sidecar eventfd write: %s\n", strerror(errno));
+    }
+}
+
+static int nova_mediad_send(const nova_mediad_msg_t *msg, const int *fds, int nfds) {
+    char cbuf[CMSG_SPACE(sizeof(int) * 3)];
+    struct iovec iov = { (void *)msg, sizeof(*msg) };
+    struct msghdr mh = { 0 };
+
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (nfds) {
+        struct cmsghdr *cm;
+
+        memset(cbuf, 0, sizeof(cbuf));
+        mh.msg_control = cbuf;
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+    }
+
+    return mediad.sock >= 0 && sendmsg(mediad.sock, &mh, MSG_NOSIGNAL) == (ssize_t)sizeof(*msg) ? 0 : -1;
+}
+
+static void nova_link_close(int fd) {
+    nova_mediad_msg_t msg = { 0 };
+    nova_link_t *link = nova_link_get(fd);
+
+    if (!link) {
+        close(fd);
+        return;
+    }
+
+    switch_mutex_lock(mediad.mutex);
+    mediad.links[fd] = NULL;
+    mediad.active--;
+    msg.type = NOVA_MEDIAD_CLOSE;
+    msg.id = link->id;
+    nova_mediad_send(&msg, NULL, 0);
+    switch_mutex_unlock(mediad.mutex);
+
+    munmap(link->shm, sizeof(nova_link_shm_t));
+    close(link->memfd);
+    close(link->up_efd);
+    close(link->down_efd);
+    free(link);
+}
+
+/*
+ * Gateway connection through the sidecar: the link's descriptor, -1 if the
+ * gateway could not be reached, NOVA_LINK_UNAVAILABLE without a sidecar.
+ * The wait is abandoned once *running (if given) is cleared.
+ */
+static int nova_link_open(const char *host, int port, const volatile int *running) {
+    nova_mediad_msg_t msg = { 0 };
+    nova_link_t *link;
+    switch_time_t deadline;
+    int fds[3];
+
+    if (mediad.sock < 0) {
+        return NOVA_LINK_UNAVAILABLE;
+    }
+
+    if (!(link = calloc(1, sizeof(*link)))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Sidecar link not created: out of memory\n");
+        return NOVA_LINK_UNAVAILABLE;
+    }
+    link->memfd = memfd_create("nova-link", MFD_CLOEXEC);
+    link->up_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    link->down_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (link->memfd < 0 || link->up_efd < 0 || link->down_efd < 0 || link->down_efd >= mediad.max_fd ||
+        ftruncate(link->memfd, sizeof(nova_link_shm_t)) < 0 ||
+        (link->shm = mmap(NULL, sizeof(nova_link_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, link->memfd, 0)) == MAP_FAILED) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Sidecar link not created: %s\n", strerror(errno));
+        if (link->memfd >= 0) {
+            close(link->memfd);
+        }
+        if (link->up_efd >= 0) {
+            close(link->up_efd);
+        }
+        if (link->down_efd >= 0) {
+            close(link->down_efd);
+        }
+        free(link);
+        return NOVA_LINK_UNAVAILABLE;
+    }
+    link->shm->magic = NOVA_MEDIAD_MAGIC;
+    link->shm->state = NOVA_LINK_CONNECTING;
+    /* The I/O worker registers after data may already be queued */
+    link->shm->down.waiting = 1;
+
+    msg.type = NOVA_MEDIAD_OPEN;
+    msg.port = (uint16_t)port;
+    msg.tls = globals.tls ? 1 : 0;
+    msg.retries = (uint32_t)globals.mediad_retries;
+    msg.timeout_ms = (uint32_t)globals.mediad_timeout_ms;
+    switch_snprintf(msg.host, sizeof(msg.host), "%s", host);
+    fds[0] = link->memfd;
+    fds[1] = link->up_efd;
+    fds[2] = link->down_efd;
+
+    switch_mutex_lock(mediad.mutex);
+    msg.id = link->id = ++mediad.next_id;
+    mediad.links[link->down_efd] = link;
+    if (nova_mediad_send(&msg, fds, 3) < 0) {
+        mediad.links[link->down_efd] = NULL;
+        switch_mutex_unlock(mediad.mutex);
+        munmap(link->shm, sizeof(nova_link_shm_t));
+        close(link->memfd);
+        close(link->up_efd);
+        close(link->down_efd);
+        free(link);
+        return NOVA_LINK_UNAVAILABLE;
+    }
+    mediad.active++;
+    switch_mutex_unlock(mediad.mutex);
+
+    /* The state change is signalled; the count is left for the I/O worker */
+    deadline = switch_time_now() + (switch_time_t)(globals.mediad_retries + 1) * (globals.mediad_timeout_ms + 1000) * 1000;
+    while (__atomic_load_n(&link->shm->state, __ATOMIC_ACQUIRE) == NOVA_LINK_CONNECTING && switch_time_now() < deadline &&
+           (!running || *running)) {
+        struct pollfd pfd = { link->down_efd, POLLIN, 0 };
+
+        poll(&pfd, 1, 100);
+    }
+
+    if (__atomic_load_n(&link->shm->state, __ATOMIC_ACQUIRE) != NOVA_LINK_OPEN) {
+        int error = link->shm->error ? link->shm->error : ETIMEDOUT;
+
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+            "Failed to connect to gateway %s:%d via sidecar: %s\n", host, port, strerror(error));
+        __atomic_add_fetch(&mediad.failed, 1, __ATOMIC_RELAXED);
+        nova_link_close(link->down_efd);
+        errno = error;
+        return -1;
+    }
+
+    __atomic_add_fetch(&mediad.opened, 1, __ATOMIC_RELAXED);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+        "Connected to gateway at %s:%d via sidecar (link %u)\n", host, port, link->id);
+    return link->down_efd;
+}
+
+static ssize_t nova_link_writev(int fd, const struct iovec *iov, int n) {
+    nova_link_t *link = nova_link_get(fd);
+    ssize_t want = 0;
+    int ok;
+
+    if (!link) {
+        return writev(fd, iov, n);
+    }
+    if (__atomic_load_n(&link->shm->state, __ATOMIC_ACQUIRE) != NOVA_LINK_OPEN) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    while (__atomic_test_and_set(&link->lock, __ATOMIC_ACQUIRE)) {
+        /* a frame or a control message; never held long */
+    }
+    ok = nova_ring_writev(&link->shm->up, iov, n);
+    __atomic_clear(&link->lock, __ATOMIC_RELEASE);
+
+    /* Four seconds behind: the sidecar is stuck, as a full socket would be */
+    if (!ok) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (nova_ring_wake(&link->shm->up)) {
+        nova_link_signal(link->up_efd);
+    }
+
+    for (int i = 0; i < n; i++) {
+        want += (ssize_t)iov[i].iov_len;
+    }
+    return want;
+}
+
+static ssize_t nova_link_send(int fd, const void *buf, size_t len, int flags) {
+    struct iovec iov = { (void *)buf, len };
+
+    return nova_link_get(fd) ? nova_link_writev(fd, &iov, 1) : send(fd, buf, len, flags | MSG_NOSIGNAL);
+}
+
+/*
+ * recv on a link: MSG_PEEK and MSG_DONTWAIT behave as on a socket; 0 once
+ * the gateway (or the sidecar) is gone and everything it sent is read
+ */
+static ssize_t nova_link_recv(int fd, void *buf, size_t len, int flags) {
+    nova_link_t *link = nova_link_get(fd);
+    nova_ring_t *ring;
+
+    if (!link) {
+        return recv(fd, buf, len, flags);
+    }
+    ring = &link->shm->down;
+
+    for (;;) {
+        size_t got = nova_ring_read(ring, buf, len, flags & MSG_PEEK);
+        uint64_t count;
+        struct pollfd pfd = { fd, POLLIN, 0 };
+
+        if (got) {
+            return (ssize_t)got;
+        }
+        /* Clear the count before re-arming, so a wakeup is never lost */
+        if (read(fd, &count, sizeof(count)) < 0) {
+            /* nothing pending */
+        }
+        if (nova_ring_wait(ring)) {
+            continue;
+        }
+        if (link->shut || __atomic_load_n(&link->shm->state, __ATOMIC_ACQUIRE) != NOVA_LINK_OPEN) {
+            return 0;
+        }
+        if (flags & MSG_DONTWAIT) {
+            errno = EAGAIN;
+            return -1;
+        }
+        poll(&pfd, 1, 100);
+    }
+}
+
+static void nova_link_shutdown(int fd) {
+    nova_link_t *link = nova_link_get(fd);
+
+    if (!link) {
+        shutdown(fd, SHUT_RDWR);
+        return;
+    }
+    link->shut = 1;
+    nova_link_signal(link->down_efd);
+}
+
+/*
+ * Keeps the sidecar connection up; when it drops, every link reads as
+ * closed so its session ends instead of waiting on a dead pump
+ */
+static void *SWITCH_THREAD_FUNC nova_mediad_thread(switch_thread_t *thread, void *obj) {
+    struct sockaddr_un addr = { 0 };
+    switch_bool_t warned = SWITCH_FALSE;
+
+    addr.sun_family = AF_UNIX;
+    switch_snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", globals.mediad_socket);
+
+    while (mediad.running) {
+        struct pollfd pfd;
+        char byte;
+        int sock;
+
+        if (mediad.sock < 0) {
+            if ((sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) >= 0 &&
+                connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+                    "Connected to media sidecar at %s\n", globals.mediad_socket);
+                switch_mutex_lock(mediad.mutex);
+                mediad.sock = sock;
+                mediad.connects++;
+                switch_mutex_unlock(mediad.mutex);
+                warned = SWITCH_FALSE;
+                continue;
+            }
+            if (sock >= 0) {
+                close(sock);
+            }
+            if (!warned) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                    "Media sidecar not reachable at %s: %s%s\n", globals.mediad_socket, strerror(errno),
+                    globals.mediad_fallback ? " - connecting to gateways directly" : "");
+                warned = SWITCH_TRUE;
+            }
+            for (int waited = 0; waited < 1000 && mediad.running; waited += 100) {
+                switch_yield(100000);
+            }
+            continue;
+        }
+
+        /* The sidecar never writes to us; readable means it has gone */
+        pfd.fd = mediad.sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 100) <= 0 || recv(mediad.sock, &byte, 1, MSG_DONTWAIT) > 0) {
+            continue;
+        }
+
+        switch_mutex_lock(mediad.mutex);
+        close(mediad.sock);
+        mediad.sock = -1;
+        for (int fd = 0; fd < mediad.max_fd; fd++) {
+            nova_link_t *link = mediad.links[fd];
+
+            if (link && link->shm->state != NOVA_LINK_CLOSED) {
+                __atomic_store_n(&link->shm->state, NOVA_LINK_CLOSED, __ATOMIC_RELEASE);
+                nova_link_signal(link->down_efd);
+                mediad.lost++;
+            }
+        }
+        switch_mutex_unlock(mediad.mutex);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+            "Media sidecar at %s went away - its %u gateway connections are closed\n",
+            globals.mediad_socket, mediad.active);
+    }
+
+    return NULL;
+}
+
+static void nova_mediad_start(switch_memory_pool_t *pool) {
+    switch_threadattr_t *thd_attr = NULL;
+    struct rlimit rl;
+
+    if (zstr(globals.mediad_socket)) {
+        return;
+    }
+
+    /* Links are found by descriptor, so the table spans the process limit */
+    mediad.max_fd = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (1 << 20)
+                  ? (int)rl.rlim_cur : (1 << 20);
+    mediad.links = switch_core_alloc(pool, sizeof(nova_link_t *) * (size_t)mediad.max_fd);
+    switch_mutex_init(&mediad.mutex, SWITCH_MUTEX_NESTED, pool);
+
+    mediad.running = 1;
+    switch_threadattr_create(&thd_attr, pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    switch_thread_create(&mediad.thread, thd_attr, nova_mediad_thread, NULL, pool);
+}
+
+static void nova_mediad_stop(void) {
+    switch_status_t st;
+
+    if (mediad.thread) {
+        mediad.running = 0;
+        switch_thread_join(&st, mediad.thread);
+        mediad.thread = NULL;
+    }
+    if (mediad.sock >= 0) {
+        close(mediad.sock);
+        mediad.sock = -1;
+    }
+}
+
+static void nova_mediad_status(switch_stream_handle_t *stream) {
+    if (!mediad.links) {
+        return;
+    }
+    stream->write_function(stream, "mediad: %s %s links=%u opened=%llu failed=%llu direct=%llu lost=%llu connects=%llu\n",
+        globals.mediad_socket, mediad.sock >= 0 ? "connected" : "down", mediad.active,
+        (unsigned long long)mediad.opened, (unsigned long long)mediad.failed,
+        (unsigned long long)mediad.fallback, (unsigned long long)mediad.lost,
+        (unsigned long long)mediad.connects);
+}
+
+/*
+ * Audio fork
+ * Tees the decoded caller and bot streams to secondary consumers without
+ * another media bug. Each subscriber owns a bounded frame ring, a drop
+ * policy and a transport, and a sender thread that does all of its I/O, so
+ * publishing from the media thread never waits on a consumer.
+ *
+ * Target syntax (comma separated):
+ *   tcp://host:port[?legs=both|caller|bot&queue=<frames>&drop=oldest|newest]
+ *   udp://host:port[?...]
+ *
+ * Consumers receive a JSON header line, then one packet per frame:
+ *   leg tag (1 byte: 0x01 caller, 0x02 bot) + ms since start (4 bytes BE)
+ *   + 320 bytes PCM16. Over UDP each packet is one datagram.
+ */
+#define FORK_LEG_CALLER     0x01
+#define FORK_LEG_BOT        0x02
+#define FORK_PACKET_BYTES   (1 + 4 + NOVA_FRAME_BYTES)
+#define FORK_DEFAULT_QUEUE  50      /* frames (1s per leg) */
+#define FORK_CONNECT_MS     2000    /* connect, and TLS handshake for a gateway */
+#define FORK_SEND_MS        1000    /* SO_SNDTIMEO once connected */
+
+typedef enum {
+    FORK_DROP_OLDEST,
+    FORK_DROP_NEWEST
+} fork_drop_policy_t;
+
+typedef struct fork_subscriber {
+    char *target;
+    char *host;
+    int port;
+    int sock_type;                  /* SOCK_STREAM or SOCK_DGRAM */
+    uint8_t legs;
+    fork_drop_policy_t drop_policy;
+
+    /* Bounded packet ring, guarded by mutex */
+    uint8_t *slots;                 /* capacity * FORK_PACKET_BYTES */
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t count;
+    switch_mutex_t *mutex;
+    switch_thread_cond_t *cond;
+
+    switch_bool_t raw;              /* gateway framing: PCM16 only, no tag/timestamp */
+    volatile int sock;
+    volatile int connecting;        /* socket while connecting, so fork_stop can shut it */
+    switch_time_t connected_at;
+    volatile int running;
+    volatile int failed;
+    uint32_t sent;
+    uint32_t dropped;
+    const char *header;             /* JSON header line sent on connect */
+    switch_thread_t *thread;
+    struct fork_subscriber *next;
+} fork_subscriber_t;
+
+typedef struct {
+    fork_subscriber_t *subscribers;
+    switch_time_t start_time;
+} nova_fork_t;
+
+/*
+ * Parse one fork target into a subscriber
+ */
+static fork_subscriber_t *fork_subscriber_parse(switch_memory_pool_t *pool, const char *target) {
+    fork_subscriber_t *sub = switch_core_alloc(pool, sizeof(fork_subscriber_t));
+    char *spec = switch_core_strdup(pool, target);
+    char *opts, *port;
+    uint32_t queue = FORK_DEFAULT_QUEUE;
+
+    sub->target = switch_core_strdup(pool, target);
+    sub->legs = FORK_LEG_CALLER | FORK_LEG_BOT;
+    sub->drop_policy = FORK_DROP_OLDEST;
+    sub->sock = -1;
+    sub->connecting = -1;
+
+    if (!strncasecmp(spec, "tcp://", 6)) {
+        sub->sock_type = SOCK_STREAM;
+    } else if (!strncasecmp(spec, "udp://", 6)) {
+        sub->sock_type = SOCK_DGRAM;
+    } else {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+            "Audio fork target '%s' must start with tcp:// or udp://\n", target);
+        return NULL;
+    }
+    spec += 6;
+
+    if ((opts = strchr(spec, '?'))) {
+        *opts++ = '\0';
+    }
+
+    if (!(port = strrchr(spec, ':')) || atoi(port + 1) <= 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+            "Audio fork target '%s' has no port\n", target);
+        return NULL;
+    }
+    *port++ = '\0';
+    sub->host = spec;
+    sub->port = atoi(port);
+
+    while (opts && *opts) {
+        char *next = strchr(opts, '&');
+        char *val;
+
+        if (next) *next++ = '\0';
+        if ((val = strchr(opts, '='))) {
+            *val++ = '\0';
+            if (!strcasecmp(opts, "legs")) {
+                sub->legs = !strcasecmp(val, "caller") ? FORK_LEG_CALLER :
+                            !strcasecmp(val, "bot") ? FORK_LEG_BOT : (FORK_LEG_CALLER | FORK_LEG_BOT);
+            } else if (!strcasecmp(opts, "queue") && atoi(val) > 0) {
+                queue = (uint32_t)atoi(val);
+            } else if (!strcasecmp(opts, "drop")) {
+                sub->drop_policy = !strcasecmp(val, "newest") ? FORK_DROP_NEWEST : FORK_DROP_OLDEST;
+            }
+        }
+        opts = next;
+    }
+
+    sub->capacity = queue;
+    sub->slots = switch_core_alloc(pool, (switch_size_t)queue * FORK_PACKET_BYTES);
+    switch_mutex_init(&sub->mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_thread_cond_create(&sub->cond, pool);
+
+    return sub;
+}
+
+/*
+ * Connect a subscriber's transport (runs on its sender thread). Bounded by
+ * FORK_CONNECT_MS and abandoned as soon as the subscriber is stopped, so a
+ * consumer that does not answer never holds up fork_stop.
+ */
+static int fork_connect(fork_subscriber_t *sub) {
+    struct addrinfo hints, *res = NULL;
+    struct timeval tv = { FORK_CONNECT_MS / 1000, 0 };
+    struct timeval send_tv = { FORK_SEND_MS / 1000, (FORK_SEND_MS % 1000) * 1000 };
+    struct timeval no_tv = { 0, 0 };
+    struct pollfd pfd;
+    char port[16];
+    int sock, err = 0, waited = 0, ready = 0;
+    socklen_t errlen = sizeof(err);
+
+    /* A raw subscriber is a gateway (shadow traffic): the sidecar owns it too */
+    if (sub->raw && mediad.links) {
+        if ((sock = nova_link_open(sub->host, sub->port, &sub->running)) != NOVA_LINK_UNAVAILABLE ||
+            !globals.mediad_fallback) {
+            return sock < 0 ? -1 : sock;
+        }
+        __atomic_add_fetch(&mediad.fallback, 1, __ATOMIC_RELAXED);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = sub->sock_type;
+    switch_snprintf(port, sizeof(port), "%d", sub->port);
+
+    if (getaddrinfo(sub->host, port, &hints, &res) != 0 || !res) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+            "Audio fork: failed to resolve %s\n", sub->target);
+        return -1;
+    }
+
+    if ((sock = socket(res->ai_family, res->ai_socktype, 0)) < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+    switch_mutex_lock(sub->mutex);
+    sub->connecting = sock;
+    switch_mutex_unlock(sub->mutex);
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    if (connect(sock, res->ai_addr, res->ai_addrlen) == 0) {
+        ready = 1;
+    } else if (errno == EINPROGRESS) {
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        while (sub->running && waited < FORK_CONNECT_MS && !(ready = poll(&pfd, 1, 100))) {
+            waited += 100;
+        }
+        ready = ready == 1 && !getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &errlen) && !err;
+        if (err) {
+            errno = err;
+        } else if (!ready) {
+            errno = ETIMEDOUT;
+        }
+    }
+    freeaddrinfo(res);
+
+    if (ready) {
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &send_tv, sizeof(send_tv));
+
+        /* A raw subscriber is a gateway (shadow traffic) and gets the same transport */
+        if (sub->raw && tls.ctx) {
+            setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            ready = nova_tls_wrap(sock, sub->host, sub->port) == SWITCH_STATUS_SUCCESS;
+            setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &send_tv, sizeof(send_tv));
+            setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &no_tv, sizeof(no_tv));
+        }
+    }
+
+    switch_mutex_lock(sub->mutex);
+    sub->connecting = -1;
+    switch_mutex_unlock(sub->mutex);
+
+    if (!ready) {
+        if (sub->running) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                "%s: failed to connect to %s: %s\n", sub->raw ? "Gateway" : "Audio fork", sub->target, strerror(errno));
+        }
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static void *SWITCH_THREAD_FUNC fork_send_thread(switch_thread_t *thread, void *obj) {
+    fork_subscriber_t *sub = (fork_subscriber_t *)obj;
+    uint8_t packet[FORK_PACKET_BYTES];
+    int sock = fork_connect(sub);
+    int running;
+
+    /* Published under the mutex so fork_stop either sees it or we see it stopped */
+    switch_mutex_lock(sub->mutex);
+    sub->sock = sock;
+    running = sub->running;
+    switch_mutex_unlock(sub->mutex);
+
+    if (sock < 0 || !running || nova_link_send(sock, sub->header, strlen(sub->header), 0) < 0) {
+        sub->failed = 1;
+        return NULL;
+    }
+
+    sub->connected_at = switch_time_now();
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+        "Audio fork connected to %s\n", sub->target);
+
+    while (1) {
+        switch_mutex_lock(sub->mutex);
+        while (sub->count == 0 && sub->running) {
+            switch_thread_cond_timedwait(sub->cond, sub->mutex, 100000);
+        }
+        if (sub->count == 0 || !sub->running) {
+            switch_mutex_unlock(sub->mutex);
+            break;
+        }
+        memcpy(packet, sub->slots + (size_t)sub->head * FORK_PACKET_BYTES, FORK_PACKET_BYTES);
+        sub->head = (sub->head + 1) % sub->capacity;
+        sub->count--;
+        switch_mutex_unlock(sub->mutex);
+
+        /* A gateway gets the same bytes with the tag and timestamp replaced by its message header */
+        if (sub->raw) {
+            nova_msg_header(packet, NOVA_MSG_AUDIO, NOVA_FRAME_BYTES);
+        }
+        if (nova_link_send(sub->sock, packet, FORK_PACKET_BYTES, 0) < 0) {
+            /* fork_stop shuts the socket down under a blocked send; that is not a failure */
+            if (sub->running) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                    "Audio fork: send to %s failed: %s\n", sub->target, strerror(errno));
+                sub->failed = 1;
+            }
+            break;
+        }
+        sub->sent++;
+    }
+
+    return NULL;
+}
+
+/*
+ * Create subscribers for a comma separated target list and start their senders
+ */
+static nova_fork_t *fork_create(switch_memory_pool_t *pool, const char *targets, const char *header) {
+    nova_fork_t *fork = switch_core_alloc(pool, sizeof(nova_fork_t));
+    char *list = switch_core_strdup(pool, targets);
+    char *argv[16];
+    unsigned int argc = switch_separate_string(list, ',', argv, 16);
+    switch_threadattr_t *thd_attr = NULL;
+
+    fork->start_time = switch_time_now();
+    switch_threadattr_create(&thd_attr, pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+
+    for (unsigned int i = 0; i < argc; i++) {
+        fork_subscriber_t *sub;
+
+        if (zstr(argv[i]) || !(sub = fork_subscriber_parse(pool, argv[i]))) {
+            continue;
+        }
+
+        sub->header = header;
+        sub->running = 1;
+        if (switch_thread_create(&sub->thread, thd_attr, fork_send_thread, sub, pool) != SWITCH_STATUS_SUCCESS) {
+            sub->failed = 1;
+            continue;
+        }
+
+        sub->next = fork->subscribers;
+        fork->subscribers = sub;
+    }
+
+    return fork->subscribers ? fork : NULL;
+}
+
+/*
+ * Publish one decoded frame to every subscriber of that leg; never blocks on I/O
+ */
+static void fork_publish(nova_fork_t *fork, uint8_t leg, const int16_t *pcm) {
+    uint32_t ts = (uint32_t)((switch_time_now() - fork->start_time) / 1000);
+
+    for (fork_subscriber_t *sub = fork->subscribers; sub; sub = sub->next) {
+        uint8_t *slot;
+
+        if (!(sub->legs & leg)) {
+            continue;
+        }
+        if (sub->failed) {
+            sub->dropped++;
+            continue;
+        }
+
+        switch_mutex_lock(sub->mutex);
+        if (sub->count == sub->capacity) {
+            sub->dropped++;
+            if (sub->drop_policy == FORK_DROP_NEWEST) {
+                switch_mutex_unlock(sub->mutex);
+                continue;
+            }
+            sub->head = (sub->head + 1) % sub->capacity;
+            sub->count--;
+        }
+
+        slot = sub->slots + (size_t)((sub->head + sub->count) % sub->capacity) * FORK_PACKET_BYTES;
+        slot[0] = leg;
+        slot[1] = (uint8_t)(ts >> 24);
+        slot[2] = (uint8_t)(ts >> 16);
+        slot[3] = (uint8_t)(ts >> 8);
+        slot[4] = (uint8_t)ts;
+        memcpy(slot + 5, pcm, NOVA_FRAME_BYTES);
+        sub->count++;
+        switch_thread_cond_signal(sub->cond);
+        switch_mutex_unlock(sub->mutex);
+    }
+}
+
+/*
+ * Stop a sender without waiting on its consumer: what is still queued is
+ * dropped and the transport is shut down first, so a send blocked on a slow
+ * consumer returns at once and the join that follows is short
+ */
+static void fork_stop(fork_subscriber_t *sub) {
+    switch_mutex_lock(sub->mutex);
+    sub->running = 0;
+    if (sub->sock >= 0) {
+        nova_link_shutdown(sub->sock);
+    }
+    if (sub->connecting >= 0) {
+        shutdown(sub->connecting, SHUT_RDWR);
+    }
+    switch_thread_cond_broadcast(sub->cond);
+    switch_mutex_unlock(sub->mutex);
+}
+
+/*
+ * Stop all senders and close their transports
+ */
+static uint32_t fork_destroy(nova_fork_t *fork) {
+    uint32_t dropped = 0;
+
+    for (fork_subscriber_t *sub = fork->subscribers; sub; sub = sub->next) {
+        fork_stop(sub);
+    }
+
+    for (fork_subscriber_t *sub = fork->subscribers; sub; sub = sub->next) {
+        switch_status_t st;
+
+        switch_thread_join(&st, sub->thread);
+        if (sub->sock >= 0) {
+            nova_link_close(sub->sock);
+        }
+        sub->dropped += sub->count;
+
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+            "Audio fork %s closed: %u frames sent, %u dropped%s\n",
+            sub->target, sub->sent, sub->dropped, sub->failed ? " (failed)" : "");
+        dropped += sub->dropped;
+    }
+
+    return dropped;
+}
+
+/*
+ * Gateway latency stats
+ * Time to connect, time from handshake to the first bot audio, and per-turn
+ * response latency: from the end of caller speech to the start of the next
+ * bot utterance. Kept for the primary gateway and for a shadow gateway so
+ * the two can be compared on the same call.
+ */
+#define BOT_TURN_GAP_US 200000  /* bot audio after this much silence starts a new turn */
+
+typedef struct {
+    switch_time_t opened_at;
+    int connect_ms;
+    int first_audio_ms;              /* -1 until the first bot frame */
+    uint32_t turns;
+    int64_t response_total_ms;
+    int response_max_ms;
+    switch_time_t last_audio_at;
+    switch_time_t last_speech_end;   /* caller speech end already answered */
+} nova_latency_t;
+
+static void latency_init(nova_latency_t *lat) {
+    memset(lat, 0, sizeof(*lat));
+    lat->opened_at = switch_time_now();
+    lat->first_audio_ms = -1;
+}
+
+static void latency_on_audio(nova_latency_t *lat, switch_time_t speech_end) {
+    switch_time_t now = switch_time_now();
+
+    if (lat->first_audio_ms < 0) {
+        lat->first_audio_ms = (int)((now - lat->opened_at) / 1000);
+    }
+
+    if (now - lat->last_audio_at > BOT_TURN_GAP_US &&
+        speech_end > lat->last_speech_end && speech_end < now) {
+        int ms = (int)((now - speech_end) / 1000);
+        lat->turns++;
+        lat->response_total_ms += ms;
+        if (ms > lat->response_max_ms) {
+            lat->response_max_ms = ms;
+        }
+        lat->last_speech_end = speech_end;
+    }
+
+    lat->last_audio_at = now;
+}
+
+static int latency_response_avg_ms(const nova_latency_t *lat) {
+    return lat->turns ? (int)(lat->response_total_ms / lat->turns) : -1;
+}
+
+/*
+ * Read the next message from a gateway socket
+ * Gateway → module is 320-byte PCM16 frames, interleaved with control
+ * messages framed as a 4-byte big-endian length (never 320) + JSON.
+ */
+typedef enum {
+    GW_MSG_CLOSED,
+    GW_MSG_AUDIO,
+    GW_MSG_CONTROL
+} gw_msg_t;
+
+static int recv_exact(int sock, void *buf, size_t len) {
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t r = nova_link_recv(sock, (uint8_t *)buf + got, len - got, 0);
+        if (r <= 0) {
+            return -1;
+        }
+        got += (size_t)r;
+    }
+
+    return 0;
+}
+
+static gw_msg_t gateway_recv_message(int sock, uint8_t *frame, char *control, size_t control_size) {
+    /* Peek at first 4 bytes to check if this is a control message */
+    uint8_t header[4];
+    ssize_t peeked = nova_link_recv(sock, header, 4, MSG_PEEK);
+
+    if (peeked <= 0) {
+        return GW_MSG_CLOSED;
+    }
+
+    if (peeked == 4) {
+        /* Control messages are typically < 1KB, audio is exactly 320 bytes */
+        uint32_t length = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                          ((uint32_t)header[2] << 8) | header[3];
+
+        if (length > 0 && length < 1024 && length != NOVA_FRAME_BYTES && length < control_size) {
+            if (recv_exact(sock, header, 4) < 0 || recv_exact(sock, control, length) < 0) {
+                return GW_MSG_CLOSED;
+            }
+            control[length] = '\0';
+            return GW_MSG_CONTROL;
+        }
+    }
+
+    /* Read exact 320 bytes of PCM16 audio (blocking until complete frame received) */
+    if (recv_exact(sock, frame, NOVA_FRAME_BYTES) < 0) {
+        return GW_MSG_CLOSED;
+    }
+
+    return GW_MSG_AUDIO;
+}
+
+/*
+ * Shadow gateway session
+ * A listen-only second session on a canary gateway for sampled calls. Caller
+ * audio goes through a bounded drop-oldest ring and a sender thread (the
+ * fork subscriber machinery in gateway framing), and a receive thread
+ * discards the canary's output while recording its latency, so the primary
+ * call path never waits on the canary.
+ */
+typedef struct {
+    fork_subscriber_t *sub;
+    nova_fork_t tee;                 /* single-subscriber fork wrapping sub */
+    nova_latency_t latency;
+    volatile switch_time_t *speech_end;
+    switch_thread_t *recv_thread;
+    volatile int running;
+} nova_shadow_t;
+
+static void *SWITCH_THREAD_FUNC shadow_recv_thread(switch_thread_t *thread, void *obj) {
+    nova_shadow_t *shadow = (nova_shadow_t *)obj;
+    uint8_t frame[NOVA_FRAME_BYTES];
+    char control[1024];
+
+    /* The sender thread owns the connect */
+    while (shadow->running && shadow->sub->sock < 0 && !shadow->sub->failed) {
+        switch_yield(10000);
+    }
+
+    if (shadow->sub->sock >= 0) {
+        shadow->latency.connect_ms = (int)((shadow->sub->connected_at - shadow->latency.opened_at) / 1000);
+    }
+
+    while (shadow->running && shadow->sub->sock >= 0) {
+        gw_msg_t msg = gateway_recv_message(shadow->sub->sock, frame, control, sizeof(control));
+
+        if (msg == GW_MSG_CLOSED) {
+            break;
+        }
+        if (msg == GW_MSG_AUDIO) {
+            latency_on_audio(&shadow->latency, *shadow->speech_end);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Deterministic per-call sampling: FNV-1a of the call UUID into [0, 100)
+ */
+static switch_bool_t shadow_sampled(const char *uuid) {
+    uint32_t hash = 2166136261u;
+
+    if (globals.shadow_sample_percent <= 0) {
+        return SWITCH_FALSE;
+    }
+
+    for (; *uuid; uuid++) {
+        hash ^= (uint8_t)*uuid;
+        hash *= 16777619u;
+    }
+
+    return (hash % 100) < (uint32_t)globals.shadow_sample_percent ? SWITCH_TRUE : SWITCH_FALSE;
+}
+
+static nova_shadow_t *shadow_create(switch_memory_pool_t *pool, const char *handshake,
+                                    volatile switch_time_t *speech_end) {
+    nova_shadow_t *shadow = switch_core_alloc(pool, sizeof(nova_shadow_t));
+    switch_threadattr_t *thd_attr = NULL;
+    const char *target = switch_core_sprintf(pool, "tcp://%s:%d?legs=caller&queue=%d&drop=oldest",
+                                             globals.shadow_host, globals.shadow_port,
+                                             globals.shadow_queue_frames);
+
+    if (!(shadow->sub = fork_subscriber_parse(pool, target))) {
+        return NULL;
+    }
+
+    shadow->sub->raw = SWITCH_TRUE;
+    shadow->tee.subscribers = shadow->sub;
+    shadow->tee.start_time = switch_time_now();
+    shadow->sub->header = handshake;
+    shadow->sub->running = 1;
+    shadow->speech_end = speech_end;
+    shadow->running = 1;
+    latency_init(&shadow->latency);
+
+    switch_threadattr_create(&thd_attr, pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+
+    if (switch_thread_create(&shadow->sub->thread, thd_attr, fork_send_thread, shadow->sub, pool) != SWITCH_STATUS_SUCCESS) {
+        return NULL;
+    }
+
+    if (switch_thread_create(&shadow->recv_thread, thd_attr, shadow_recv_thread, shadow, pool) != SWITCH_STATUS_SUCCESS) {
+        shadow->recv_thread = NULL;
+    }
+
+    return shadow;
+}
+
+/*
+ * Shut the canary connection down first, then join: neither thread is left
+ * waiting on the canary, whatever state it is in
+ */
+static void shadow_destroy(nova_shadow_t *shadow) {
+    fork_subscriber_t *sub = shadow->sub;
+    switch_status_t st;
+
+    shadow->running = 0;
+    fork_stop(sub);
+    switch_thread_join(&st, sub->thread);
+    if (shadow->recv_thread) {
+        switch_thread_join(&st, shadow->recv_thread);
+    }
+    if (sub->sock >= 0) {
+        nova_link_close(sub->sock);
+    }
+}
+
+/*
+ * Egress ring: bot audio queued ready to send
+ * Single producer, single consumer. The producer is always the session's
+ * I/O worker, which encodes each gateway frame into a slot in the channel's
+ * codec under its mutex. In blocking mode the consumer is the same worker's
+ * egress tick: it points write_frame.data at the slot outside the mutex and
+ * releases it after the write. In background modes it is the media bug
+ * thread. Either way no per-frame conversion runs on the consumer.
+ */
+#define EGRESS_SLOTS 64             /* power of two, ~1.3s of bot audio */
+
+typedef enum {
+    EGRESS_L16,                     /* background modes: media bug frames are linear */
+    EGRESS_PCMU,
+    EGRESS_PCMA
+} egress_format_t;
+
+typedef struct {
+    uint32_t datalen;
+    uint32_t peak;                  /* largest absolute sample, for DTX */
+    uint8_t data[NOVA_FRAME_BYTES];
+} egress_slot_t;
+
+typedef struct {
+    egress_slot_t slots[EGRESS_SLOTS];
+    egress_format_t format;
+    uint32_t head;                  /* next slot to play, consumer owned */
+    uint32_t tail;                  /* next slot to fill, producer owned */
+    uint32_t overflows;
+} egress_ring_t;
+
+static uint32_t egress_ring_count(egress_ring_t *ring) {
+    return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Next free slot for the producer to fill, or NULL (counted) when full
+ */
+static egress_slot_t *egress_ring_reserve(egress_ring_t *ring) {
+    uint32_t tail = ring->tail;
+
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == EGRESS_SLOTS) {
+        ring->overflows++;
+        return NULL;
+    }
+
+    return &ring->slots[tail & (EGRESS_SLOTS - 1)];
+}
+
+static void egress_ring_commit(egress_ring_t *ring) {
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Oldest ready slot, or NULL; stays owned by the consumer until released
+ */
+static egress_slot_t *egress_ring_peek(egress_ring_t *ring) {
+    uint32_t head = ring->head;
+
+    if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) {
+        return NULL;
+    }
+
+    return &ring->slots[head & (EGRESS_SLOTS - 1)];
+}
+
+static void egress_ring_release(egress_ring_t *ring) {
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static egress_format_t egress_format_for(const switch_codec_t *codec) {
+    if (codec && codec->implementation && !strcasecmp(codec->implementation->iananame, "PCMA")) {
+        return EGRESS_PCMA;
+    }
+
+    return EGRESS_PCMU;
+}
+
+/*
+ * Egress DTX
+ * After dtx-hangover-ms without audible bot audio (nothing queued, or
+ * frames below the threshold) the caller gets one RFC 3389 SID frame and
+ * then nothing but a SID refresh every dtx-sid-interval-ms, until the next
+ * audible bot frame. The SID is written as a CNG frame: FreeSWITCH sends it
+ * with the channel's CN payload type when CN was negotiated and drops it
+ * otherwise, which leaves plain silence suppression.
+ */
+typedef enum {
+    DTX_PLAY,                       /* play the queued frame, if any */
+    DTX_SID,                        /* send a comfort-noise update, discard the frame */
+    DTX_IDLE                        /* send nothing, discard the frame */
+} dtx_action_t;
+
+typedef struct {
+    uint32_t threshold;             /* peak at or below which a frame counts as silence */
+    uint32_t hangover_ticks;
+    uint32_t sid_ticks;
+    uint32_t quiet_ticks;
+    uint32_t since_sid;
+    uint32_t noise_peak;            /* loudest quiet frame since the last SID */
+    switch_bool_t active;
+    uint8_t level;                  /* -dBov of the last SID */
+    uint32_t sids;
+    uint32_t suppressed;
+} nova_dtx_t;
+
+static void dtx_init(nova_dtx_t *dtx, int threshold_db, int hangover_ms, int sid_interval_ms) {
+    memset(dtx, 0, sizeof(*dtx));
+    dtx->threshold = (uint32_t)(32768.0 * pow(10.0, threshold_db / 20.0));
+    dtx->hangover_ticks = (uint32_t)(hangover_ms / NOVA_FRAME_MS);
+    dtx->sid_ticks = (uint32_t)(sid_interval_ms / NOVA_FRAME_MS);
+    if (dtx->sid_ticks < 1) {
+        dtx->sid_ticks = 1;
+    }
+}
+
+/*
+ * RFC 3389 noise level: 0..127 in -dBov
+ */
+static uint8_t dtx_level(uint32_t peak) {
+    double dbov;
+
+    if (peak == 0) {
+        return 127;
+    }
+    dbov = -20.0 * log10(peak / 32768.0);
+    return (uint8_t)(dbov > 127.0 ? 127 : dbov < 0.0 ? 0 : (int)dbov);
+}
+
+/*
+ * Decide what one 20ms egress tick sends; slot is the queued frame or NULL
+ */
+static dtx_action_t dtx_tick(nova_dtx_t *dtx, const egress_slot_t *slot) {
+    if (slot && slot->peak > dtx->threshold) {
+        dtx->quiet_ticks = 0;
+        dtx->noise_peak = 0;
+        dtx->active = SWITCH_FALSE;
+        return DTX_PLAY;
+    }
+
+    if (slot && slot->peak > dtx->noise_peak) {
+        dtx->noise_peak = slot->peak;
+    }
+    if (dtx->quiet_ticks < dtx->hangover_ticks) {
+        dtx->quiet_ticks++;
+        return DTX_PLAY;
+    }
+
+    if (!dtx->active || ++dtx->since_sid >= dtx->sid_ticks) {
+        dtx->active = SWITCH_TRUE;
+        dtx->since_sid = 0;
+        dtx->level = dtx_level(dtx->noise_peak);
+        dtx->noise_peak = 0;
+        dtx->sids++;
+        return DTX_SID;
+    }
+
+    if (slot) {
+        dtx->suppressed++;
+    }
+    return DTX_IDLE;
+}
+
+/*
+ * Call quality inputs, updated on the playout path
+ */
+typedef struct {
+    uint32_t ticks;                 /* playout ticks during bot turns */
+    uint32_t underruns;             /* ... with no bot audio ready, concealed by the channel */
+    uint64_t queued_ms_total;       /* playout queue depth summed over those ticks */
+    uint32_t barge_ins;
+    uint64_t barge_stop_ms_total;   /* caller onset to the bot going quiet */
+    switch_time_t barge_at;         /* barge-in waiting for the bot to stop */
+} nova_quality_t;
+
+/*
+ * Caller-leg RTP statistics, as last sampled from the channel
+ */
+typedef struct {
+    uint32_t samples;
+    uint32_t frames;                /* caller frames since the last sample */
+    double jitter_ms;               /* inter-arrival standard deviation */
+    double jitter_max_ms;           /* worst seen at any sample */
+    double loss_pct;
+    uint32_t flaws;                 /* sequence gaps and reordering */
+    uint32_t packets;
+    uint32_t skipped;
+    double mos;                     /* FreeSWITCH's own inbound estimate */
+} nova_rtp_t;
+
+/*
+ * Caller audio waiting for one write to the gateway
+ */
+#define NOVA_TX_MAX_FRAMES 8
+
+typedef struct {
+    uint8_t buf[NOVA_TX_MAX_FRAMES * (NOVA_MSG_HEADER + NOVA_FRAME_BYTES * 2)];
+    uint32_t len;
+    uint32_t frames;
+    uint32_t total_frames;          /* this connection, for status and nova_tx_* */
+    uint32_t total_writes;
+} nova_tx_t;
+
+typedef enum {
+    HEDGE_OFF,                      /* gateway not opened yet */
+    HEDGE_WAITING,                  /* primary opened, not ready yet */
+    HEDGE_CONNECTING,               /* hedge connect and handshake on their own thread */
+    HEDGE_RACING,                   /* both opened, first ready wins */
+    HEDGE_DONE
+} nova_hedge_state_t;
+
+#define HEDGE_CONTROL_BYTES 8192        /* backlog room for control messages */
+#define HEDGE_WRITE_CHUNK   16384       /* per send; well under a sidecar ring */
+
+/*
+ * Everything written to the primary gateway since it opened, for replay to
+ * the hedge; while racing, what the hedge socket has not taken yet
+ */
+typedef struct {
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t len;
+    uint32_t sent;
+} nova_hedge_tx_t;
+
+/*
+ * How a session is attached to the channel
+ * Blocking runs the audio loop on the channel thread (nova_ai_session); the
+ * background modes run from a media bug (nova_ai_session_bg) and differ in
+ * what happens to the audio written to the caller.
+ */
+typedef enum {
+    NOVA_MODE_BLOCKING,
+    NOVA_MODE_REPLACE,              // Bot audio (or silence) replaces the write stream
+    NOVA_MODE_MIX,                  // Bot audio is mixed over the write stream
+    NOVA_MODE_LISTEN,               // Bot audio is consumed but never played
+    NOVA_MODE_ASSIST                // Both legs as stereo, bot audio never played
+} nova_mode_t;
+
+static const char *nova_mode_names[] = { "blocking", "replace", "mix", "listen", "assist" };
+
+typedef struct nova_io_slot nova_io_slot_t;
+
+/*
+ * Nova session context
+ */
+typedef struct {
+    switch_core_session_t *session;
+    switch_channel_t *channel;
+    switch_memory_pool_t *pool;
+    nova_mode_t mode;
+
+    char session_id[128];
+    char caller_id[128];
+
+    int gateway_socket;
+    char *gateway_host;
+    int gateway_port;
+    struct nova_gateway *gw;        // Pool entry this session counts against, if any
+    nova_tx_t tx;                   // Caller audio not yet written to gateway_socket
+
+    egress_ring_t *egress;          // Bot audio from Nova, encoded for the channel
+    int32_t egress_gain;            // Q12 gain applied to bot audio before encoding
+
+    /* Caller speech detection and lazy start */
+    nova_vad_t vad;
+    switch_bool_t lazy_start;
+    preroll_ring_t *preroll;        // Caller audio held until the gateway is open
+    switch_time_t start_time;
+
+    /* Hold music detection */
+    switch_bool_t hold_detect;
+    nova_music_t music;
+    switch_bool_t paused;           // Caller streaming paused during hold
+    switch_time_t paused_at;
+    switch_time_t paused_total;
+
+    nova_fork_t *fork;              // Secondary consumers of decoded audio
+
+    /* Gateway latency and shadow comparison */
+    nova_latency_t latency;
+    volatile switch_time_t caller_speech_end;
+    switch_bool_t vad_was_active;
+    switch_time_t caller_turn_start;
+
+    // Tracing: trace ID is the call UUID, every phase is a child of the session span
+    char trace_id[33];
+    char span_id[17];
+    char trace_parent[17];          // Upstream span from a SIP traceparent header, if any
+    switch_time_t bot_turn_start;
+    switch_time_t bot_turn_last;
+
+    nova_quality_t quality;         // Inputs to the running MOS estimate
+    nova_rtp_t rtp;                 // Caller leg as seen by FreeSWITCH's RTP stack
+    nova_vad_t vad_agent;           // Agent leg in assist mode
+    switch_bool_t agent_was_active;
+    switch_bool_t shadow_selected;
+    nova_shadow_t *shadow;
+
+    /* Background mode: media bug and codec-rate conversion */
+    switch_media_bug_t *bug;
+    switch_audio_resampler_t *read_resampler;
+    switch_audio_resampler_t *write_resampler;
+    uint32_t write_rate;
+    int channels;                           // 2 in assist mode: caller left, agent right
+    int16_t in_frame[NOVA_FRAME_SAMPLES * 2];  // Caller samples gathered into 20ms frames
+    uint32_t in_len;
+    int16_t out_frame[NOVA_FRAME_SAMPLES];  // Bot frame being played out
+    uint32_t out_pos;
+    uint32_t out_len;
+
+    /* API control */
+    char *conference;               // Room this session is a member of (nova_sonic conference)
+    const char **export_names;      // Channel variables exported to the gateway
+    uint32_t *export_hash;          // Value last sent for each, 0 if unset
+    int export_count;
+    switch_time_t export_checked_at;
+    volatile switch_bool_t api_paused;
+    switch_bool_t api_paused_sent;
+    uint32_t frames_sent;
+    uint32_t frames_played;
+    const switch_codec_t *write_codec;  // Blocking mode: codec bot frames are written with
+    volatile int media_ready;       // Blocking mode: first real inbound frame seen
+    switch_bool_t dtx_enabled;      // Blocking mode: no RTP while the bot is silent
+    nova_dtx_t dtx;
+
+    // Hedged start: a second gateway is raced if the first is slow to get ready
+    switch_bool_t hedge;
+    nova_hedge_state_t hedge_state;
+    int hedge_socket;
+    nova_io_slot_t *hedge_io;
+    switch_time_t hedge_opened_at;
+    fork_subscriber_t *hedge_sub;   // Connect state while HEDGE_CONNECTING
+    switch_thread_t *hedge_thread;
+    nova_hedge_tx_t hedge_tx;
+
+    nova_io_slot_t *io;             // Gateway socket registration with an I/O worker
+    volatile int running;
+} nova_session_t;
+
+/*
+ * Connect to Java gateway via TCP
+ */
+static int connect_to_gateway(const char *host, int port) {
+    int sock;
+    struct sockaddr_in server_addr;
+    struct hostent *server;
+
+    if (mediad.links) {
+        if ((sock = nova_link_open(host, port, NULL)) != NOVA_LINK_UNAVAILABLE || !globals.mediad_fallback) {
+            return sock < 0 ? -1 : sock;
+        }
+        __atomic_add_fetch(&mediad.fallback, 1, __ATOMIC_RELAXED);
+    }
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+            "Failed to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    server = gethostbyname(host);
+    if (server == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+            "Failed to resolve host: %s\n", host);
+        close(sock);
+        return -1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    memcpy(&server_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    server_addr.sin_port = htons(port);
+
+    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+            "Failed to connect to gateway %s:%d: %s\n", host, port, strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    if (tls.ctx && nova_tls_wrap(sock, host, port) != SWITCH_STATUS_SUCCESS) {
+        close(sock);
+        return -1;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+        "Connected to gateway at %s:%d (socket %d%s)\n", host, port, sock, tls.ctx ? ", kTLS" : "");
+
+    return sock;
+}
+
+/*
+ * Gateway pool
+ * With gateways= listing several host:port entries (typically one per AZ),
+ * each new session goes to the gateway with the lowest score, the EWMA of
+ * its RTT plus load-weight-us per session already assigned to it. RTT is
+ * sampled every probe-interval-ms: from the kernel's smoothed RTT (TCP_INFO)
+ * on the live session connections to a gateway, or, if it has none, from the
+ * time a TCP connect to it takes. A gateway whose probe fails is skipped
+ * until a probe succeeds again.
+ */
+typedef struct nova_gateway {
+    char *host;
+    int port;
+    uint32_t active;                /* sessions assigned */
+    double rtt_us;                  /* EWMA, 0 until the first sample */
+    uint32_t last_rtt_us;
+    switch_bool_t up;
+    uint64_t samples;
+    uint64_t probes;
+    uint64_t probe_failures;
+    int live;                       /* connections sampled in the last round */
+} nova_gateway_t;
+
+static void nova_gateway_sample(nova_gateway_t *gw, uint32_t rtt_us) {
+    gw->rtt_us = gw->samples ? gw->rtt_us + globals.rtt_alpha * ((double)rtt_us - gw->rtt_us) : rtt_us;
+    gw->last_rtt_us = rtt_us;
+    gw->samples++;
+    gw->up = SWITCH_TRUE;
+}
+
+/*
+ * Time a TCP connect (one SYN/SYN-ACK round trip); -1 if it fails or times out
+ */
+static int nova_gateway_probe(nova_gateway_t *gw) {
+    struct addrinfo hints = { 0 }, *res = NULL;
+    struct pollfd pfd;
+    char port[16];
+    switch_time_t start;
+    int sock, err = 0, rtt = -1;
+    socklen_t errlen = sizeof(err);
+
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    switch_snprintf(port, sizeof(port), "%d", gw->port);
+    if (getaddrinfo(gw->host, port, &hints, &res) || !res) {
+        return -1;
+    }
+
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    start = switch_time_now();
+    if (connect(sock, res->ai_addr, res->ai_addrlen) == 0 || errno == EINPROGRESS) {
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, globals.probe_timeout_ms) == 1 &&
+            !getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &errlen) && !err) {
+            rtt = (int)(switch_time_now() - start);
+        }
+    }
+
+    close(sock);
+    freeaddrinfo(res);
+    return rtt;
+}
+
+static void *SWITCH_THREAD_FUNC nova_gateway_thread(switch_thread_t *thread, void *obj) {
+    while (globals.probe_running) {
+        switch_hash_index_t *hi;
+
+        switch_mutex_lock(globals.gateways_mutex);
+        for (int i = 0; i < globals.gateway_count; i++) {
+            globals.gateways[i].live = 0;
+        }
+        switch_mutex_unlock(globals.gateways_mutex);
+
+        /* Sessions leave the registry before their socket is closed */
+        switch_mutex_lock(globals.sessions_mutex);
+        for (hi = switch_core_hash_first(globals.sessions); hi; hi = switch_core_hash_next(&hi)) {
+            nova_session_t *ctx;
+            struct tcp_info info;
+            socklen_t len = sizeof(info);
+            void *val;
+
+            switch_core_hash_this(hi, NULL, NULL, &val);
+            ctx = (nova_session_t *)val;
+            if (!ctx->gw || ctx->gateway_socket < 0 ||
+                getsockopt(ctx->gateway_socket, IPPROTO_TCP, TCP_INFO, &info, &len) || !info.tcpi_rtt) {
+                continue;
+            }
+            switch_mutex_lock(globals.gateways_mutex);
+            nova_gateway_sample(ctx->gw, info.tcpi_rtt);
+            ctx->gw->live++;
+            switch_mutex_unlock(globals.gateways_mutex);
+        }
+        switch_mutex_unlock(globals.sessions_mutex);
+
+        for (int i = 0; i < globals.gateway_count && globals.probe_running; i++) {
+            nova_gateway_t *gw = &globals.gateways[i];
+            int rtt;
+
+            if (gw->live) {
+                continue;
+            }
+
+            rtt = nova_gateway_probe(gw);
+            switch_mutex_lock(globals.gateways_mutex);
+            gw->probes++;
+            if (rtt >= 0) {
+                nova_gateway_sample(gw, (uint32_t)rtt);
+            } else {
+                gw->probe_failures++;
+                if (gw->up) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                        "Gateway %s:%d failed its probe - not selecting it\n", gw->host, gw->port);
+                }
+                gw->up = SWITCH_FALSE;
+            }
+            switch_mutex_unlock(globals.gateways_mutex);
+        }
+
+        for (int waited = 0; waited < globals.probe_interval_ms && globals.probe_running; waited += 100) {
+            switch_yield(100000);
+        }
+    }
+
+    return NULL;
+}
+
+static void nova_gateway_start(switch_memory_pool_t *pool) {
+    switch_threadattr_t *thd_attr = NULL;
+
+    if (!globals.gateway_count) {
+        return;
+    }
+
+    switch_mutex_init(&globals.gateways_mutex, SWITCH_MUTEX_NESTED, pool);
+    globals.probe_running = 1;
+    switch_threadattr_create(&thd_attr, pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    switch_thread_create(&globals.probe_thread, thd_attr, nova_gateway_thread, NULL, pool);
+}
+
+static void nova_gateway_stop(void) {
+    switch_status_t st;
+
+    if (globals.probe_thread) {
+        globals.probe_running = 0;
+        switch_thread_join(&st, globals.probe_thread);
+        globals.probe_thread = NULL;
+    }
+}
+
+/*
+ * Assign the session to the best-scoring gateway (all are candidates when
+ * none is up, so a probe outage alone never blocks calls)
+ */
+static void nova_gateway_pick(nova_session_t *ctx) {
+    nova_gateway_t *best = NULL;
+    double best_score = 0;
+    int want_up = 0;
+
+    if (!globals.probe_thread) {
+        return;
+    }
+
+    switch_mutex_lock(globals.gateways_mutex);
+    for (int i = 0; i < globals.gateway_count; i++) {
+        want_up |= globals.gateways[i].up;
+    }
+    for (int i = 0; i < globals.gateway_count; i++) {
+        nova_gateway_t *gw = &globals.gateways[i];
+        double score = gw->rtt_us + (double)gw->active * globals.load_weight_us;
+
+        if (want_up && !gw->up) {
+            continue;
+        }
+        if (!best || score < best_score) {
+            best = gw;
+            best_score = score;
+        }
+    }
+    best->active++;
+    switch_mutex_unlock(globals.gateways_mutex);
+
+    ctx->gw = best;
+    ctx->gateway_host = best->host;
+    ctx->gateway_port = best->port;
+    switch_channel_set_variable_printf(ctx->channel, "nova_gateway", "%s:%d", best->host, best->port);
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_DEBUG,
+        "Selected gateway %s:%d (rtt %.0fus, %u active)\n", best->host, best->port, best->rtt_us, best->active);
+}
+
+static void nova_gateway_release(nova_session_t *ctx) {
+    if (!ctx->gw) {
+        return;
+    }
+
+    switch_mutex_lock(globals.gateways_mutex);
+    ctx->gw->active--;
+    ctx->gw = NULL;
+    switch_mutex_unlock(globals.gateways_mutex);
+}
+
+static void nova_gateway_status(switch_stream_handle_t *stream) {
+    if (!globals.probe_thread) {
+        return;
+    }
+
+    switch_mutex_lock(globals.gateways_mutex);
+    for (int i = 0; i < globals.gateway_count; i++) {
+        nova_gateway_t *gw = &globals.gateways[i];
+
+        stream->write_function(stream,
+            "gateway %s:%d %s rtt=%.2fms last=%.2fms active=%u score=%.2fms samples=%llu probes=%llu failed=%llu\n",
+            gw->host, gw->port, gw->up ? "up" : "down", gw->rtt_us / 1000.0, gw->last_rtt_us / 1000.0, gw->active,
+            (gw->rtt_us + (double)gw->active * globals.load_weight_us) / 1000.0,
+            (unsigned long long)gw->samples, (unsigned long long)gw->probes, (unsigned long long)gw->probe_failures);
+    }
+    switch_mutex_unlock(globals.gateways_mutex);
+}
+
+/*
+ * JSON writer
+ * Writes into a caller-supplied buffer with no allocation. Strings are
+ * escaped per RFC 8259 and never cut short: once something does not fit
+ * the writer stops and reports full, and the caller can roll back to a
+ * saved copy of the writer to drop the whole member instead. Room for
+ * the closing brace of every open object (plus reserve bytes the caller
+ * asks for) is kept free, so a rolled-back writer can always be closed.
+ */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    size_t reserve;                 /* bytes kept free: caller's plus one per open object */
+    uint32_t first;                 /* bit per open object: no member yet */
+    int depth;
+    switch_bool_t full;
+} nova_json_writer_t;
+
+static void jw_init(nova_json_writer_t *w, char *buf, size_t size) {
+    memset(w, 0, sizeof(*w));
+    w->buf = buf;
+    w->size = size;
+    buf[0] = '\0';
+}
+
+static void jw_put(nova_json_writer_t *w, const char *s, size_t n) {
+    if (w->full || w->len + n + w->reserve >= w->size) {
+        w->full = SWITCH_TRUE;
+        return;
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+    w->buf[w->len] = '\0';
+}
+
+static void jw_escaped(nova_json_writer_t *w, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    const char *run = s;
+
+    jw_put(w, "\"", 1);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        char esc[6] = { '\\', 0 };
+        size_t n = 2;
+
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        jw_put(w, run, s - run);
+        run = s + 1;
+        switch (c) {
+        case '"': esc[1] = '"'; break;
+        case '\\': esc[1] = '\\'; break;
+        case '\n': esc[1] = 'n'; break;
+        case '\r': esc[1] = 'r'; break;
+        case '\t': esc[1] = 't'; break;
+        default:
+            esc[1] = 'u'; esc[2] = '0'; esc[3] = '0'; esc[4] = hex[c >> 4]; esc[5] = hex[c & 15];
+            n = 6;
+        }
+        jw_put(w, esc, n);
+    }
+    jw_put(w, run, s - run);
+    jw_put(w, "\"", 1);
+}
+
+static void jw_open(nova_json_writer_t *w) {
+    w->reserve++;
+    jw_put(w, "{", 1);
+    w->depth++;
+    w->first |= 1u << w->depth;
+}
+
+static void jw_close(nova_json_writer_t *w) {
+    w->first &= ~(1u << w->depth);
+    w->depth--;
+    w->reserve--;
+    jw_put(w, "}", 1);
+}
+
+static void jw_key(nova_json_writer_t *w, const char *key) {
+    if (w->first & (1u << w->depth)) {
+        w->first &= ~(1u << w->depth);
+    } else {
+        jw_put(w, ",", 1);
+    }
+    jw_escaped(w, key);
+    jw_put(w, ":", 1);
+}
+
+/*
+ * String member; NULL writes null
+ */
+static void jw_string(nova_json_writer_t *w, const char *key, const char *value) {
+    jw_key(w, key);
+    if (value) {
+        jw_escaped(w, value);
+    } else {
+        jw_put(w, "null", 4);
+    }
+}
+
+static void jw_int(nova_json_writer_t *w, const char *key, int value) {
+    char num[16];
+
+    jw_key(w, key);
+    jw_put(w, num, switch_snprintf(num, sizeof(num), "%d", value));
+}
+
+static void jw_bool(nova_json_writer_t *w, const char *key, switch_bool_t value) {
+    jw_key(w, key);
+    jw_put(w, value ? "true" : "false", value ? 4 : 5);
+}
+
+/*
+ * Span export
+ * Sessions queue finished spans (connect, handshake, gateway-ready, caller
+ * and bot turns, barge-ins, teardown, and the session itself) in a bounded
+ * ring; a background thread POSTs them in batches to otlp-endpoint as
+ * OTLP/HTTP JSON. When the ring is full new spans are dropped and counted,
+ * so a slow or absent collector never stalls a call. The trace ID is the
+ * call UUID, sent to the gateway as a W3C traceparent in the handshake so
+ * its spans join the same trace.
+ */
+typedef struct {
+    char trace_id[33];
+    char span_id[17];
+    char parent_id[17];
+    char name[24];
+    char attr_key[16];
+    char attr_value[64];
+    switch_time_t start;
+    switch_time_t end;
+} nova_span_t;
+
+static struct {
+    nova_span_t *ring;
+    uint32_t size;
+    uint32_t head;
+    uint32_t count;
+    switch_mutex_t *mutex;
+    char host[128];
+    char port[8];
+    char path[128];
+    switch_thread_t *thread;
+    volatile int running;
+    uint64_t exported;
+    uint64_t dropped;
+    uint64_t failed;
+} otlp;
+
+static void nova_span_id(char *out) {
+    static uint64_t seq;
+    uint64_t x = __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED) * 0x9e3779b97f4a7c15ull ^ (uint64_t)switch_time_now();
+
+    /* splitmix64 finalizer, never all zero */
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    switch_snprintf(out, 17, "%016llx", (unsigned long long)(x | 1));
+}
+
+/*
+ * True if s starts with len lowercase hex digits that are not all zero
+ */
+static switch_bool_t nova_trace_hex(const char *s, size_t len) {
+    switch_bool_t nonzero = SWITCH_FALSE;
+
+    for (size_t i = 0; i < len; i++) {
+        if (!isdigit((unsigned char)s[i]) && (s[i] < 'a' || s[i] > 'f')) {
+            return SWITCH_FALSE;
+        }
+        nonzero |= s[i] != '0';
+    }
+    return nonzero;
+}
+
+/*
+ * Check a W3C traceparent: version-traceid-parentid-flags in lowercase hex,
+ * neither ID all zeros, version ff reserved, and only later versions may
+ * append fields
+ */
+static switch_bool_t nova_traceparent_valid(const char *tp) {
+    size_t len = strlen(tp);
+
+    if (len < 55 || tp[2] != '-' || tp[35] != '-' || tp[52] != '-') {
+        return SWITCH_FALSE;
+    }
+    if ((!nova_trace_hex(tp, 2) && strncmp(tp, "00", 2)) || !strncmp(tp, "ff", 2) ||
+        !nova_trace_hex(tp + 3, 32) || !nova_trace_hex(tp + 36, 16) ||
+        (!nova_trace_hex(tp + 53, 2) && strncmp(tp + 53, "00", 2))) {
+        return SWITCH_FALSE;
+    }
+    return len == 55 || (strncmp(tp, "00", 2) && tp[55] == '-');
+}
+
+static void nova_trace_init(nova_session_t *ctx) {
+    const char *upstream = switch_channel_get_variable(ctx->channel, "sip_h_traceparent");
+    int j = 0;
+
+    if (!otlp.ring) {
+        return;
+    }
+    nova_span_id(ctx->span_id);
+
+    /* Join the caller's trace when the SIP side already started one; the
+     * header is caller-controlled, so anything malformed is ignored */
+    if (upstream && nova_traceparent_valid(upstream)) {
+        switch_snprintf(ctx->trace_id, sizeof(ctx->trace_id), "%.32s", upstream + 3);
+        switch_snprintf(ctx->trace_parent, sizeof(ctx->trace_parent), "%.16s", upstream + 36);
+        switch_channel_set_variable(ctx->channel, "nova_trace_id", ctx->trace_id);
+        return;
+    }
+    if (upstream) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_DEBUG,
+            "Ignoring malformed traceparent\n");
+    }
+
+    for (const char *p = ctx->session_id; *p && j < 32; p++) {
+        if (isxdigit((unsigned char)*p)) {
+            ctx->trace_id[j++] = (char)tolower((unsigned char)*p);
+        }
+    }
+    while (j < 32) {
+        ctx->trace_id[j++] = '0';
+    }
+    ctx->trace_id[32] = '\0';
+    switch_channel_set_variable(ctx->channel, "nova_trace_id", ctx->trace_id);
+}
+
+/*
+ * Queue a finished span; attr_key may be NULL
+ */
+static void nova_span(nova_session_t *ctx, const char *name, switch_time_t start, switch_time_t end,
+                      const char *attr_key, const char *attr_value) {
+    nova_span_t *span;
+
+    if (!otlp.ring || !ctx->span_id[0]) {
+        return;
+    }
+
+    switch_mutex_lock(otlp.mutex);
+    if (otlp.count == otlp.size) {
+        otlp.dropped++;
+        switch_mutex_unlock(otlp.mutex);
+        return;
+    }
+    span = &otlp.ring[(otlp.head + otlp.count++) % otlp.size];
+    memcpy(span->trace_id, ctx->trace_id, sizeof(span->trace_id));
+    if (!strcmp(name, "nova.session")) {
+        memcpy(span->span_id, ctx->span_id, sizeof(span->span_id));
+        memcpy(span->parent_id, ctx->trace_parent, sizeof(span->parent_id));
+    } else {
+        nova_span_id(span->span_id);
+        memcpy(span->parent_id, ctx->span_id, sizeof(span->parent_id));
+    }
+    switch_snprintf(span->name, sizeof(span->name), "%s", name);
+    switch_snprintf(span->attr_key, sizeof(span->attr_key), "%s", attr_key ? attr_key : "");
+    switch_snprintf(span->attr_value, sizeof(span->attr_value), "%s", attr_value ? attr_value : "");
+    span->start = start;
+    span->end = end > start ? end : start;
+    switch_mutex_unlock(otlp.mutex);
+}
+
+/*
+ * POST one JSON body; only the status line of the response is read
+ */
+static switch_bool_t otlp_post(const char *body, size_t len) {
+    struct addrinfo hints = { 0 }, *res = NULL;
+    struct timeval tv = { 2, 0 };
+    char head[512], status[64];
+    int sock, n, code = 0;
+    switch_bool_t ok = SWITCH_FALSE;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(otlp.host, otlp.port, &hints, &res) || !res) {
+        return SWITCH_FALSE;
+    }
+    if ((sock = socket(res->ai_family, SOCK_STREAM, 0)) < 0) {
+        freeaddrinfo(res);
+        return SWITCH_FALSE;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    n = switch_snprintf(head, sizeof(head),
+        "POST %s HTTP/1.1\r\nHost: %s:%s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        otlp.path, otlp.host, otlp.port, len);
+    if (!connect(sock, res->ai_addr, res->ai_addrlen) &&
+        send(sock, head, n, MSG_NOSIGNAL) == n && send(sock, body, len, MSG_NOSIGNAL) == (ssize_t)len &&
+        (n = recv(sock, status, sizeof(status) - 1, 0)) > 0) {
+        status[n] = '\0';
+        ok = sscanf(status, "HTTP/%*s %d", &code) == 1 && code >= 200 && code < 300;
+    }
+
+    close(sock);
+    freeaddrinfo(res);
+    return ok;
+}
+
+/*
+ * Take up to otlp-batch-spans from the ring and export them. Span names,
+ * attribute values and the service name are escaped; a span that does not
+ * fit ends the batch early and goes out with the next one.
+ */
+#define OTLP_SPAN_BYTES 1024            /* one span with every field fully escaped */
+
+static int otlp_flush(char *body, size_t size) {
+    static const char tail[] = "]}]}]}";
+    nova_json_writer_t w, saved;
+    char times[96];
+    uint32_t n, i;
+    switch_bool_t ok;
+
+    switch_mutex_lock(otlp.mutex);
+    n = otlp.count < (uint32_t)globals.otlp_batch_spans ? otlp.count : (uint32_t)globals.otlp_batch_spans;
+    switch_mutex_unlock(otlp.mutex);
+    if (!n) {
+        return 0;
+    }
+
+#define JW_LIT(w, s) jw_put(w, s, sizeof(s) - 1)
+    jw_init(&w, body, size);
+    w.reserve = sizeof(tail) - 1;
+    JW_LIT(&w, "{\"resourceSpans\":[{\"resource\":{\"attributes\":[{\"key\":\"service.name\",\"value\":{\"stringValue\":");
+    jw_escaped(&w, globals.otlp_service);
+    JW_LIT(&w, "}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"mod_nova_sonic\"},\"spans\":[");
+
+    /* Only this thread removes spans, so the first n stay put while unlocked */
+    for (i = 0; i < n; i++) {
+        nova_span_t *span = &otlp.ring[(otlp.head + i) % otlp.size];
+
+        saved = w;
+        if (i) {
+            JW_LIT(&w, ",");
+        }
+        JW_LIT(&w, "{\"traceId\":");
+        jw_escaped(&w, span->trace_id);
+        JW_LIT(&w, ",\"spanId\":");
+        jw_escaped(&w, span->span_id);
+        JW_LIT(&w, ",\"parentSpanId\":");
+        jw_escaped(&w, span->parent_id);
+        JW_LIT(&w, ",\"name\":");
+        jw_escaped(&w, span->name);
+        jw_put(&w, times, switch_snprintf(times, sizeof(times),
+            ",\"kind\":1,\"startTimeUnixNano\":\"%lld000\",\"endTimeUnixNano\":\"%lld000\"",
+            (long long)span->start, (long long)span->end));
+        if (span->attr_key[0]) {
+            JW_LIT(&w, ",\"attributes\":[{\"key\":");
+            jw_escaped(&w, span->attr_key);
+            JW_LIT(&w, ",\"value\":{\"stringValue\":");
+            jw_escaped(&w, span->attr_value);
+            JW_LIT(&w, "}}]");
+        }
+        JW_LIT(&w, "}");
+        if (w.full) {
+            w = saved;
+            w.buf[w.len] = '\0';
+            break;
+        }
+    }
+    w.reserve = 0;
+    JW_LIT(&w, tail);
+#undef JW_LIT
+
+    /* The body is sized for a full batch, so only a huge service name ends here */
+    if (!(n = i)) {
+        switch_mutex_lock(otlp.mutex);
+        otlp.failed += otlp.count;
+        otlp.head = (otlp.head + otlp.count) % otlp.size;
+        otlp.count = 0;
+        switch_mutex_unlock(otlp.mutex);
+        return -1;
+    }
+
+    ok = otlp_post(body, w.len);
+
+    switch_mutex_lock(otlp.mutex);
+    otlp.head = (otlp.head + n) % otlp.size;
+    otlp.count -= n;
+    if (ok) {
+        otlp.exported += n;
+    } else {
+        otlp.failed += n;
+    }
+    switch_mutex_unlock(otlp.mutex);
+
+    return ok ? (int)n : -1;
+}
+
+static void *SWITCH_THREAD_FUNC otlp_thread(switch_thread_t *thread, void *obj) {
+    size_t size = (size_t)globals.otlp_batch_spans * OTLP_SPAN_BYTES + 512 + strlen(globals.otlp_service) * 6;
+    char *body = malloc(size);
+    int waited = 0;
+
+    while (otlp.running && body) {
+        switch_yield(100000);
+        waited += 100;
+        if (otlp.count < (uint32_t)globals.otlp_batch_spans && waited < globals.otlp_flush_ms) {
+            continue;
+        }
+        waited = 0;
+        /* Drain what is there; a failed POST drops its batch and waits for the next interval */
+        while (otlp_flush(body, size) == globals.otlp_batch_spans);
+    }
+
+    if (body) {
+        otlp_flush(body, size);
+    }
+    switch_safe_free(body);
+    return NULL;
+}
+
+static void otlp_start(switch_memory_pool_t *pool) {
+    switch_threadattr_t *thd_attr = NULL;
+    const char *p = globals.otlp_endpoint, *slash, *colon;
+
+    if (zstr(p)) {
+        return;
+    }
+    if (strncasecmp(p, "http://", 7)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+            "otlp-endpoint must be http://host[:port][/path] - span export disabled\n");
+        return;
+    }
+    p += 7;
+    slash = strchr(p, '/');
+    colon = memchr(p, ':', slash ? (size_t)(slash - p) : strlen(p));
+    switch_snprintf(otlp.host, sizeof(otlp.host), "%.*s", (int)((colon ? colon : slash ? slash : p + strlen(p)) - p), p);
+    if (colon) {
+        switch_snprintf(otlp.port, sizeof(otlp.port), "%.*s", (int)((slash ? slash : colon + strlen(colon)) - colon - 1), colon + 1);
+    } else {
+        switch_snprintf(otlp.port, sizeof(otlp.port), "4318");
+    }
+    switch_snprintf(otlp.path, sizeof(otlp.path), "%s", slash && slash[1] ? slash : "/v1/traces");
+
+    if (globals.otlp_batch_spans < 1) {
+        globals.otlp_batch_spans = 1;
+    }
+    if (globals.otlp_queue_spans < globals.otlp_batch_spans) {
+        globals.otlp_queue_spans = globals.otlp_batch_spans;
+    }
+    otlp.size = (uint32_t)globals.otlp_queue_spans;
+    otlp.ring = switch_core_alloc(pool, otlp.size * sizeof(nova_span_t));
+    switch_mutex_init(&otlp.mutex, SWITCH_MUTEX_NESTED, pool);
+
+    otlp.running = 1;
+    switch_threadattr_create(&thd_attr, pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    switch_thread_create(&otlp.thread, thd_attr, otlp_thread, NULL, pool);
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+        "Nova Sonic span export: http://%s:%s%s, batches of %d, queue %d\n",
+        otlp.host, otlp.port, otlp.path, globals.otlp_batch_spans, globals.otlp_queue_spans);
+}
+
+static void otlp_stop(void) {
+    switch_status_t st;
+
+    if (otlp.thread) {
+        otlp.running = 0;
+        switch_thread_join(&st, otlp.thread);
+        otlp.thread = NULL;
+    }
+    /* Sessions check the ring before queueing */
+    otlp.ring = NULL;
+}
+
+static void otlp_status(switch_stream_handle_t *stream) {
+    if (!otlp.ring) {
+        return;
+    }
+
+    switch_mutex_lock(otlp.mutex);
+    stream->write_function(stream, "spans: http://%s:%s%s queued=%u/%u exported=%llu dropped=%llu failed=%llu\n",
+        otlp.host, otlp.port, otlp.path, otlp.count, otlp.size, (unsigned long long)otlp.exported,
+        (unsigned long long)otlp.dropped, (unsigned long long)otlp.failed);
+    switch_mutex_unlock(otlp.mutex);
+}
+
+/*
+ * Frame a control message for the gateway; 0 if the JSON is empty or too long
+ */
+static size_t nova_control_encode(uint8_t *msg, size_t size, const char *json) {
+    size_t len = strlen(json);
+
+    if (len == 0 || len + NOVA_MSG_HEADER > size) {
+        return 0;
+    }
+
+    nova_msg_header(msg, NOVA_MSG_CONTROL, (uint32_t)len);
+    memcpy(msg + NOVA_MSG_HEADER, json, len);
+    return len + NOVA_MSG_HEADER;
+}
+
+/*
+ * Copy a string member of a flat JSON object; false if absent or too long
+ */
+static switch_bool_t nova_json_string(const char *json, const char *key, char *out, size_t len) {
+    char pattern[64];
+    const char *p, *end;
+
+    switch_snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+    if (!(p = strstr(json, pattern)) || !(end = strchr(p += strlen(pattern), '"')) || (size_t)(end - p) >= len) {
+        return SWITCH_FALSE;
+    }
+
+    memcpy(out, p, end - p);
+    out[end - p] = '\0';
+    return SWITCH_TRUE;
+}
+
+/*
+ * Variable export
+ * The handshake carries a "vars" object with each exported channel
+ * variable that is set (export-vars plus the call's nova_export_vars; SIP
+ * headers are read through their channel variables, e.g. sip_h_X-Account
+ * or sip_req_user). Every export-poll-ms the session thread compares the
+ * variables with what was last sent, by hash, and sends the changes as
+ * {"type":"vars","vars":{...}}, null for a variable that was unset. A
+ * delta is split over several messages to stay within the control frame
+ * limit; a value too large for one message is sent in the handshake only.
+ */
+#define NOVA_HANDSHAKE_BYTES 8192
+#define NOVA_VARS_MSG_BYTES  1000     /* gateway reads control messages under 1024 bytes */
+
+static uint32_t nova_vars_hash(const char *value) {
+    uint32_t h = 2166136261u;
+
+    if (!value) {
+        return 0;
+    }
+    while (*value) {
+        h = (h ^ (uint8_t)*value++) * 16777619u;
+    }
+    return h | 1;
+}
+
+/*
+ * Collect this call's exported variable names (session thread, at create)
+ */
+static void nova_vars_init(nova_session_t *ctx) {
+    const char *extra = switch_channel_get_variable(ctx->channel, "nova_export_vars");
+    char *names[64], *copy = NULL;
+    int extra_count = 0;
+
+    if (!zstr(extra)) {
+        copy = switch_core_strdup(ctx->pool, extra);
+        extra_count = (int)switch_separate_string(copy, ',', names, 64);
+    }
+    if (!globals.export_count && !extra_count) {
+        return;
+    }
+
+    ctx->export_names = switch_core_alloc(ctx->pool, (globals.export_count + extra_count) * sizeof(char *));
+    ctx->export_hash = switch_core_alloc(ctx->pool, (globals.export_count + extra_count) * sizeof(uint32_t));
+    for (int i = 0; i < globals.export_count; i++) {
+        ctx->export_names[ctx->export_count++] = globals.export_vars[i];
+    }
+    for (int i = 0; i < extra_count; i++) {
+        if (!zstr(names[i])) {
+            ctx->export_names[ctx->export_count++] = names[i];
+        }
+    }
+}
+
+/*
+ * Write the "vars" member of the handshake and remember what was sent
+ */
+static void nova_vars_handshake(nova_session_t *ctx, nova_json_writer_t *w) {
+    nova_json_writer_t saved;
+
+    if (!ctx->export_count) {
+        return;
+    }
+
+    jw_key(w, "vars");
+    jw_open(w);
+    for (int i = 0; i < ctx->export_count; i++) {
+        const char *value = switch_channel_get_variable(ctx->channel, ctx->export_names[i]);
+
+        ctx->export_hash[i] = nova_vars_hash(value);
+        if (!value) {
+            continue;
+        }
+
+        saved = *w;
+        jw_string(w, ctx->export_names[i], value);
+        if (w->full) {
+            *w = saved;
+            w->buf[w->len] = '\0';
+            ctx->export_hash[i] = 0;
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                "Handshake full - %s (%d bytes) not exported\n", ctx->export_names[i], (int)strlen(value));
+        }
+    }
+    jw_close(w);
+    ctx->export_checked_at = switch_time_now();
+}
+
+/*
+ * Handle a control message from the gateway
+ */
+static void nova_gateway_control(nova_session_t *ctx, const char *control_msg) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+        "Received control message from gateway: %s\n", control_msg);
+
+    /* Check if this is a hangup command */
+    if (strstr(control_msg, "\"type\":\"hangup\"") != NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+            "Nova requested hangup - terminating call\n");
+
+        /* Hangup the channel; an assist session only detaches from a human call */
+        if (ctx->mode != NOVA_MODE_ASSIST) {
+            switch_channel_hangup(ctx->channel, SWITCH_CAUSE_NORMAL_CLEARING);
+        }
+        ctx->running = 0;
+    }
+}
+
+/*
+ * Call quality
+ * An E-model (ITU-T G.107) R factor from what the module sees on its side
+ * of the call, mapped to a MOS estimate:
+ *   Ie-eff  G.711 (Ie 0, Bpl 25.1) with Ppl = bot frames concealed because
+ *           playout ran dry mid-utterance plus frames dropped on overflow
+ *   Id      from Ta = average playout queue + half the gateway RTT +
+ *           packetization (simplified Cole/Rosenbluth form)
+ *   Iresp   not part of G.107: response latency beyond 800ms and barge-in
+ *           stop time beyond 400ms, each capped at 20
+ * The network leg to the caller is not visible here, so this ranks AI call
+ * quality between sessions, gateways and carriers rather than replacing a
+ * network MOS.
+ */
+#define BARGE_STOP_CAP_US 5000000
+
+typedef struct {
+    uint32_t dropped;
+    double loss_pct;
+    int ta_ms;
+    int barge_stop_ms;
+    double r;
+    double mos;
+} nova_quality_score_t;
+
+static void quality_tick(nova_session_t *ctx, switch_bool_t played) {
+    nova_quality_t *q = &ctx->quality;
+    switch_time_t now = switch_time_now();
+
+    if (q->barge_at && (!played || now - q->barge_at > BARGE_STOP_CAP_US)) {
+        q->barge_stop_ms_total += (uint64_t)((now - q->barge_at) / 1000);
+        q->barge_ins++;
+        q->barge_at = 0;
+    }
+
+    if (!played && (!ctx->bot_turn_start || now - ctx->bot_turn_last >= BOT_TURN_GAP_US)) {
+        return;
+    }
+
+    q->ticks++;
+    if (!played) {
+        q->underruns++;
+    }
+    q->queued_ms_total += egress_ring_count(ctx->egress) * NOVA_FRAME_MS;
+}
+
+static void quality_score(nova_session_t *ctx, nova_quality_score_t *out) {
+    nova_quality_t *q = &ctx->quality;
+    uint32_t dropped = ctx->egress ? ctx->egress->overflows : 0;
+    uint32_t frames = q->ticks + dropped;
+    int response_ms = latency_response_avg_ms(&ctx->latency);
+    int rtt_ms = 0;
+    double ie, id, iresp, r;
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    if (ctx->gateway_socket >= 0 && !getsockopt(ctx->gateway_socket, IPPROTO_TCP, TCP_INFO, &info, &len)) {
+        rtt_ms = (int)(info.tcpi_rtt / 1000);
+    }
+
+    out->dropped = dropped;
+    out->loss_pct = frames ? 100.0 * (q->underruns + dropped) / frames : 0;
+    out->ta_ms = (int)(q->ticks ? q->queued_ms_total / q->ticks : 0) + rtt_ms / 2 + 2 * NOVA_FRAME_MS;
+    out->barge_stop_ms = q->barge_ins ? (int)(q->barge_stop_ms_total / q->barge_ins) : 0;
+
+    ie = 95.0 * out->loss_pct / (out->loss_pct + 25.1);
+    id = 0.024 * out->ta_ms + (out->ta_ms > 177.3 ? 0.11 * (out->ta_ms - 177.3) : 0);
+    iresp = response_ms > 800 ? 0.01 * (response_ms - 800) : 0;
+    iresp = (iresp > 20 ? 20 : iresp) +
+            (out->barge_stop_ms > 400 ? (0.02 * (out->barge_stop_ms - 400) > 20 ? 20 : 0.02 * (out->barge_stop_ms - 400)) : 0);
+
+    r = 93.2 - id - ie - iresp;
+    out->r = r < 0 ? 0 : r > 100 ? 100 : r;
+    out->mos = out->r <= 0 ? 1.0 : 1 + 0.035 * out->r + out->r * (out->r - 60) * (100 - out->r) * 7e-6;
+}
+
+/*
+ * Caller-leg RTP statistics
+ * Every rtp-stats-interval-sec the channel's inbound RTP numbers are read
+ * (on the thread feeding caller audio, which holds the session) and fired
+ * with the module's own metrics as a nova_sonic::quality event. At teardown
+ * the last sample goes to CDR variables with a verdict on where a bad call
+ * went wrong: the caller's network, the gateway path, or the model.
+ */
+static const char *nova_blame(nova_session_t *ctx, const nova_quality_score_t *score) {
+    int response_ms = latency_response_avg_ms(&ctx->latency);
+
+    if (ctx->rtp.samples && (ctx->rtp.loss_pct >= 1.0 || ctx->rtp.jitter_max_ms >= 30.0)) {
+        return "network";
+    }
+    if (score->loss_pct >= 1.0 || score->ta_ms >= 250) {
+        return "gateway";
+    }
+    if (response_ms >= 1500) {
+        return "model";
+    }
+    return "none";
+}
+
+static switch_bool_t nova_rtp_read(nova_session_t *ctx) {
+    switch_rtp_stats_t *stats = switch_core_media_get_stats(ctx->session, SWITCH_MEDIA_TYPE_AUDIO, NULL);
+
+    /* Loopback or other non-RTP channels have none */
+    if (!stats) {
+        return SWITCH_FALSE;
+    }
+
+    ctx->rtp.samples++;
+    ctx->rtp.jitter_ms = stats->inbound.std_deviation;
+    if (ctx->rtp.jitter_ms > ctx->rtp.jitter_max_ms) {
+        ctx->rtp.jitter_max_ms = ctx->rtp.jitter_ms;
+    }
+    ctx->rtp.loss_pct = stats->inbound.lossrate;
+    ctx->rtp.flaws = (uint32_t)stats->inbound.flaws;
+    ctx->rtp.packets = (uint32_t)stats->inbound.packet_count;
+    ctx->rtp.skipped = (uint32_t)stats->inbound.skip_packet_count;
+    ctx->rtp.mos = stats->inbound.mos;
+    return SWITCH_TRUE;
+}
+
+static void nova_rtp_sample(nova_session_t *ctx) {
+    nova_quality_score_t score;
+    switch_event_t *event;
+
+    if (!globals.rtp_stats_interval_sec ||
+        ++ctx->rtp.frames < (uint32_t)globals.rtp_stats_interval_sec * (1000 / NOVA_FRAME_MS)) {
+        return;
+    }
+    ctx->rtp.frames = 0;
+
+    if (!nova_rtp_read(ctx)) {
+        return;
+    }
+    quality_score(ctx, &score);
+
+    if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, NOVA_EVENT_QUALITY) == SWITCH_STATUS_SUCCESS) {
+        switch_channel_event_set_data(ctx->channel, event);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Nova-RTP-Jitter-MS", "%.1f", ctx->rtp.jitter_ms);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Nova-RTP-Loss-Pct", "%.2f", ctx->rtp.loss_pct);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Nova-RTP-Flaws", "%u", ctx->rtp.flaws);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Nova-RTP-MOS", "%.2f", ctx->rtp.mos);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Nova-MOS", "%.2f", score.mos);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Nova-Concealed-MS", "%u", ctx->quality.underruns * NOVA_FRAME_MS);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Nova-Queued-MS", "%u",
+                                ctx->egress ? egress_ring_count(ctx->egress) * NOVA_FRAME_MS : 0);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Nova-Response-Avg-MS", "%d", latency_response_avg_ms(&ctx->latency));
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Nova-Blame", nova_blame(ctx, &score));
+        switch_event_fire(&event);
+    }
+}
+
+/*
+ * Blocking mode egress tick: play the oldest queued bot frame, if any
+ * Runs on the I/O worker every 20ms at the session's phase, outside the
+ * worker mutex; FreeSWITCH allows one thread to write a session while
+ * another reads it.
+ */
+static void nova_play_frame(nova_session_t *ctx, egress_ring_t *ring) {
+    switch_frame_t write_frame = { 0 };
+    egress_slot_t *slot;
+    dtx_action_t action;
+    switch_status_t st;
+
+    if (!ctx->media_ready || !ctx->write_codec) {
+        return;
+    }
+
+    slot = egress_ring_peek(ring);
+    quality_tick(ctx, slot != NULL);
+    action = ctx->dtx_enabled ? dtx_tick(&ctx->dtx, slot) : DTX_PLAY;
+
+    write_frame.samples = NOVA_FRAME_SAMPLES;
+    write_frame.rate = 8000;
+    write_frame.channels = 1;
+    write_frame.codec = (switch_codec_t *)ctx->write_codec;
+
+    if (action == DTX_SID) {
+        /* CN payload: just the noise level, no spectral information */
+        write_frame.data = &ctx->dtx.level;
+        write_frame.datalen = 1;
+        write_frame.flags = SFF_CNG;
+        switch_core_session_write_frame(ctx->session, &write_frame, SWITCH_IO_FLAG_NONE, 0);
+    }
+
+    if (!slot) {
+        return;
+    }
+    if (action != DTX_PLAY) {
+        egress_ring_release(ring);
+        return;
+    }
+
+    /* Slot already holds the frame in the write codec (160 bytes of G.711) */
+    write_frame.data = slot->data;
+    write_frame.datalen = slot->datalen;
+
+    st = switch_core_session_write_frame(ctx->session, &write_frame, SWITCH_IO_FLAG_NONE, 0);
+    egress_ring_release(ring);
+    ctx->frames_played++;
+    if (st != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_DEBUG,
+            "write_frame returned status: %d\n", st);
+    }
+}
+
+/*
+ * Handle one 20ms PCM16 bot frame from the gateway
+ */
+static void nova_gateway_audio(nova_session_t *ctx, const int16_t *pcm) {
+    switch_time_t now = switch_time_now();
+
+    if (now - ctx->bot_turn_last > BOT_TURN_GAP_US) {
+        if (ctx->bot_turn_start) {
+            nova_span(ctx, "bot.turn", ctx->bot_turn_start, ctx->bot_turn_last + NOVA_FRAME_MS * 1000, NULL, NULL);
+        }
+        ctx->bot_turn_start = now;
+    }
+    ctx->bot_turn_last = now;
+
+    latency_on_audio(&ctx->latency, ctx->caller_speech_end);
+
+    if (ctx->fork) {
+        fork_publish(ctx->fork, FORK_LEG_BOT, pcm);
+    }
+}
+
+/*
+ * Egress cache
+ * Bot utterances the gateway marks with cache_as are kept as PCM16 in an
+ * LRU shared by all sessions, within egress-cache-mb. A later play_ref
+ * replays the cached audio through the same gain/encode path as live
+ * frames, so one entry serves calls on any codec. Entries being replayed
+ * are pinned; an entry evicted meanwhile is freed by its last player.
+ *
+ *   gateway -> module: {"type":"cache_as","hash":H}  following audio, up to
+ *                      {"type":"cache_end"}, is stored under H
+ *                      {"type":"play_ref","hash":H}  replay H
+ *                      {"type":"play_stop"}          cut a replay short (barge-in)
+ *   module -> gateway: {"type":"cache_miss","hash":H} H is not cached; send the audio
+ *                      {"type":"play_done","hash":H}  last frame of H queued
+ */
+#define EGRESS_CACHE_HASH_LEN    64
+#define EGRESS_CACHE_MAX_FRAMES  1500       /* 30s; longer utterances are not cached */
+#define EGRESS_REPLAY_DEPTH      16         /* frames kept queued ahead while replaying */
+
+typedef struct egress_cache_entry {
+    char hash[EGRESS_CACHE_HASH_LEN + 1];
+    int16_t *pcm;
+    uint32_t frames;
+    uint32_t refs;                  /* sessions replaying it */
+    switch_bool_t evicted;
+    struct egress_cache_entry *prev, *next;     /* LRU, most recent first */
+} egress_cache_entry_t;
+
+static struct {
+    switch_hash_t *entries;
+    switch_mutex_t *mutex;
+    egress_cache_entry_t *head, *tail;
+    size_t bytes;
+    size_t budget;
+    uint64_t hits, misses, stores, evictions;
+} egress_cache;
+
+static size_t egress_cache_entry_bytes(const egress_cache_entry_t *entry) {
+    return sizeof(*entry) + (size_t)entry->frames * NOVA_FRAME_BYTES;
+}
+
+static void egress_cache_free(egress_cache_entry_t *entry) {
+    free(entry->pcm);
+    free(entry);
+}
+
+static void egress_cache_unlink(egress_cache_entry_t *entry) {
+    if (entry->prev) entry->prev->next = entry->next; else egress_cache.head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev; else egress_cache.tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void egress_cache_push_front(egress_cache_entry_t *entry) {
+    entry->prev = NULL;
+    entry->next = egress_cache.head;
+    if (egress_cache.head) egress_cache.head->prev = entry; else egress_cache.tail = entry;
+    egress_cache.head = entry;
+}
+
+/*
+ * Pin the entry for hash and mark it recently used; NULL on a miss
+ */
+static egress_cache_entry_t *egress_cache_get(const char *hash) {
+    egress_cache_entry_t *entry;
+
+    switch_mutex_lock(egress_cache.mutex);
+    if ((entry = egress_cache.entries ? switch_core_hash_find(egress_cache.entries, hash) : NULL)) {
+        egress_cache_unlink(entry);
+        egress_cache_push_front(entry);
+        entry->refs++;
+        egress_cache.hits++;
+    } else {
+        egress_cache.misses++;
+    }
+    switch_mutex_unlock(egress_cache.mutex);
+
+    return entry;
+}
+
+static void egress_cache_release(egress_cache_entry_t *entry) {
+    switch_mutex_lock(egress_cache.mutex);
+    if (--entry->refs == 0 && entry->evicted) {
+        egress_cache_free(entry);
+    }
+    switch_mutex_unlock(egress_cache.mutex);
+}
+
+/*
+ * Store frames (malloc'd, ownership passes to the cache) under hash,
+ * evicting least recently used entries to stay within the budget
+ */
+static void egress_cache_put(const char *hash, int16_t *pcm, uint32_t frames) {
+    egress_cache_entry_t *entry = calloc(1, sizeof(*entry));
+
+    if (!entry) {
+        free(pcm);
+        return;
+    }
+    switch_snprintf(entry->hash, sizeof(entry->hash), "%s", hash);
+    entry->pcm = pcm;
+    entry->frames = frames;
+
+    switch_mutex_lock(egress_cache.mutex);
+    if (!egress_cache.entries || egress_cache_entry_bytes(entry) > egress_cache.budget ||
+        switch_core_hash_find(egress_cache.entries, hash)) {
+        switch_mutex_unlock(egress_cache.mutex);
+        egress_cache_free(entry);
+        return;
+    }
+
+    while (egress_cache.tail && egress_cache.bytes + egress_cache_entry_bytes(entry) > egress_cache.budget) {
+        egress_cache_entry_t *victim = egress_cache.tail;
+
+        egress_cache_unlink(victim);
+        switch_core_hash_delete(egress_cache.entries, victim->hash);
+        egress_cache.bytes -= egress_cache_entry_bytes(victim);
+        egress_cache.evictions++;
+        if (victim->refs) {
+            victim->evicted = SWITCH_TRUE;
+        } else {
+            egress_cache_free(victim);
+        }
+    }
+
+    switch_core_hash_insert(egress_cache.entries, entry->hash, entry);
+    egress_cache_push_front(entry);
+    egress_cache.bytes += egress_cache_entry_bytes(entry);
+    egress_cache.stores++;
+    switch_mutex_unlock(egress_cache.mutex);
+}
+
+static void egress_cache_init(switch_memory_pool_t *pool) {
+    switch_mutex_init(&egress_cache.mutex, SWITCH_MUTEX_NESTED, pool);
+    egress_cache.budget = (size_t)globals.egress_cache_mb * 1024 * 1024;
+    if (egress_cache.budget) {
+        switch_core_hash_init(&egress_cache.entries);
+    }
+}
+
+static void egress_cache_destroy(void) {
+    while (egress_cache.head) {
+        egress_cache_entry_t *entry = egress_cache.head;
+
+        egress_cache_unlink(entry);
+        egress_cache_free(entry);
+    }
+    if (egress_cache.entries) {
+        switch_core_hash_destroy(&egress_cache.entries);
+    }
+}
+
+static void egress_cache_status(switch_stream_handle_t *stream) {
+    uint32_t count = 0;
+
+    if (!egress_cache.entries) {
+        return;
+    }
+
+    switch_mutex_lock(egress_cache.mutex);
+    for (egress_cache_entry_t *entry = egress_cache.head; entry; entry = entry->next) {
+        count++;
+    }
+    stream->write_function(stream, "egress cache %u entries %zu/%zuKB hits=%llu misses=%llu stores=%llu evictions=%llu\n",
+        count, egress_cache.bytes / 1024, egress_cache.budget / 1024,
+        (unsigned long long)egress_cache.hits, (unsigned long long)egress_cache.misses,
+        (unsigned long long)egress_cache.stores, (unsigned long long)egress_cache.evictions);
+    switch_mutex_unlock(egress_cache.mutex);
+}
+
+/*
+ * Hugepage mapping
+ * Tries explicit 2MB pages (vm.nr_hugepages), then normal pages with a
+ * transparent hugepage hint. The length is rounded up to a 2MB multiple;
+ * *huge reports whether explicit hugepages were obtained.
+ */
+#define NOVA_HUGEPAGE_BYTES (2u * 1024 * 1024)
+
+static void *nova_huge_map(size_t *bytes, switch_bool_t *huge) {
+    size_t len = (*bytes + NOVA_HUGEPAGE_BYTES - 1) & ~((size_t)NOVA_HUGEPAGE_BYTES - 1);
+    void *mem = MAP_FAILED;
+
+    *huge = SWITCH_FALSE;
+#ifdef MAP_HUGETLB
+    if (globals.arena_hugepages) {
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        *huge = mem != MAP_FAILED;
+    }
+#endif
+    if (mem == MAP_FAILED) {
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if (globals.arena_hugepages) {
+            madvise(mem, len, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    *bytes = len;
+    return mem;
+}
+
+/*
+ * Session arena
+ * The session context, its pre-gateway egress ring and its pre-roll ring
+ * are carved from one fixed-size block instead of the session pool, so the
+ * audio state of every call sits at the same cache-aligned offsets in a
+ * few hugepages rather than scattered across pools. Blocks are all one
+ * size and recycled through a free list, so the arena never fragments;
+ * when it is exhausted sessions fall back to their pool as before.
+ */
+#define NOVA_CACHE_ALIGN(n) (((n) + 63) & ~(size_t)63)
+
+typedef struct nova_arena_block {
+    struct nova_arena_block *next_free;
+} nova_arena_block_t;
+
+static struct {
+    uint8_t *base;
+    size_t mapped;
+    size_t block_bytes;
+    size_t egress_off;              /* egress_ring_t */
+    size_t preroll_off;             /* preroll_ring_t, frames follow */
+    uint32_t preroll_frames;
+    uint32_t blocks;
+    uint32_t in_use;
+    uint32_t peak;
+    uint64_t fallbacks;             /* sessions that found the arena full */
+    switch_bool_t huge;
+    nova_arena_block_t *free_list;
+    switch_mutex_t *mutex;
+} arena;
+
+static void nova_arena_start(switch_memory_pool_t *pool) {
+    size_t bytes;
+
+    if (globals.arena_sessions <= 0) {
+        return;
+    }
+
+    arena.preroll_frames = globals.lazy_preroll_ms > 0 ? (uint32_t)(globals.lazy_preroll_ms / NOVA_FRAME_MS) : 0;
+    if (arena.preroll_frames == 0) {
+        arena.preroll_frames = 1;
+    }
+    arena.egress_off = NOVA_CACHE_ALIGN(sizeof(nova_session_t));
+    arena.preroll_off = arena.egress_off + NOVA_CACHE_ALIGN(sizeof(egress_ring_t));
+    arena.block_bytes = arena.preroll_off + NOVA_CACHE_ALIGN(sizeof(preroll_ring_t))
+        + NOVA_CACHE_ALIGN((size_t)arena.preroll_frames * NOVA_FRAME_BYTES);
+
+    bytes = arena.block_bytes * (size_t)globals.arena_sessions;
+    if (!(arena.base = nova_huge_map(&bytes, &arena.huge))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+            "Session arena of %zu bytes not mapped (%s) - using session pools\n", bytes, strerror(errno));
+        return;
+    }
+    arena.mapped = bytes;
+    /* Rounding up to whole hugepages leaves room for more blocks */
+    arena.blocks = (uint32_t)(bytes / arena.block_bytes);
+
+    for (int i = (int)arena.blocks - 1; i >= 0; i--) {
+        nova_arena_block_t *block = (nova_arena_block_t *)(arena.base + (size_t)i * arena.block_bytes);
+        block->next_free = arena.free_list;
+        arena.free_list = block;
+    }
+    switch_mutex_init(&arena.mutex, SWITCH_MUTEX_NESTED, pool);
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+        "Session arena: %u blocks of %zu bytes in %zuMB of %s pages\n",
+        arena.blocks, arena.block_bytes, arena.mapped >> 20, arena.huge ? "2MB" : "normal");
+}
+
+static void nova_arena_stop(void) {
+    if (arena.base) {
+        munmap(arena.base, arena.mapped);
+        arena.base = NULL;
+    }
+}
+
+/*
+ * Zeroed session block, or NULL when the arena is off or full
+ */
+static uint8_t *nova_arena_alloc(void) {
+    nova_arena_block_t *block = NULL;
+
+    if (!arena.base) {
+        return NULL;
+    }
+
+    switch_mutex_lock(arena.mutex);
+    if ((block = arena.free_list)) {
+        arena.free_list = block->next_free;
+        if (++arena.in_use > arena.peak) {
+            arena.peak = arena.in_use;
+        }
+    } else {
+        arena.fallbacks++;
+    }
+    switch_mutex_unlock(arena.mutex);
+
+    if (block) {
+        memset(block, 0, arena.block_bytes);
+    }
+    return (uint8_t *)block;
+}
+
+static void nova_arena_free(void *mem) {
+    nova_arena_block_t *block = (nova_arena_block_t *)mem;
+
+    switch_mutex_lock(arena.mutex);
+    block->next_free = arena.free_list;
+    arena.free_list = block;
+    arena.in_use--;
+    switch_mutex_unlock(arena.mutex);
+}
+
+static switch_bool_t nova_arena_owns(const void *mem) {
+    return arena.base && (const uint8_t *)mem >= arena.base && (const uint8_t *)mem < arena.base + arena.mapped;
+}
+
+static void nova_arena_status(switch_stream_handle_t *stream) {
+    if (!arena.base) {
+        stream->write_function(stream, "arena: off\n");
+        return;
+    }
+
+    switch_mutex_lock(arena.mutex);
+    stream->write_function(stream, "arena: %u/%u blocks (peak %u) of %zu bytes, %zuMB %s pages, %llu pool fallbacks\n",
+        arena.in_use, arena.blocks, arena.peak, arena.block_bytes, arena.mapped >> 20,
+        arena.huge ? "2MB" : "normal", (unsigned long long)arena.fallbacks);
+    switch_mutex_unlock(arena.mutex);
+}
+
+/*
+ * Gateway I/O workers
+ * A few epoll threads serve every session's gateway socket instead of one
+ * receive thread per call. Each worker can be pinned to a CPU (ideally on
+ * the NIC's NUMA node) and run SCHED_FIFO/RR; it first-touches a slab of
+ * session slots after pinning so the rx buffer and egress ring of its
+ * sessions are NUMA-local.
+ *
+ * Each worker also runs a timer wheel that fires the 20ms egress tick of
+ * its blocking-mode sessions. A session keeps one of 20 1ms phase buckets
+ * for its lifetime, picked from the least loaded, so ticks are staggered
+ * across the period and every bucket is one batch of writes. The worker's
+ * timerfd is armed for the next non-empty bucket only (once per period
+ * when idle), and how late it fires is reported by "nova_sonic status".
+ */
+#define WHEEL_TICK_NS    1000000    /* phase resolution */
+#define WHEEL_SLOTS      20         /* one 20ms egress period */
+#define IO_MAX_EVENTS    64
+#define IO_LAT_BUCKETS   5          /* <50us, <200us, <1ms, <5ms, >=5ms */
+#define EGRESS_BATCH     32         /* frames per block; one 64-byte row per sample index */
+#define EGRESS_GAIN_ONE  4096       /* unity gain, Q12 */
+
+/*
+ * Bot frames received in one epoll batch, from any of the worker's sessions
+ * Stored sample-major (pcm[sample][frame]) so the gain stage runs across
+ * frames at full SIMD width; encoding then reads the G.711 tables for many
+ * sessions back to back instead of once per session.
+ */
+typedef struct {
+    int16_t pcm[NOVA_FRAME_SAMPLES][EGRESS_BATCH] __attribute__((aligned(64)));
+    int32_t gain[EGRESS_BATCH] __attribute__((aligned(64)));
+    nova_io_slot_t *slot[EGRESS_BATCH];
+    uint32_t count;
+    switch_bool_t scaled;           /* some frame needs a non-unity gain */
+} egress_batch_t;
+
+struct nova_io_slot {
+    egress_ring_t egress;           /* bot audio, encoded for the channel */
+    uint8_t rx[4 + 1024];           /* partial gateway message */
+    uint32_t rx_len;
+    int fd;
+    nova_session_t *ctx;
+    struct nova_io_worker *worker;
+    switch_bool_t pooled;           /* slab was full; allocated from the session pool */
+    nova_io_slot_t *next_free;
+    nova_io_slot_t *wheel_next;     /* bucket list, while ticking */
+    int phase;                      /* wheel bucket, -1 when not ticking */
+    nova_io_slot_t *play_next;      /* due this pass, played after the mutex is released */
+    nova_session_t *play_ctx;       /* session as it was when the tick fired */
+    volatile int playing;           /* on the due list; unregister waits for it */
+
+    /* Egress cache: utterance being recorded, entry being replayed */
+    char rec_hash[EGRESS_CACHE_HASH_LEN + 1];
+    int16_t *rec;
+    uint32_t rec_frames;
+    uint32_t rec_cap;
+    egress_cache_entry_t *replay;
+    uint32_t replay_pos;
+    nova_io_slot_t *replay_next;
+
+    /* Hedged start */
+    switch_bool_t standby;          /* candidate connection, not yet the session's */
+    volatile int ready;             /* gateway sent "ready" or its first audio */
+};
+
+/*
+ * Control message from an I/O worker, straight on the slot's socket; caller
+ * audio the session thread is coalescing is unaffected
+ */
+static void nova_io_send_control(nova_io_slot_t *slot, const char *json) {
+    uint8_t msg[1024];
+    size_t len = nova_control_encode(msg, sizeof(msg), json);
+
+    if (len && slot->fd >= 0 && nova_link_send(slot->fd, msg, len, 0) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+            "Failed to send control message to gateway: %s\n", strerror(errno));
+    }
+}
+
+typedef struct nova_io_worker {
+    int index;
+    int cpu;                        /* -1 when not pinned */
+    int epfd;
+    int tfd;
+    switch_thread_t *thread;
+    switch_mutex_t *mutex;          /* held while a batch of events is handled */
+    nova_io_slot_t *slab;
+    size_t slab_bytes;
+    switch_bool_t slab_huge;
+    nova_io_slot_t *free_list;
+    uint32_t sessions;
+    egress_batch_t *batch;          /* on the worker's stack */
+    volatile int ready;
+    volatile int running;
+
+    /* Egress timer wheel; tick n fires bucket n % WHEEL_SLOTS at epoch_ns + n ms */
+    nova_io_slot_t *wheel[WHEEL_SLOTS];
+    uint32_t wheel_load[WHEEL_SLOTS];
+    uint32_t timers;
+    uint64_t epoch_ns;
+    uint64_t next_tick;
+
+    /* Slots replaying a cached utterance */
+    nova_io_slot_t *replaying;
+
+    /* Blocking-mode sessions whose tick fired this pass; worker thread only */
+    nova_io_slot_t *due;
+    nova_io_slot_t **due_tail;
+
+    /* Lateness of the wheel's timerfd */
+    uint64_t ticks;
+    uint64_t lat_total_us;
+    uint32_t lat_max_us;
+    uint32_t lat_hist[IO_LAT_BUCKETS];
+} nova_io_worker_t;
+
+static const char *io_lat_labels[IO_LAT_BUCKETS] = { "<50us", "<200us", "<1ms", "<5ms", ">=5ms" };
+
+/*
+ * Q12 gain for a level in dB, limited to +/-24dB so a full-scale sample
+ * times the gain still fits in 32 bits
+ */
+static int32_t egress_gain_q12(double db) {
+    if (db > 24.0) db = 24.0;
+    if (db < -24.0) db = -24.0;
+
+    return (int32_t)lrint(pow(10.0, db / 20.0) * EGRESS_GAIN_ONE);
+}
+
+static void egress_batch_gain(egress_batch_t *batch) {
+    for (int i = 0; i < NOVA_FRAME_SAMPLES; i++) {
+        int16_t *row = batch->pcm[i];
+
+        /* Full width even when the block is short; unused lanes are never read */
+        for (int k = 0; k < EGRESS_BATCH; k++) {
+            int32_t v = (row[k] * batch->gain[k] + EGRESS_GAIN_ONE / 2) >> 12;
+            row[k] = (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+        }
+    }
+}
+
+/*
+ * Apply gain, encode every frame in the block and hand the slots to the
+ * media threads
+ */
+static void egress_batch_flush(egress_batch_t *batch) {
+    uint32_t peak[EGRESS_BATCH] = { 0 };
+
+    if (batch->scaled) {
+        egress_batch_gain(batch);
+    }
+
+    /* Peak of every frame in one pass over the rows */
+    for (int i = 0; i < NOVA_FRAME_SAMPLES; i++) {
+        const int16_t *row = batch->pcm[i];
+
+        for (int k = 0; k < EGRESS_BATCH; k++) {
+            uint32_t v = (uint32_t)(row[k] < 0 ? -row[k] : row[k]);
+            peak[k] = v > peak[k] ? v : peak[k];
+        }
+    }
+
+    for (uint32_t k = 0; k < batch->count; k++) {
+        nova_io_slot_t *slot = batch->slot[k];
+        egress_ring_t *ring = &slot->egress;
+        egress_slot_t *out = egress_ring_reserve(ring);
+
+        if (!out) {
+            if (ring->overflows == 1 && slot->ctx) {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(slot->ctx->session), SWITCH_LOG_WARNING,
+                    "Bot audio queue full - dropping frames\n");
+            }
+            continue;
+        }
+
+        switch (ring->format) {
+        case EGRESS_PCMU:
+            for (int i = 0; i < NOVA_FRAME_SAMPLES; i++) {
+                out->data[i] = ulaw_encode(batch->pcm[i][k]);
+            }
+            out->datalen = NOVA_FRAME_SAMPLES;
+            break;
+        case EGRESS_PCMA:
+            for (int i = 0; i < NOVA_FRAME_SAMPLES; i++) {
+                out->data[i] = alaw_lut[(uint16_t)batch->pcm[i][k] >> 3];
+            }
+            out->datalen = NOVA_FRAME_SAMPLES;
+            break;
+        default: {
+            int16_t *dst = (int16_t *)out->data;
+
+            for (int i = 0; i < NOVA_FRAME_SAMPLES; i++) {
+                dst[i] = batch->pcm[i][k];
+            }
+            out->datalen = NOVA_FRAME_BYTES;
+            break;
+        }
+        }
+
+        out->peak = peak[k];
+        egress_ring_commit(ring);
+    }
+
+    batch->count = 0;
+    batch->scaled = SWITCH_FALSE;
+}
+
+static void egress_batch_add(egress_batch_t *batch, nova_io_slot_t *slot, const int16_t *pcm) {
+    uint32_t k = batch->count;
+
+    for (int i = 0; i < NOVA_FRAME_SAMPLES; i++) {
+        batch->pcm[i][k] = pcm[i];
+    }
+    batch->gain[k] = slot->ctx->egress_gain;
+    batch->slot[k] = slot;
+    if (batch->gain[k] != EGRESS_GAIN_ONE) {
+        batch->scaled = SWITCH_TRUE;
+    }
+
+    if (++batch->count == EGRESS_BATCH) {
+        egress_batch_flush(batch);
+    }
+}
+
+/*
+ * Drop a recording in progress (worker mutex held)
+ */
+static void nova_io_record_stop(nova_io_slot_t *slot) {
+    free(slot->rec);
+    slot->rec = NULL;
+    slot->rec_frames = slot->rec_cap = 0;
+    slot->rec_hash[0] = '\0';
+}
+
+static void nova_io_record(nova_io_slot_t *slot, const int16_t *pcm) {
+    if (slot->rec_frames == slot->rec_cap) {
+        uint32_t cap = slot->rec_cap ? slot->rec_cap * 2 : 50;
+        int16_t *rec;
+
+        if (cap > EGRESS_CACHE_MAX_FRAMES || !(rec = realloc(slot->rec, (size_t)cap * NOVA_FRAME_BYTES))) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(slot->ctx->session), SWITCH_LOG_WARNING,
+                "Utterance %s too long to cache\n", slot->rec_hash);
+            nova_io_record_stop(slot);
+            return;
+        }
+        slot->rec = rec;
+        slot->rec_cap = cap;
+    }
+
+    memcpy(slot->rec + (size_t)slot->rec_frames * NOVA_FRAME_SAMPLES, pcm, NOVA_FRAME_BYTES);
+    slot->rec_frames++;
+}
+
+/*
+ * Stop a replay and unpin its entry (worker mutex held)
+ */
+static void nova_io_replay_stop(nova_io_slot_t *slot) {
+    nova_io_worker_t *worker = slot->worker;
+    nova_io_slot_t **link;
+
+    if (!slot->replay) {
+        return;
+    }
+
+    for (link = &worker->replaying; *link; link = &(*link)->replay_next) {
+        if (*link == slot) {
+            *link = slot->replay_next;
+            break;
+        }
+    }
+    egress_cache_release(slot->replay);
+    slot->replay = NULL;
+    slot->replay_next = NULL;
+}
+
+/*
+ * Keep every replaying slot EGRESS_REPLAY_DEPTH frames ahead of playback
+ */
+static void nova_io_replay(nova_io_worker_t *worker) {
+    nova_io_slot_t *slot = worker->replaying;
+
+    while (slot) {
+        nova_io_slot_t *next = slot->replay_next;
+        egress_cache_entry_t *entry = slot->replay;
+        uint32_t queued = egress_ring_count(&slot->egress);
+
+        while (queued++ < EGRESS_REPLAY_DEPTH && slot->replay_pos < entry->frames) {
+            const int16_t *pcm = entry->pcm + (size_t)slot->replay_pos++ * NOVA_FRAME_SAMPLES;
+
+            nova_gateway_audio(slot->ctx, pcm);
+            egress_batch_add(worker->batch, slot, pcm);
+        }
+
+        if (slot->replay_pos == entry->frames) {
+            char done[128];
+
+            switch_snprintf(done, sizeof(done), "{\"type\":\"play_done\",\"hash\":\"%s\"}", entry->hash);
+            nova_io_replay_stop(slot);
+            nova_io_send_control(slot, done);
+        }
+        slot = next;
+    }
+}
+
+/*
+ * Gateway control messages that concern the slot (egress cache), others
+ * go to nova_gateway_control
+ */
+static void nova_io_control(nova_io_slot_t *slot, const char *control) {
+    char hash[EGRESS_CACHE_HASH_LEN + 1];
+
+    if (strstr(control, "\"type\":\"cache_as\"")) {
+        nova_io_record_stop(slot);
+        if (egress_cache.entries && nova_json_string(control, "hash", hash, sizeof(hash))) {
+            switch_snprintf(slot->rec_hash, sizeof(slot->rec_hash), "%s", hash);
+        }
+    } else if (strstr(control, "\"type\":\"cache_end\"")) {
+        if (slot->rec_hash[0] && slot->rec_frames) {
+            egress_cache_put(slot->rec_hash, slot->rec, slot->rec_frames);
+            slot->rec = NULL;
+        }
+        nova_io_record_stop(slot);
+    } else if (strstr(control, "\"type\":\"play_ref\"")) {
+        egress_cache_entry_t *entry;
+
+        if (!nova_json_string(control, "hash", hash, sizeof(hash))) {
+            return;
+        }
+        nova_io_replay_stop(slot);
+        if (!(entry = egress_cache_get(hash))) {
+            char miss[128];
+
+            switch_snprintf(miss, sizeof(miss), "{\"type\":\"cache_miss\",\"hash\":\"%s\"}", hash);
+            nova_io_send_control(slot, miss);
+            return;
+        }
+        slot->replay = entry;
+        slot->replay_pos = 0;
+        slot->replay_next = slot->worker->replaying;
+        slot->worker->replaying = slot;
+    } else if (strstr(control, "\"type\":\"play_stop\"")) {
+        nova_io_replay_stop(slot);
+    } else {
+        nova_gateway_control(slot->ctx, control);
+    }
+}
+
+/*
+ * Split buffered bytes into gateway messages
+ * Audio is 320 bytes; control is a 4-byte big-endian length (never 320) + JSON.
+ */
+static void nova_io_parse(nova_io_slot_t *slot) {
+    uint32_t off = 0;
+
+    while (slot->ctx && slot->rx_len - off >= 4) {
+        const uint8_t *p = slot->rx + off;
+        uint32_t avail = slot->rx_len - off;
+        uint32_t length = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+
+        if (length > 0 && length < 1024 && length != NOVA_FRAME_BYTES) {
+            char control[1024];
+
+            if (avail < 4 + length) {
+                break;
+            }
+            memcpy(control, p + 4, length);
+            control[length] = '\0';
+            if (strstr(control, "\"type\":\"ready\"")) {
+                slot->ready = 1;
+            } else if (!slot->standby) {
+                nova_io_control(slot, control);
+            }
+            off += 4 + length;
+        } else {
+            int16_t pcm[NOVA_FRAME_SAMPLES];
+
+            if (avail < NOVA_FRAME_BYTES) {
+                break;
+            }
+            memcpy(pcm, p, NOVA_FRAME_BYTES);
+            slot->ready = 1;
+            if (!slot->standby) {
+                nova_gateway_audio(slot->ctx, pcm);
+            }
+            egress_batch_add(slot->worker->batch, slot, pcm);
+            if (slot->rec_hash[0]) {
+                nova_io_record(slot, pcm);
+            }
+            off += NOVA_FRAME_BYTES;
+        }
+    }
+
+    if (off) {
+        memmove(slot->rx, slot->rx + off, slot->rx_len - off);
+        slot->rx_len -= off;
+    }
+}
+
+static void nova_io_readable(nova_io_worker_t *worker, nova_io_slot_t *slot) {
+    /* Stale event for a slot that was detached (or reused) meanwhile */
+    if (!slot->ctx || slot->fd < 0) {
+        return;
+    }
+
+    for (;;) {
+        ssize_t r = nova_link_recv(slot->fd, slot->rx + slot->rx_len, sizeof(slot->rx) - slot->rx_len, MSG_DONTWAIT);
+
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (r <= 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+                "Gateway closed connection%s\n", slot->standby ? " (standby)" : "");
+            /* A failed hedge candidate is not the end of the session */
+            if (!slot->standby) {
+                slot->ctx->running = 0;
+            }
+            epoll_ctl(worker->epfd, EPOLL_CTL_DEL, slot->fd, NULL);
+            slot->fd = -1;
+            return;
+        }
+
+        slot->rx_len += (uint32_t)r;
+        nova_io_parse(slot);
+    }
+}
+
+static uint64_t nova_io_clock_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Arm the timerfd for the first non-empty bucket at or after tick n
+ */
+static void nova_io_arm(nova_io_worker_t *worker, uint64_t n) {
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+    uint64_t deadline;
+    uint32_t skip = 0;
+
+    while (skip < WHEEL_SLOTS && !worker->wheel[(n + skip) % WHEEL_SLOTS]) {
+        skip++;
+    }
+
+    worker->next_tick = n + skip;
+    deadline = worker->epoch_ns + worker->next_tick * WHEEL_TICK_NS;
+    its.it_value.tv_sec = (time_t)(deadline / 1000000000ULL);
+    its.it_value.tv_nsec = (long)(deadline % 1000000000ULL);
+    timerfd_settime(worker->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void nova_io_tick(nova_io_worker_t *worker) {
+    uint64_t expirations, now, current, late_ns;
+    uint32_t late_us;
+    int bucket;
+
+    if (read(worker->tfd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+
+    now = nova_io_clock_ns();
+    current = (now - worker->epoch_ns) / WHEEL_TICK_NS;
+    late_ns = now - (worker->epoch_ns + worker->next_tick * WHEEL_TICK_NS);
+    late_us = (uint32_t)(late_ns / 1000);
+    bucket = late_us < 50 ? 0 : late_us < 200 ? 1 : late_us < 1000 ? 2 : late_us < 5000 ? 3 : 4;
+
+    worker->ticks++;
+    worker->lat_total_us += late_us;
+    worker->lat_hist[bucket]++;
+    if (late_us > worker->lat_max_us) {
+        worker->lat_max_us = late_us;
+    }
+
+    /* A worker more than a period behind fires each bucket once, not once per missed period */
+    if (current - worker->next_tick >= WHEEL_SLOTS) {
+        worker->next_tick = current - (WHEEL_SLOTS - 1);
+    }
+
+    /* Only collected here; a slow channel write must not hold the mutex */
+    for (uint64_t n = worker->next_tick; n <= current; n++) {
+        for (nova_io_slot_t *slot = worker->wheel[n % WHEEL_SLOTS]; slot; slot = slot->wheel_next) {
+            if (slot->playing) {
+                continue;
+            }
+            slot->play_ctx = slot->ctx;
+            slot->play_next = NULL;
+            __atomic_store_n(&slot->playing, 1, __ATOMIC_RELAXED);
+            *worker->due_tail = slot;
+            worker->due_tail = &slot->play_next;
+        }
+    }
+
+    nova_io_arm(worker, current + 1);
+}
+
+/*
+ * Play the frames collected by nova_io_tick (worker mutex not held)
+ */
+static void nova_io_play_due(nova_io_worker_t *worker) {
+    nova_io_slot_t *slot = worker->due;
+
+    worker->due = NULL;
+    worker->due_tail = &worker->due;
+
+    while (slot) {
+        nova_io_slot_t *next = slot->play_next;
+
+        nova_play_frame(slot->play_ctx, &slot->egress);
+        /* Last touch: unregister may release the slot as soon as this is seen */
+        __atomic_store_n(&slot->playing, 0, __ATOMIC_RELEASE);
+        slot = next;
+    }
+}
+
+/*
+ * Put a blocking-mode session on its worker's wheel (worker mutex held)
+ */
+static void nova_io_wheel_add(nova_io_worker_t *worker, nova_io_slot_t *slot) {
+    uint64_t n;
+    int phase = 0;
+
+    for (int i = 1; i < WHEEL_SLOTS; i++) {
+        if (worker->wheel_load[i] < worker->wheel_load[phase]) {
+            phase = i;
+        }
+    }
+
+    slot->phase = phase;
+    slot->wheel_next = worker->wheel[phase];
+    worker->wheel[phase] = slot;
+    worker->wheel_load[phase]++;
+    worker->timers++;
+
+    /* The timer may be parked up to a period out; bring it forward if needed */
+    n = (nova_io_clock_ns() - worker->epoch_ns) / WHEEL_TICK_NS + 1;
+    if (n < worker->next_tick) {
+        nova_io_arm(worker, n);
+    }
+}
+
+static void nova_io_wheel_remove(nova_io_worker_t *worker, nova_io_slot_t *slot) {
+    nova_io_slot_t **link;
+
+    if (slot->phase < 0) {
+        return;
+    }
+
+    for (link = &worker->wheel[slot->phase]; *link; link = &(*link)->wheel_next) {
+        if (*link == slot) {
+            *link = slot->wheel_next;
+            break;
+        }
+    }
+    worker->wheel_load[slot->phase]--;
+    worker->timers--;
+    slot->phase = -1;
+    slot->wheel_next = NULL;
+}
+
+/*
+ * Pin and prioritise the calling worker thread
+ */
+static void nova_io_place(nova_io_worker_t *worker) {
+    if (worker->cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                "I/O worker %d: failed to pin to CPU %d\n", worker->index, worker->cpu);
+            worker->cpu = -1;
+        }
+    }
+
+    if (globals.io_sched != SCHED_OTHER) {
+        struct sched_param param = { 0 };
+
+        param.sched_priority = globals.io_priority;
+        if (pthread_setschedparam(pthread_self(), globals.io_sched, &param) != 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                "I/O worker %d: real-time priority %d not permitted (needs CAP_SYS_NICE)\n",
+                worker->index, globals.io_priority);
+        }
+    }
+}
+
+static void *SWITCH_THREAD_FUNC nova_io_thread(switch_thread_t *thread, void *obj) {
+    nova_io_worker_t *worker = (nova_io_worker_t *)obj;
+    struct epoll_event events[IO_MAX_EVENTS];
+    egress_batch_t batch;
+
+    nova_io_place(worker);
+
+    memset(&batch, 0, sizeof(batch));
+    worker->batch = &batch;
+    worker->due = NULL;
+    worker->due_tail = &worker->due;
+
+    /* First touch after pinning places the slab on this CPU's node */
+    worker->slab_bytes = (size_t)globals.io_slab_sessions * sizeof(nova_io_slot_t);
+    if (globals.io_slab_sessions > 0 && (worker->slab = nova_huge_map(&worker->slab_bytes, &worker->slab_huge))) {
+        memset(worker->slab, 0, worker->slab_bytes);
+        for (int i = globals.io_slab_sessions - 1; i >= 0; i--) {
+            worker->slab[i].fd = -1;
+            worker->slab[i].next_free = worker->free_list;
+            worker->free_list = &worker->slab[i];
+        }
+    }
+
+    worker->ready = 1;
+
+    while (worker->running) {
+        int n = epoll_wait(worker->epfd, events, IO_MAX_EVENTS, 100);
+
+        if (n <= 0) {
+            continue;
+        }
+
+        switch_mutex_lock(worker->mutex);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == worker) {
+                nova_io_tick(worker);
+            } else {
+                nova_io_readable(worker, (nova_io_slot_t *)events[i].data.ptr);
+            }
+        }
+        if (worker->replaying) {
+            nova_io_replay(worker);
+        }
+        /* Encode before unlocking so no detached slot is left in the block */
+        if (batch.count) {
+            egress_batch_flush(&batch);
+        }
+        switch_mutex_unlock(worker->mutex);
+
+        if (worker->due) {
+            nova_io_play_due(worker);
+        }
+    }
+
+    return NULL;
+}
+
+static switch_status_t nova_io_start(switch_memory_pool_t *pool) {
+    switch_threadattr_t *thd_attr = NULL;
+    char *cpus[64];
+    int ncpus = 0;
+
+    if (!zstr(globals.io_cpus)) {
+        ncpus = (int)switch_separate_string(switch_core_strdup(pool, globals.io_cpus), ',', cpus, 64);
+    }
+
+    globals.workers = switch_core_alloc(pool, sizeof(nova_io_worker_t) * globals.io_workers);
+    switch_threadattr_create(&thd_attr, pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+
+    for (int i = 0; i < globals.io_workers; i++) {
+        nova_io_worker_t *worker = &globals.workers[i];
+        struct epoll_event ev = { 0 };
+
+        worker->index = i;
+        worker->cpu = ncpus ? atoi(cpus[i % ncpus]) : -1;
+        worker->running = 1;
+        switch_mutex_init(&worker->mutex, SWITCH_MUTEX_NESTED, pool);
+
+        if ((worker->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+            (worker->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
+                "I/O worker %d: %s\n", i, strerror(errno));
+            return SWITCH_STATUS_FALSE;
+        }
+
+        /* Stagger the workers' wheels too */
+        worker->epoch_ns = nova_io_clock_ns() + (uint64_t)i * WHEEL_TICK_NS * WHEEL_SLOTS / globals.io_workers;
+        nova_io_arm(worker, 1);
+        ev.events = EPOLLIN;
+        ev.data.ptr = worker;
+        epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->tfd, &ev);
+
+        if (switch_thread_create(&worker->thread, thd_attr, nova_io_thread, worker, pool) != SWITCH_STATUS_SUCCESS) {
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    /* Sessions must not attach before the slabs exist */
+    for (int i = 0; i < globals.io_workers; i++) {
+        for (int wait = 0; !globals.workers[i].ready && wait < 1000; wait++) {
+            switch_yield(1000);
+        }
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void nova_io_stop(void) {
+    switch_status_t st;
+
+    for (int i = 0; globals.workers && i < globals.io_workers; i++) {
+        nova_io_worker_t *worker = &globals.workers[i];
+
+        if (!worker->thread) {
+            continue;
+        }
+        worker->running = 0;
+        switch_thread_join(&st, worker->thread);
+        close(worker->tfd);
+        close(worker->epfd);
+        if (worker->slab) {
+            munmap(worker->slab, worker->slab_bytes);
+        }
+    }
+}
+
+/*
+ * Register a gateway socket with the least loaded worker
+ * A standby slot (the second leg of a hedged start) only buffers what its
+ * gateway sends until nova_io_promote makes it the session's own.
+ */
+static nova_io_slot_t *nova_io_register(nova_session_t *ctx, int fd, switch_bool_t standby) {
+    nova_io_worker_t *worker = &globals.workers[0];
+    struct epoll_event ev = { 0 };
+    nova_io_slot_t *slot;
+
+    for (int i = 1; i < globals.io_workers; i++) {
+        if (globals.workers[i].sessions < worker->sessions) {
+            worker = &globals.workers[i];
+        }
+    }
+
+    switch_mutex_lock(worker->mutex);
+    if ((slot = worker->free_list)) {
+        worker->free_list = slot->next_free;
+    }
+    switch_mutex_unlock(worker->mutex);
+
+    if (!slot) {
+        slot = switch_core_alloc(ctx->pool, sizeof(nova_io_slot_t));
+        slot->pooled = SWITCH_TRUE;
+    }
+
+    /* Queue format was chosen from the channel codec before the gateway opened */
+    slot->egress.format = ctx->egress->format;
+    slot->egress.head = slot->egress.tail = slot->egress.overflows = 0;
+    slot->rx_len = 0;
+    slot->fd = fd;
+    slot->worker = worker;
+    slot->ctx = ctx;
+    slot->phase = -1;
+    slot->playing = 0;
+    slot->standby = standby;
+    slot->ready = 0;
+
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = slot;
+
+    switch_mutex_lock(worker->mutex);
+    if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, slot->fd, &ev) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_ERROR,
+            "Failed to register gateway socket with I/O worker %d: %s\n", worker->index, strerror(errno));
+        slot->fd = -1;
+        slot->ctx = NULL;
+        if (!slot->pooled) {
+            slot->next_free = worker->free_list;
+            worker->free_list = slot;
+        }
+        slot = NULL;
+    } else {
+        worker->sessions++;
+        if (!standby) {
+            ctx->egress = &slot->egress;
+            ctx->io = slot;
+            /* Background modes are paced by the media bug instead */
+            if (ctx->mode == NOVA_MODE_BLOCKING) {
+                nova_io_wheel_add(worker, slot);
+            }
+        }
+    }
+    switch_mutex_unlock(worker->mutex);
+
+    if (slot) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_DEBUG,
+            "Gateway socket served by I/O worker %d%s%s\n", worker->index,
+            slot->pooled ? " (slab full)" : "", standby ? " (standby)" : "");
+    }
+
+    return slot;
+}
+
+static switch_status_t nova_io_attach(nova_session_t *ctx) {
+    return nova_io_register(ctx, ctx->gateway_socket, SWITCH_FALSE) ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE;
+}
+
+/*
+ * Make a standby slot the session's gateway connection
+ */
+static void nova_io_promote(nova_session_t *ctx, nova_io_slot_t *slot) {
+    nova_io_worker_t *worker = slot->worker;
+
+    switch_mutex_lock(worker->mutex);
+    slot->standby = SWITCH_FALSE;
+    ctx->egress = &slot->egress;
+    ctx->io = slot;
+    if (ctx->mode == NOVA_MODE_BLOCKING) {
+        nova_io_wheel_add(worker, slot);
+    }
+    switch_mutex_unlock(worker->mutex);
+}
+
+/*
+ * Unregister a slot; once this returns the worker no longer touches it or
+ * its session (events are handled under the worker mutex, a stale event for
+ * a released slot is ignored, and a frame already due is waited for)
+ */
+static void nova_io_unregister(nova_io_slot_t *slot) {
+    nova_io_worker_t *worker = slot->worker;
+
+    switch_mutex_lock(worker->mutex);
+    if (slot->fd >= 0) {
+        epoll_ctl(worker->epfd, EPOLL_CTL_DEL, slot->fd, NULL);
+        slot->fd = -1;
+    }
+    nova_io_wheel_remove(worker, slot);
+    nova_io_replay_stop(slot);
+    nova_io_record_stop(slot);
+    slot->ctx = NULL;
+    worker->sessions--;
+    switch_mutex_unlock(worker->mutex);
+
+    /* Off the wheel, so at most the write already collected is left */
+    while (__atomic_load_n(&slot->playing, __ATOMIC_ACQUIRE)) {
+        switch_yield(1000);
+    }
+
+    switch_mutex_lock(worker->mutex);
+    if (!slot->pooled) {
+        slot->next_free = worker->free_list;
+        worker->free_list = slot;
+    }
+    switch_mutex_unlock(worker->mutex);
+}
+
+static void nova_io_detach(nova_session_t *ctx) {
+    if (ctx->io) {
+        nova_io_unregister(ctx->io);
+        ctx->io = NULL;
+    }
+}
+
+static void nova_io_status(switch_stream_handle_t *stream) {
+    static const char *policies[] = { "other", "fifo", "rr" };
+
+    for (int i = 0; globals.workers && i < globals.io_workers; i++) {
+        nova_io_worker_t *worker = &globals.workers[i];
+
+        stream->write_function(stream, "worker %d cpu=%d sched=%s/%d slab=%s sessions=%u timers=%u ticks=%llu tick-lateness avg=%lluus max=%uus",
+            i, worker->cpu, policies[globals.io_sched], globals.io_sched == SCHED_OTHER ? 0 : globals.io_priority,
+            !worker->slab ? "none" : worker->slab_huge ? "2MB" : "4KB", worker->sessions, worker->timers, (unsigned long long)worker->ticks,
+            (unsigned long long)(worker->ticks ? worker->lat_total_us / worker->ticks : 0), worker->lat_max_us);
+        for (int b = 0; b < IO_LAT_BUCKETS; b++) {
+            stream->write_function(stream, " %s=%u", io_lat_labels[b], worker->lat_hist[b]);
+        }
+        stream->write_function(stream, "\n");
+    }
+}
+
+/*
+ * Degradation ladder
+ * Once a second the monitor thread compares the workers' average tick
+ * lateness and the host's idle CPU with the configured limits. Under
+ * pressure it sheds one more stage per second; it steps back up one stage
+ * after degrade_recover_sec seconds with lateness below half the limit and
+ * idle CPU above twice its limit, so it does not flap around the threshold.
+ */
+static switch_bool_t nova_shed(nova_shed_t stage) {
+    int level = globals.degrade_level;
+
+    for (int i = 0; i < level; i++) {
+        if (globals.degrade_ladder[i] == stage) {
+            return SWITCH_TRUE;
+        }
+    }
+
+    return SWITCH_FALSE;
+}
+
+/*
+ * Idle share of all CPUs since the previous call, -1 if unknown
+ */
+static int nova_cpu_idle_pct(uint64_t *last_idle, uint64_t *last_total) {
+    unsigned long long v[8] = { 0 };
+    uint64_t idle, total = 0;
+    int pct = -1;
+    FILE *f;
+
+    if (!(f = fopen("/proc/stat", "r"))) {
+        return -1;
+    }
+    if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+               &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) == 8) {
+        for (int i = 0; i < 8; i++) {
+            total += v[i];
+        }
+        idle = v[3] + v[4];
+        if (*last_total && total > *last_total) {
+            pct = (int)((idle - *last_idle) * 100 / (total - *last_total));
+        }
+        *last_idle = idle;
+        *last_total = total;
+    }
+    fclose(f);
+
+    return pct;
+}
+
+static void *SWITCH_THREAD_FUNC nova_degrade_thread(switch_thread_t *thread, void *obj) {
+    uint64_t last_ticks = 0, last_lat = 0, last_idle = 0, last_total = 0;
+    int healthy = 0;
+
+    nova_cpu_idle_pct(&last_idle, &last_total);
+
+    while (globals.degrade_running) {
+        uint64_t ticks = 0, lat = 0;
+        uint32_t lateness_us;
+        int idle, level = globals.degrade_level;
+
+        for (int i = 0; i < 10 && globals.degrade_running; i++) {
+            switch_yield(100000);
+        }
+
+        for (int i = 0; i < globals.io_workers; i++) {
+            ticks += globals.workers[i].ticks;
+            lat += globals.workers[i].lat_total_us;
+        }
+        lateness_us = ticks > last_ticks ? (uint32_t)((lat - last_lat) / (ticks - last_ticks)) : 0;
+        last_ticks = ticks;
+        last_lat = lat;
+        idle = nova_cpu_idle_pct(&last_idle, &last_total);
+
+        globals.degrade_last_lateness_us = lateness_us;
+        globals.degrade_last_idle_pct = idle;
+
+        if (lateness_us > (uint32_t)globals.degrade_lateness_us || (idle >= 0 && idle < globals.degrade_cpu_idle_pct)) {
+            healthy = 0;
+            if (level < globals.degrade_steps) {
+                globals.degrade_level = level + 1;
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                    "CPU pressure (tick lateness %uus, %d%% idle) - degrade level %d: shedding %s\n",
+                    lateness_us, idle, level + 1, nova_shed_names[globals.degrade_ladder[level]]);
+            }
+        } else if (lateness_us < (uint32_t)globals.degrade_lateness_us / 2 &&
+                   (idle < 0 || idle > 2 * globals.degrade_cpu_idle_pct)) {
+            if (level > 0 && ++healthy >= globals.degrade_recover_sec) {
+                healthy = 0;
+                globals.degrade_level = level - 1;
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+                    "CPU pressure relieved - degrade level %d: restoring %s\n",
+                    level - 1, nova_shed_names[globals.degrade_ladder[level - 1]]);
+            }
+        } else {
+            healthy = 0;
+        }
+    }
+
+    return NULL;
+}
+
+static void nova_degrade_start(switch_memory_pool_t *pool) {
+    switch_threadattr_t *thd_attr = NULL;
+
+    if (!globals.degrade_steps) {
+        return;
+    }
+
+    globals.degrade_running = 1;
+    switch_threadattr_create(&thd_attr, pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    switch_thread_create(&globals.degrade_thread, thd_attr, nova_degrade_thread, NULL, pool);
+}
+
+static void nova_degrade_stop(void) {
+    switch_status_t st;
+
+    if (globals.degrade_thread) {
+        globals.degrade_running = 0;
+        switch_thread_join(&st, globals.degrade_thread);
+        globals.degrade_thread = NULL;
+    }
+}
+
+static void nova_degrade_status(switch_stream_handle_t *stream) {
+    if (!globals.degrade_steps) {
+        return;
+    }
+
+    stream->write_function(stream, "degrade level %d/%d shed=", globals.degrade_level, globals.degrade_steps);
+    for (int i = 0; i < globals.degrade_level; i++) {
+        stream->write_function(stream, "%s%s", i ? "," : "", nova_shed_names[globals.degrade_ladder[i]]);
+    }
+    stream->write_function(stream, "%s tick-lateness=%uus cpu-idle=%d%%\n", globals.degrade_level ? "" : "none",
+        globals.degrade_last_lateness_us, globals.degrade_last_idle_pct);
+}
+
+/*
+ * Refuse a new session on the last rung of the ladder; the dialplan sees
+ * nova_admission=rejected and can route the call elsewhere
+ */
+static switch_bool_t nova_admit(switch_core_session_t *session) {
+    if (!nova_shed(NOVA_SHED_ADMISSION)) {
+        return SWITCH_TRUE;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+        "Degrade level %d - not admitting new Nova session\n", globals.degrade_level);
+    switch_channel_set_variable(switch_core_session_get_channel(session), "nova_admission", "rejected");
+    return SWITCH_FALSE;
+}
+
+/*
+ * Format the JSON handshake line (NOVA_HANDSHAKE_BYTES is always enough
+ * for the fixed members; exported variables that do not fit are dropped)
+ */
+static void nova_format_handshake(nova_session_t *ctx, char *handshake, size_t len, switch_bool_t shadow) {
+    /* Extract UUI from SIP header if present */
+    const char *uui = switch_channel_get_variable(ctx->channel, "sip_h_User-to-User");
+    nova_json_writer_t w;
+
+    jw_init(&w, handshake, len);
+    w.reserve = 1;                  /* newline */
+    jw_open(&w);
+    jw_string(&w, "call_uuid", ctx->session_id);
+    jw_string(&w, "caller", ctx->caller_id);
+    jw_int(&w, "sample_rate", 8000);
+    jw_int(&w, "channels", ctx->channels);
+    jw_string(&w, "format", "PCM16");
+    jw_string(&w, "framing", "typed");
+    if (uui && *uui) {
+        jw_string(&w, "uui", uui);
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+            "Sending handshake with UUI: %s\n", uui);
+    }
+    if (ctx->conference) {
+        jw_string(&w, "conference", ctx->conference);
+    }
+    if (ctx->span_id[0]) {
+        char trace[64];
+
+        switch_snprintf(trace, sizeof(trace), "00-%s-%s-01", ctx->trace_id, ctx->span_id);
+        jw_string(&w, "traceparent", trace);
+    }
+    if (shadow) {
+        jw_bool(&w, "shadow", SWITCH_TRUE);
+    }
+    nova_vars_handshake(ctx, &w);
+
+    jw_close(&w);
+    w.reserve = 0;
+    jw_put(&w, "\n", 1);
+}
+
+/*
+ * Connect to the gateway, send the JSON handshake and start the receive thread
+ */
+static switch_status_t nova_gateway_open(nova_session_t *ctx) {
+    switch_core_session_t *session = ctx->session;
+    char gateway[160];
+    switch_time_t sent_at;
+
+    latency_init(&ctx->latency);
+    switch_snprintf(gateway, sizeof(gateway), "%s:%d", ctx->gateway_host, ctx->gateway_port);
+
+    /* Connect to Java gateway */
+    ctx->gateway_socket = connect_to_gateway(ctx->gateway_host, ctx->gateway_port);
+    nova_span(ctx, "gateway.connect", ctx->latency.opened_at, switch_time_now(), "gateway", gateway);
+    if (ctx->gateway_socket < 0) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+            "Failed to connect to gateway\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    char handshake[NOVA_HANDSHAKE_BYTES];
+    nova_format_handshake(ctx, handshake, sizeof(handshake), SWITCH_FALSE);
+
+    sent_at = switch_time_now();
+    ssize_t sent = nova_link_send(ctx->gateway_socket, handshake, strlen(handshake), 0);
+    nova_span(ctx, "gateway.handshake", sent_at, switch_time_now(), "gateway", gateway);
+    if (sent < 0) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+            "Failed to send handshake: %s\n", strerror(errno));
+        nova_link_close(ctx->gateway_socket);
+        ctx->gateway_socket = -1;
+        return SWITCH_STATUS_FALSE;
+    }
+
+    ctx->latency.connect_ms = (int)((switch_time_now() - ctx->latency.opened_at) / 1000);
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+        "Sent JSON handshake: %s", handshake);
+
+    /* Bot audio is received by an I/O worker */
+    if (nova_io_attach(ctx) != SWITCH_STATUS_SUCCESS) {
+        nova_link_close(ctx->gateway_socket);
+        ctx->gateway_socket = -1;
+        return SWITCH_STATUS_FALSE;
+    }
+
+    /* Readiness is tracked for every session; only some may hedge */
+    ctx->hedge_state = HEDGE_WAITING;
+    if (ctx->hedge) {
+        int backlog_ms = globals.hedge_after_ms + 2 * FORK_CONNECT_MS + (ctx->preroll ? globals.lazy_preroll_ms : 0);
+
+        __atomic_add_fetch(&globals.hedge_sessions, 1, __ATOMIC_RELAXED);
+        ctx->hedge_tx.size = (uint32_t)(backlog_ms / NOVA_FRAME_MS) * NOVA_FRAME_BYTES * ctx->channels + HEDGE_CONTROL_BYTES;
+        ctx->hedge_tx.buf = switch_core_alloc(ctx->pool, ctx->hedge_tx.size);
+    }
+
+    /* Mirror this session to the canary gateway if the call was sampled */
+    if (ctx->shadow_selected) {
+        char *shadow_handshake = switch_core_alloc(ctx->pool, NOVA_HANDSHAKE_BYTES);
+
+        nova_format_handshake(ctx, shadow_handshake, NOVA_HANDSHAKE_BYTES, SWITCH_TRUE);
+        if ((ctx->shadow = shadow_create(ctx->pool, shadow_handshake, &ctx->caller_speech_end))) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+                "Shadowing session to canary gateway %s:%d\n", globals.shadow_host, globals.shadow_port);
+        }
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Hedged start
+ * With hedge-gateway-host set, a session whose gateway has not said
+ * {"type":"ready"} (or sent audio) within hedge-after-ms gets the same
+ * handshake on the hedge gateway. Caller audio goes to both until one is
+ * ready; the other connection is closed, which ends its Bedrock session.
+ * Readiness is checked once per caller frame, on the thread that owns the
+ * session, so the switch never races the media path.
+ *
+ * The hedge is connected on a thread of its own, so a slow connect or TLS
+ * handshake never holds up a caller frame. Everything written to the
+ * primary since it opened (pre-roll, caller audio, pause/resume and vars
+ * messages) is kept and replayed to the hedge once it is up, so both
+ * gateways see the same stream. From then on the hedge gets each write the
+ * primary gets, through its own buffer flushed without blocking; a partial
+ * write leaves the rest queued, and a hedge that falls a full buffer behind
+ * is dropped.
+ */
+/*
+ * Drop the hedge. A connect still in progress is aborted; its thread is
+ * joined here once it has finished, else at session close (wait).
+ */
+static void nova_hedge_cancel(nova_session_t *ctx, switch_bool_t wait) {
+    fork_subscriber_t *sub = ctx->hedge_sub;
+    switch_status_t st;
+
+    if (ctx->hedge_io) {
+        nova_io_unregister(ctx->hedge_io);
+        ctx->hedge_io = NULL;
+    }
+    if (ctx->hedge_socket >= 0) {
+        nova_link_close(ctx->hedge_socket);
+        ctx->hedge_socket = -1;
+    }
+    if (!ctx->hedge_thread) {
+        return;
+    }
+
+    fork_stop(sub);
+    if (!wait && sub->sock < 0 && !sub->failed) {
+        return;
+    }
+    switch_thread_join(&st, ctx->hedge_thread);
+    ctx->hedge_thread = NULL;
+    if (sub->sock >= 0) {
+        nova_link_close(sub->sock);
+        sub->sock = -1;
+    }
+}
+
+static void *SWITCH_THREAD_FUNC nova_hedge_thread(switch_thread_t *thread, void *obj) {
+    fork_subscriber_t *sub = (fork_subscriber_t *)obj;
+    int sock = fork_connect(sub);
+
+    if (sock >= 0 && nova_link_send(sock, sub->header, strlen(sub->header), 0) < 0) {
+        nova_link_close(sock);
+        sock = -1;
+    }
+
+    switch_mutex_lock(sub->mutex);
+    sub->sock = sock;
+    sub->failed = sock < 0;
+    switch_mutex_unlock(sub->mutex);
+    return NULL;
+}
+
+static void nova_hedge_open(nova_session_t *ctx) {
+    const char *target = switch_core_sprintf(ctx->pool, "tcp://%s:%d?queue=1", globals.hedge_host, globals.hedge_port);
+    char *handshake = switch_core_alloc(ctx->pool, NOVA_HANDSHAKE_BYTES);
+    switch_threadattr_t *thd_attr = NULL;
+    fork_subscriber_t *sub;
+
+    __atomic_add_fetch(&globals.hedge_fired, 1, __ATOMIC_RELAXED);
+    ctx->hedge_opened_at = switch_time_now();
+    ctx->hedge_state = HEDGE_DONE;
+
+    /* The fork machinery's bounded, abortable gateway connect */
+    if (!(sub = fork_subscriber_parse(ctx->pool, target))) {
+        return;
+    }
+    nova_format_handshake(ctx, handshake, NOVA_HANDSHAKE_BYTES, SWITCH_FALSE);
+    sub->raw = SWITCH_TRUE;
+    sub->header = handshake;
+    sub->running = 1;
+
+    switch_threadattr_create(&thd_attr, ctx->pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    if (switch_thread_create(&ctx->hedge_thread, thd_attr, nova_hedge_thread, sub, ctx->pool) != SWITCH_STATUS_SUCCESS) {
+        ctx->hedge_thread = NULL;
+        return;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+        "Gateway not ready after %dms - hedging on %s:%d\n",
+        globals.hedge_after_ms, globals.hedge_host, globals.hedge_port);
+    ctx->hedge_sub = sub;
+    ctx->hedge_state = HEDGE_CONNECTING;
+}
+
+/*
+ * Queue bytes for the hedge; false if they do not fit
+ */
+static switch_bool_t nova_hedge_queue(nova_hedge_tx_t *tx, const struct iovec *iov, int n) {
+    size_t want = 0;
+
+    for (int i = 0; i < n; i++) {
+        want += iov[i].iov_len;
+    }
+    if (tx->sent && tx->len + want > tx->size) {
+        memmove(tx->buf, tx->buf + tx->sent, tx->len - tx->sent);
+        tx->len -= tx->sent;
+        tx->sent = 0;
+    }
+    if (tx->len + want > tx->size) {
+        return SWITCH_FALSE;
+    }
+
+    for (int i = 0; i < n; i++) {
+        memcpy(tx->buf + tx->len, iov[i].iov_base, iov[i].iov_len);
+        tx->len += (uint32_t)iov[i].iov_len;
+    }
+    return SWITCH_TRUE;
+}
+
+/*
+ * Write what the hedge socket takes without blocking; false on error
+ */
+static switch_bool_t nova_hedge_flush(nova_session_t *ctx) {
+    nova_hedge_tx_t *tx = &ctx->hedge_tx;
+
+    while (tx->sent < tx->len) {
+        size_t chunk = tx->len - tx->sent < HEDGE_WRITE_CHUNK ? tx->len - tx->sent : HEDGE_WRITE_CHUNK;
+        ssize_t n = nova_link_send(ctx->hedge_socket, tx->buf + tx->sent, chunk, MSG_DONTWAIT);
+
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        tx->sent += (uint32_t)n;
+    }
+
+    tx->len = tx->sent = 0;
+    return SWITCH_TRUE;
+}
+
+static void nova_hedge_ready(nova_session_t *ctx, const char *winner) {
+    uint32_t ready_ms = (uint32_t)((switch_time_now() - ctx->latency.opened_at) / 1000);
+
+    ctx->hedge_state = HEDGE_DONE;
+    __atomic_add_fetch(&globals.ready_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&globals.ready_total_ms, ready_ms, __ATOMIC_RELAXED);
+    if (ready_ms > globals.ready_max_ms) {
+        globals.ready_max_ms = ready_ms;
+    }
+    switch_channel_set_variable_printf(ctx->channel, "nova_gateway_ready_ms", "%u", ready_ms);
+    switch_channel_set_variable(ctx->channel, "nova_hedge", winner);
+    nova_span(ctx, "gateway.ready", ctx->latency.opened_at, switch_time_now(), "hedge", winner);
+}
+
+/*
+ * Advance the hedge once per caller frame
+ */
+static void nova_hedge_poll(nova_session_t *ctx) {
+    int waited_ms;
+
+    if (ctx->hedge_state != HEDGE_WAITING && ctx->hedge_state != HEDGE_CONNECTING && ctx->hedge_state != HEDGE_RACING) {
+        return;
+    }
+
+    if (ctx->io && ctx->io->ready) {
+        const char *winner = ctx->hedge_state == HEDGE_WAITING ? "none" : "primary";
+
+        if (ctx->hedge_state != HEDGE_WAITING) {
+            __atomic_add_fetch(&globals.hedge_primary_wins, 1, __ATOMIC_RELAXED);
+            nova_hedge_cancel(ctx, SWITCH_FALSE);
+        }
+        nova_hedge_ready(ctx, winner);
+        return;
+    }
+
+    if (ctx->hedge_state == HEDGE_WAITING) {
+        waited_ms = (int)((switch_time_now() - ctx->latency.opened_at) / 1000);
+        if (ctx->hedge && waited_ms >= globals.hedge_after_ms) {
+            nova_hedge_open(ctx);
+        }
+        return;
+    }
+
+    waited_ms = (int)((switch_time_now() - ctx->hedge_opened_at) / 1000);
+
+    if (ctx->hedge_state == HEDGE_CONNECTING) {
+        fork_subscriber_t *sub = ctx->hedge_sub;
+        switch_status_t st;
+
+        if (sub->sock < 0 && !sub->failed) {
+            if (waited_ms >= globals.hedge_giveup_ms) {
+                nova_hedge_cancel(ctx, SWITCH_FALSE);
+                ctx->hedge_state = HEDGE_DONE;
+            }
+            return;
+        }
+
+        /* The thread has published its result and is exiting */
+        switch_thread_join(&st, ctx->hedge_thread);
+        ctx->hedge_thread = NULL;
+        ctx->hedge_socket = sub->sock;
+        sub->sock = -1;
+        if (ctx->hedge_socket < 0) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                "Hedge gateway %s:%d unreachable - staying on %s:%d\n",
+                globals.hedge_host, globals.hedge_port, ctx->gateway_host, ctx->gateway_port);
+            nova_hedge_cancel(ctx, SWITCH_FALSE);
+            ctx->hedge_state = HEDGE_DONE;
+            return;
+        }
+        if (!(ctx->hedge_io = nova_io_register(ctx, ctx->hedge_socket, SWITCH_TRUE))) {
+            nova_hedge_cancel(ctx, SWITCH_FALSE);
+            ctx->hedge_state = HEDGE_DONE;
+            return;
+        }
+
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+            "Hedge gateway %s:%d connected - replaying %u bytes sent to %s:%d\n",
+            globals.hedge_host, globals.hedge_port, ctx->hedge_tx.len, ctx->gateway_host, ctx->gateway_port);
+        ctx->hedge_state = HEDGE_RACING;
+    }
+
+    if (!nova_hedge_flush(ctx)) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+            "Hedge gateway %s:%d write failed: %s\n", globals.hedge_host, globals.hedge_port, strerror(errno));
+        nova_hedge_cancel(ctx, SWITCH_FALSE);
+        ctx->hedge_state = HEDGE_DONE;
+        return;
+    }
+
+    /* Switch only once the hedge has everything the primary was sent */
+    if (ctx->hedge_io->ready && ctx->hedge_tx.len == 0) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+            "Hedge gateway %s:%d ready first - cancelling %s:%d\n",
+            globals.hedge_host, globals.hedge_port, ctx->gateway_host, ctx->gateway_port);
+        __atomic_add_fetch(&globals.hedge_wins, 1, __ATOMIC_RELAXED);
+        nova_gateway_release(ctx);
+        nova_io_detach(ctx);
+        nova_link_close(ctx->gateway_socket);
+        /* Audio still coalescing in ctx->tx was never written, so it goes to the hedge next */
+        ctx->gateway_socket = ctx->hedge_socket;
+        ctx->gateway_host = globals.hedge_host;
+        ctx->gateway_port = globals.hedge_port;
+        nova_io_promote(ctx, ctx->hedge_io);
+        ctx->hedge_io = NULL;
+        ctx->hedge_socket = -1;
+        nova_hedge_ready(ctx, "hedge");
+        return;
+    }
+
+    /* Neither came up; keep the primary and let the call run its course */
+    if (waited_ms >= globals.hedge_giveup_ms || ctx->hedge_io->fd < 0) {
+        nova_hedge_cancel(ctx, SWITCH_FALSE);
+        ctx->hedge_state = HEDGE_DONE;
+    }
+}
+
+static void nova_hedge_status(switch_stream_handle_t *stream) {
+    uint64_t ready = globals.ready_count;
+
+    if (zstr(globals.hedge_host)) {
+        return;
+    }
+    stream->write_function(stream,
+        "hedge: %s:%d after=%dms hedged=%llu/%llu (%.1f%%) hedge-wins=%llu primary-wins=%llu ready avg=%llums max=%ums\n",
+        globals.hedge_host, globals.hedge_port, globals.hedge_after_ms,
+        (unsigned long long)globals.hedge_fired, (unsigned long long)globals.hedge_sessions,
+        globals.hedge_sessions ? 100.0 * globals.hedge_fired / globals.hedge_sessions : 0.0,
+        (unsigned long long)globals.hedge_wins, (unsigned long long)globals.hedge_primary_wins,
+        (unsigned long long)(ready ? globals.ready_total_ms / ready : 0), globals.ready_max_ms);
+}
+
+/*
+ * Copy one write to the primary into the hedge's backlog, and on to the
+ * hedge once it is racing
+ */
+static void nova_hedge_mirror(nova_session_t *ctx, const struct iovec *iov, int n) {
+    if (!ctx->hedge_tx.buf || (ctx->hedge_state != HEDGE_WAITING && ctx->hedge_state != HEDGE_CONNECTING &&
+                               ctx->hedge_state != HEDGE_RACING)) {
+        return;
+    }
+
+    if (nova_hedge_queue(&ctx->hedge_tx, iov, n) &&
+        (ctx->hedge_state != HEDGE_RACING || nova_hedge_flush(ctx))) {
+        return;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+        "Hedge gateway %s:%d fell behind - staying on %s:%d\n",
+        globals.hedge_host, globals.hedge_port, ctx->gateway_host, ctx->gateway_port);
+    if (ctx->hedge_state == HEDGE_WAITING) {
+        /* Not fired yet: readiness is still tracked, there is just no hedge */
+        ctx->hedge = SWITCH_FALSE;
+        ctx->hedge_tx.buf = NULL;
+        return;
+    }
+    nova_hedge_cancel(ctx, SWITCH_FALSE);
+    ctx->hedge_state = HEDGE_DONE;
+}
+
+/*
+ * Gateway writes
+ * Caller audio for the gateway goes through a small per-connection buffer
+ * owned by the session thread. A live frame is written as soon as it is
+ * queued, so none waits for another; only a burst such as the pre-roll
+ * replay is gathered into one write. A control message is written in the
+ * same writev as the audio queued before it, so ordering on the wire is
+ * unchanged.
+ */
+static switch_status_t nova_tx_write(nova_session_t *ctx, const uint8_t *extra, size_t extra_len) {
+    struct iovec iov[2];
+    int n = 0;
+    ssize_t want = 0, sent;
+
+    if (ctx->tx.len) {
+        iov[n].iov_base = ctx->tx.buf;
+        iov[n++].iov_len = ctx->tx.len;
+        want += ctx->tx.len;
+    }
+    if (extra_len) {
+        iov[n].iov_base = (void *)extra;
+        iov[n++].iov_len = extra_len;
+        want += extra_len;
+    }
+    if (!n) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    sent = nova_link_writev(ctx->gateway_socket, iov, n);
+    nova_hedge_mirror(ctx, iov, n);
+    __atomic_add_fetch(&globals.tx_frames, ctx->tx.frames, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&globals.tx_writes, 1, __ATOMIC_RELAXED);
+    ctx->tx.total_frames += ctx->tx.frames;
+    ctx->tx.total_writes++;
+    ctx->tx.len = 0;
+    ctx->tx.frames = 0;
+
+    if (sent < want) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_ERROR,
+            "Failed to send to gateway: %s\n", sent < 0 ? strerror(errno) : "short write");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Queue one caller frame (mono or stereo); written now unless more of a
+ * burst follows (flush false)
+ */
+static switch_status_t nova_tx_frame(nova_session_t *ctx, const void *data, size_t len, switch_bool_t flush) {
+    if (ctx->tx.len + NOVA_MSG_HEADER + len > sizeof(ctx->tx.buf) && nova_tx_write(ctx, NULL, 0) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    nova_msg_header(ctx->tx.buf + ctx->tx.len, NOVA_MSG_AUDIO, (uint32_t)len);
+    memcpy(ctx->tx.buf + ctx->tx.len + NOVA_MSG_HEADER, data, len);
+    ctx->tx.len += (uint32_t)(NOVA_MSG_HEADER + len);
+    ctx->tx.frames++;
+
+    if (flush) {
+        return nova_tx_write(ctx, NULL, 0);
+    }
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void nova_tx_status(switch_stream_handle_t *stream) {
+    uint64_t writes = globals.tx_writes;
+
+    stream->write_function(stream, "gateway-tx: frames=%llu writes=%llu frames/write=%.2f (per connection in the session lines)\n",
+        (unsigned long long)globals.tx_frames, (unsigned long long)writes,
+        writes ? (double)globals.tx_frames / writes : 0.0);
+}
+
+/*
+ * Send one decoded 20ms caller frame to the gateway
+ * flush is false while replaying a burst that ends with a flushed frame
+ */
+static switch_status_t nova_send_caller_frame(nova_session_t *ctx, const int16_t *pcm, switch_bool_t flush) {
+    switch_status_t status = nova_tx_frame(ctx, pcm, NOVA_FRAME_BYTES, flush);
+
+    ctx->frames_sent++;
+
+    if (ctx->shadow) {
+        fork_publish(&ctx->shadow->tee, FORK_LEG_CALLER, pcm);
+    }
+
+    return status;
+}
+
+/*
+ * Send a control message to the gateway
+ */
+static switch_status_t nova_send_control(nova_session_t *ctx, const char *json) {
+    uint8_t msg[1024];
+    size_t len = nova_control_encode(msg, sizeof(msg), json);
+
+    if (!len) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_ERROR,
+            "Control message length %d not sendable\n", (int)strlen(json));
+        return SWITCH_STATUS_FALSE;
+    }
+
+    /* Audio queued before the message goes out with it */
+    if (nova_tx_write(ctx, msg, len) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+        "Sent control message to gateway: %s\n", json);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Send one vars message built by nova_vars_poll
+ */
+static void nova_vars_send(nova_session_t *ctx, nova_json_writer_t *w) {
+    jw_close(w);
+    jw_close(w);
+    nova_send_control(ctx, w->buf);
+}
+
+/*
+ * Send changed exported variables (session thread, once per caller frame)
+ */
+static void nova_vars_poll(nova_session_t *ctx) {
+    nova_json_writer_t w, saved;
+    char msg[NOVA_VARS_MSG_BYTES + 8];
+    switch_time_t now;
+    int members = 0;
+
+    if (!ctx->export_count || (now = switch_time_now()) - ctx->export_checked_at < (switch_time_t)globals.export_poll_ms * 1000) {
+        return;
+    }
+    ctx->export_checked_at = now;
+
+    for (int i = 0; i < ctx->export_count; i++) {
+        const char *value = switch_channel_get_variable(ctx->channel, ctx->export_names[i]);
+        uint32_t hash = nova_vars_hash(value);
+
+        if (hash == ctx->export_hash[i]) {
+            continue;
+        }
+        ctx->export_hash[i] = hash;
+
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (!members) {
+                jw_init(&w, msg, NOVA_VARS_MSG_BYTES);
+                jw_open(&w);
+                jw_string(&w, "type", "vars");
+                jw_key(&w, "vars");
+                jw_open(&w);
+            }
+            saved = w;
+            jw_string(&w, ctx->export_names[i], value);
+            if (!w.full) {
+                members++;
+                break;
+            }
+            w = saved;
+            msg[w.len] = '\0';
+            if (!members) {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_WARNING,
+                    "%s changed but is too large for a vars message (%d bytes)\n",
+                    ctx->export_names[i], value ? (int)strlen(value) : 0);
+                break;
+            }
+            /* Send what fits and start another message */
+            nova_vars_send(ctx, &w);
+            members = 0;
+        }
+    }
+
+    if (members) {
+        nova_vars_send(ctx, &w);
+    }
+}
+
+/*
+ * Send everything held in the pre-roll ring, oldest first
+ */
+static switch_status_t nova_preroll_flush(nova_session_t *ctx) {
+    preroll_ring_t *ring = ctx->preroll;
+
+    while (ring->count > 0) {
+        const int16_t *frame = ring->frames + (size_t)ring->head * NOVA_FRAME_SAMPLES;
+        if (nova_send_caller_frame(ctx, frame, ring->count == 1) != SWITCH_STATUS_SUCCESS) {
+            return SWITCH_STATUS_FALSE;
+        }
+        ring->head = (ring->head + 1) % ring->capacity;
+        ring->count--;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Hold handling for a caller frame on an open gateway session
+ * Streaming pauses once music has been heard for hold_detect_ms and resumes
+ * on caller speech; frames heard while paused feed the pre-roll ring so the
+ * resumed utterance is not clipped.
+ */
+static switch_status_t nova_hold_frame(nova_session_t *ctx, const int16_t *pcm, switch_bool_t speech) {
+    switch_bool_t music = music_detect_process(&ctx->music, pcm, NOVA_FRAME_SAMPLES);
+
+    if (!ctx->paused) {
+        if (!music) {
+            return nova_send_caller_frame(ctx, pcm, SWITCH_TRUE);
+        }
+
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+            "Hold music detected - pausing caller audio to gateway\n");
+        ctx->paused = SWITCH_TRUE;
+        ctx->paused_at = switch_time_now();
+        ctx->preroll->head = 0;
+        ctx->preroll->count = 0;
+        return nova_send_control(ctx, "{\"type\":\"paused\",\"reason\":\"music\"}");
+    }
+
+    preroll_ring_push(ctx->preroll, pcm);
+    if (music || !speech) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    switch_time_t paused_for = switch_time_now() - ctx->paused_at;
+    ctx->paused_total += paused_for;
+    ctx->paused = SWITCH_FALSE;
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+        "Caller speech after %dms on hold - resuming caller audio to gateway\n",
+        (int)(paused_for / 1000));
+
+    if (nova_send_control(ctx, "{\"type\":\"resumed\"}") != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    return nova_preroll_flush(ctx);
+}
+
+/*
+ * Signal a pause/resume requested through the API to the gateway
+ */
+static switch_status_t nova_api_pause_sync(nova_session_t *ctx) {
+    if (ctx->api_paused == ctx->api_paused_sent) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    ctx->api_paused_sent = ctx->api_paused;
+    return nova_send_control(ctx, ctx->api_paused ? "{\"type\":\"paused\",\"reason\":\"api\"}" :
+                                                    "{\"type\":\"resumed\"}");
+}
+
+/*
+ * Caller turn spans from VAD transitions; speech starting while the bot is
+ * talking (or still has audio queued) is a barge-in
+ */
+static void nova_trace_caller(nova_session_t *ctx, switch_bool_t speech) {
+    switch_time_t now = switch_time_now();
+    char queued[16];
+
+    if (speech && !ctx->vad_was_active) {
+        ctx->caller_turn_start = now - (switch_time_t)ctx->vad.onset_frames * NOVA_FRAME_MS * 1000;
+        if (ctx->bot_turn_start && (now - ctx->bot_turn_last < BOT_TURN_GAP_US || egress_ring_count(ctx->egress))) {
+            switch_snprintf(queued, sizeof(queued), "%u", egress_ring_count(ctx->egress) * NOVA_FRAME_MS);
+            nova_span(ctx, "barge_in", ctx->caller_turn_start, now, "bot_queued_ms", queued);
+            if (!ctx->quality.barge_at) {
+                ctx->quality.barge_at = ctx->caller_turn_start;
+            }
+        }
+    } else if (!speech && ctx->vad_was_active && ctx->caller_turn_start) {
+        nova_span(ctx, "caller.turn", ctx->caller_turn_start, ctx->caller_speech_end, NULL, NULL);
+    }
+}
+
+/*
+ * Handle one decoded 20ms caller frame
+ * In lazy mode frames are held in the pre-roll ring until the VAD flags
+ * speech; the gateway session is then opened and the ring replayed.
+ */
+static switch_status_t nova_ingress_frame(nova_session_t *ctx, const int16_t *pcm) {
+    switch_bool_t speech = vad_process(&ctx->vad, pcm, NOVA_FRAME_SAMPLES);
+
+    nova_rtp_sample(ctx);
+
+    /* End of caller speech, backdated by the VAD hangover */
+    if (ctx->vad_was_active && !speech) {
+        ctx->caller_speech_end = switch_time_now() - (switch_time_t)ctx->vad.hangover_frames * NOVA_FRAME_MS * 1000;
+    }
+    nova_trace_caller(ctx, speech);
+    ctx->vad_was_active = speech;
+
+    if (ctx->fork) {
+        fork_publish(ctx->fork, FORK_LEG_CALLER, pcm);
+    }
+
+    if (ctx->gateway_socket >= 0) {
+        nova_hedge_poll(ctx);
+        nova_vars_poll(ctx);
+        if (nova_api_pause_sync(ctx) != SWITCH_STATUS_SUCCESS) {
+            return SWITCH_STATUS_FALSE;
+        }
+        if (ctx->api_paused) {
+            return SWITCH_STATUS_SUCCESS;
+        }
+        /* Under CPU pressure the detector is skipped, but a hold in progress still ends normally */
+        if (ctx->hold_detect && (ctx->paused || !nova_shed(NOVA_SHED_HOLD_DETECT))) {
+            return nova_hold_frame(ctx, pcm, speech);
+        }
+        return nova_send_caller_frame(ctx, pcm, SWITCH_TRUE);
+    }
+
+    preroll_ring_push(ctx->preroll, pcm);
+    if (!speech) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    int waited_ms = (int)((switch_time_now() - ctx->start_time) / 1000);
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+        "Caller speech detected after %dms - opening gateway session (%u pre-roll frames)\n",
+        waited_ms, ctx->preroll->count);
+    switch_channel_set_variable_printf(ctx->channel, "nova_lazy_wait_ms", "%d", waited_ms);
+
+    if (nova_gateway_open(ctx) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    /* The pre-roll already contains this frame */
+    return nova_preroll_flush(ctx);
+}
+
+/*
+ * Handle one 20ms interleaved caller/agent frame (assist mode)
+ * Each leg has its own VAD; speech transitions are sent to the gateway as
+ * {"type":"vad","leg":...,"speech":...} so turns can be attributed, and
+ * the stereo frame goes out as one 640-byte write, keeping legs aligned.
+ */
+static switch_status_t nova_assist_frame(nova_session_t *ctx, const int16_t *stereo) {
+    int16_t caller[NOVA_FRAME_SAMPLES], agent[NOVA_FRAME_SAMPLES];
+    switch_bool_t caller_speech, agent_speech;
+    char msg[64];
+
+    for (int i = 0; i < NOVA_FRAME_SAMPLES; i++) {
+        caller[i] = stereo[2 * i];
+        agent[i] = stereo[2 * i + 1];
+    }
+
+    caller_speech = vad_process(&ctx->vad, caller, NOVA_FRAME_SAMPLES);
+    agent_speech = vad_process(&ctx->vad_agent, agent, NOVA_FRAME_SAMPLES);
+    nova_hedge_poll(ctx);
+    nova_vars_poll(ctx);
+    nova_rtp_sample(ctx);
+
+    if (ctx->fork) {
+        fork_publish(ctx->fork, FORK_LEG_CALLER, caller);
+    }
+
+    if (nova_api_pause_sync(ctx) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    if (caller_speech != ctx->vad_was_active) {
+        if (!caller_speech) {
+            ctx->caller_speech_end = switch_time_now() - (switch_time_t)ctx->vad.hangover_frames * NOVA_FRAME_MS * 1000;
+        }
+        nova_trace_caller(ctx, caller_speech);
+        ctx->vad_was_active = caller_speech;
+        switch_snprintf(msg, sizeof(msg), "{\"type\":\"vad\",\"leg\":\"caller\",\"speech\":%s}",
+                        caller_speech ? "true" : "false");
+        if (!ctx->api_paused && nova_send_control(ctx, msg) != SWITCH_STATUS_SUCCESS) {
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    if (agent_speech != ctx->agent_was_active) {
+        ctx->agent_was_active = agent_speech;
+        switch_snprintf(msg, sizeof(msg), "{\"type\":\"vad\",\"leg\":\"agent\",\"speech\":%s}",
+                        agent_speech ? "true" : "false");
+        if (!ctx->api_paused && nova_send_control(ctx, msg) != SWITCH_STATUS_SUCCESS) {
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    if (ctx->api_paused) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if (nova_tx_frame(ctx, stereo, NOVA_FRAME_BYTES * 2, SWITCH_TRUE) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+    ctx->frames_sent++;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Session registry, keyed by call UUID, for the nova_sonic API
+ */
+static void nova_registry_add(nova_session_t *ctx) {
+    switch_mutex_lock(globals.sessions_mutex);
+    switch_core_hash_insert(globals.sessions, ctx->session_id, ctx);
+    switch_mutex_unlock(globals.sessions_mutex);
+}
+
+static void nova_registry_remove(nova_session_t *ctx) {
+    switch_mutex_lock(globals.sessions_mutex);
+    switch_core_hash_delete(globals.sessions, ctx->session_id);
+    switch_mutex_unlock(globals.sessions_mutex);
+}
+
+/*
+ * Create the per-call context
+ * Caller identity, bot output stream and the per-call feature switches
+ * (channel variables override module config). Returns NULL on failure.
+ */
+static nova_session_t *nova_session_create(switch_core_session_t *session, nova_mode_t mode) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    switch_memory_pool_t *pool = NULL;
+    nova_session_t *ctx;
+    uint8_t *block;
+
+    /* Create memory pool for session */
+    if (switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+            "Failed to create memory pool\n");
+        return NULL;
+    }
+
+    /* Allocate session context, with its rings, from the arena when it has room */
+    if ((block = nova_arena_alloc())) {
+        ctx = (nova_session_t *)block;
+        ctx->egress = (egress_ring_t *)(block + arena.egress_off);
+    } else {
+        ctx = switch_core_alloc(pool, sizeof(nova_session_t));
+        ctx->egress = switch_core_alloc(pool, sizeof(egress_ring_t));
+    }
+    ctx->session = session;
+    ctx->channel = channel;
+    ctx->pool = pool;
+    ctx->mode = mode;
+    ctx->channels = mode == NOVA_MODE_ASSIST ? 2 : 1;
+    ctx->running = 1;
+    ctx->gateway_socket = -1;
+    ctx->gateway_host = globals.gateway_host;
+    ctx->gateway_port = globals.gateway_port;
+    ctx->start_time = switch_time_now();
+    nova_gateway_pick(ctx);
+
+    /* Generate session ID */
+    const char *uuid = switch_core_session_get_uuid(session);
+    switch_snprintf(ctx->session_id, sizeof(ctx->session_id), "%s", uuid);
+    nova_trace_init(ctx);
+
+    /* Get caller ID */
+    const char *caller_number = switch_channel_get_variable(channel, "caller_id_number");
+    if (caller_number) {
+        switch_snprintf(ctx->caller_id, sizeof(ctx->caller_id), "%s", caller_number);
+    } else {
+        switch_snprintf(ctx->caller_id, sizeof(ctx->caller_id), "Unknown");
+    }
+
+    /* Set on the loopback leg by nova_sonic conference; its media is the room's mix */
+    const char *conference = switch_channel_get_variable(channel, "nova_conference");
+    if (!zstr(conference)) {
+        ctx->conference = switch_core_strdup(pool, conference);
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+        "Session: %s, Caller: %s\n", ctx->session_id, ctx->caller_id);
+    nova_vars_init(ctx);
+
+    /* Bot audio queue; linear until the caller picks a channel codec */
+    ctx->egress->format = EGRESS_L16;
+
+    const char *gain_var = switch_channel_get_variable(channel, "nova_egress_gain_db");
+    ctx->egress_gain = egress_gain_q12(gain_var ? atof(gain_var) : globals.egress_gain_db);
+
+    ctx->hedge_socket = -1;
+    const char *hedge_var = switch_channel_get_variable(channel, "nova_hedge_start");
+    ctx->hedge = !zstr(globals.hedge_host) && (!hedge_var || switch_true(hedge_var));
+
+    /* DTX needs control over which ticks write, which only the blocking loop has */
+    const char *dtx_var = switch_channel_get_variable(channel, "nova_dtx");
+    ctx->dtx_enabled = mode == NOVA_MODE_BLOCKING && (dtx_var ? switch_true(dtx_var) : globals.dtx);
+    if (ctx->dtx_enabled) {
+        dtx_init(&ctx->dtx, globals.dtx_threshold_db, globals.dtx_hangover_ms, globals.dtx_sid_interval_ms);
+    }
+
+    /* Caller speech detection; lazy start can be overridden per call */
+    vad_init(&ctx->vad, globals.vad_threshold_db, globals.vad_onset_ms, globals.vad_hangover_ms);
+
+    /* Only the blocking loop may open the gateway mid-call: in the background
+     * modes caller frames arrive on the media thread, which must not connect */
+    const char *lazy_var = switch_channel_get_variable(channel, "nova_lazy_start");
+    ctx->lazy_start = mode == NOVA_MODE_BLOCKING && (lazy_var ? switch_true(lazy_var) : globals.lazy_start);
+
+    const char *hold_var = switch_channel_get_variable(channel, "nova_hold_detect");
+    ctx->hold_detect = hold_var ? switch_true(hold_var) : globals.hold_detect;
+    if (ctx->conference) {
+        /* Room music or silence is not a caller on hold */
+        ctx->hold_detect = SWITCH_FALSE;
+    }
+
+    if ((ctx->lazy_start || ctx->hold_detect) && block) {
+        ctx->preroll = (preroll_ring_t *)(block + arena.preroll_off);
+        ctx->preroll->frames = (int16_t *)(block + arena.preroll_off + NOVA_CACHE_ALIGN(sizeof(preroll_ring_t)));
+        ctx->preroll->capacity = arena.preroll_frames;
+    } else if (ctx->lazy_start || ctx->hold_detect) {
+        ctx->preroll = preroll_ring_create(pool, globals.lazy_preroll_ms);
+    }
+
+    if (ctx->hold_detect) {
+        music_detect_init(&ctx->music, ctx->vad.threshold, globals.hold_detect_ms,
+                          globals.hold_flatness_max, globals.hold_periodicity_min);
+    }
+
+    const char *shadow_var = switch_channel_get_variable(channel, "nova_shadow");
+    ctx->shadow_selected = shadow_var ? switch_true(shadow_var) : shadow_sampled(ctx->session_id);
+    if (zstr(globals.shadow_host) || nova_shed(NOVA_SHED_SHADOW)) {
+        ctx->shadow_selected = SWITCH_FALSE;
+    }
+
+    /* Pre-roll, hold detection and the shadow mirror work on mono caller audio */
+    if (mode == NOVA_MODE_ASSIST) {
+        vad_init(&ctx->vad_agent, globals.vad_threshold_db, globals.vad_onset_ms, globals.vad_hangover_ms);
+        ctx->lazy_start = SWITCH_FALSE;
+        ctx->hold_detect = SWITCH_FALSE;
+        ctx->shadow_selected = SWITCH_FALSE;
+    }
+
+    return ctx;
+}
+
+/*
+ * Open the gateway session (or defer it in lazy mode) and start the audio fork
+ */
+static switch_status_t nova_session_start(nova_session_t *ctx) {
+    if (ctx->lazy_start) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+            "Lazy start: gateway session deferred until caller speech (pre-roll %dms)\n",
+            globals.lazy_preroll_ms);
+    } else if (nova_gateway_open(ctx) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    const char *fork_targets = switch_channel_get_variable(ctx->channel, "nova_fork");
+    if (!fork_targets) {
+        fork_targets = globals.fork_targets;
+    }
+    if (!zstr(fork_targets)) {
+        /* The caller ID comes from SIP, so it is escaped like the gateway handshake */
+        char *header = switch_core_alloc(ctx->pool, NOVA_HANDSHAKE_BYTES);
+        nova_json_writer_t w;
+
+        jw_init(&w, header, NOVA_HANDSHAKE_BYTES);
+        w.reserve = 1;              /* newline */
+        jw_open(&w);
+        jw_string(&w, "call_uuid", ctx->session_id);
+        jw_string(&w, "caller", ctx->caller_id);
+        jw_int(&w, "sample_rate", 8000);
+        jw_int(&w, "channels", 1);
+        jw_string(&w, "format", "PCM16");
+        jw_close(&w);
+        w.reserve = 0;
+        jw_put(&w, "\n", 1);
+        ctx->fork = fork_create(ctx->pool, fork_targets, header);
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Stop the gateway session and secondary consumers, publish per-call stats
+ * as channel variables and release the context
+ */
+static void nova_session_close(nova_session_t *ctx) {
+    switch_channel_t *channel = ctx->channel;
+    switch_memory_pool_t *pool = ctx->pool;
+    switch_time_t teardown_at = switch_time_now();
+    nova_quality_score_t score;
+
+    ctx->running = 0;
+
+    /* Scored while the gateway socket and egress ring are still the session's */
+    quality_score(ctx, &score);
+    if (globals.rtp_stats_interval_sec) {
+        nova_rtp_read(ctx);
+    }
+
+    if (ctx->hold_detect) {
+        if (ctx->paused) {
+            ctx->paused_total += switch_time_now() - ctx->paused_at;
+        }
+        switch_channel_set_variable_printf(channel, "nova_hold_paused_ms", "%d", (int)(ctx->paused_total / 1000));
+    }
+    switch_channel_set_variable_printf(channel, "nova_tx_frames", "%u", ctx->tx.total_frames);
+    switch_channel_set_variable_printf(channel, "nova_tx_writes", "%u", ctx->tx.total_writes);
+
+    /* The worker stops touching the session before the socket is closed */
+    nova_hedge_cancel(ctx, SWITCH_TRUE);
+    nova_io_detach(ctx);
+    if (ctx->gateway_socket >= 0) {
+        nova_link_close(ctx->gateway_socket);
+    }
+    nova_gateway_release(ctx);
+
+    if (ctx->latency.opened_at) {
+        switch_channel_set_variable_printf(channel, "nova_mos", "%.2f", score.mos);
+        switch_channel_set_variable_printf(channel, "nova_r_factor", "%.1f", score.r);
+        switch_channel_set_variable_printf(channel, "nova_concealed_ms", "%u", ctx->quality.underruns * NOVA_FRAME_MS);
+        switch_channel_set_variable_printf(channel, "nova_egress_dropped_frames", "%u", score.dropped);
+        switch_channel_set_variable_printf(channel, "nova_mouth_to_ear_ms", "%d", score.ta_ms);
+        switch_channel_set_variable_printf(channel, "nova_barge_stop_avg_ms", "%d", score.barge_stop_ms);
+        if (ctx->rtp.samples) {
+            switch_channel_set_variable_printf(channel, "nova_rtp_jitter_ms", "%.1f", ctx->rtp.jitter_ms);
+            switch_channel_set_variable_printf(channel, "nova_rtp_jitter_max_ms", "%.1f", ctx->rtp.jitter_max_ms);
+            switch_channel_set_variable_printf(channel, "nova_rtp_loss_pct", "%.2f", ctx->rtp.loss_pct);
+            switch_channel_set_variable_printf(channel, "nova_rtp_flaws", "%u", ctx->rtp.flaws);
+        }
+        switch_channel_set_variable(channel, "nova_quality_blame", nova_blame(ctx, &score));
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+            "Call quality: MOS %.2f (R %.1f), loss %.1f%%, delay %dms, barge-in stop %dms; caller RTP jitter %.1fms (max %.1f), loss %.2f%%, %u flaws; blame %s\n",
+            score.mos, score.r, score.loss_pct, score.ta_ms, score.barge_stop_ms,
+            ctx->rtp.jitter_ms, ctx->rtp.jitter_max_ms, ctx->rtp.loss_pct, ctx->rtp.flaws, nova_blame(ctx, &score));
+    }
+
+    if (ctx->dtx_enabled) {
+        switch_channel_set_variable_printf(channel, "nova_dtx_sid_frames", "%u", ctx->dtx.sids);
+        switch_channel_set_variable_printf(channel, "nova_dtx_suppressed_frames", "%u", ctx->dtx.suppressed);
+    }
 
-    /* Audio streams */
-    audio_stream_t *input_stream;   /* Caller audio going to Java gateway */
-    audio_stream_t *output_stream;  /* Java gateway audio going to caller */
+    if (ctx->latency.opened_at) {
+        switch_channel_set_variable_printf(channel, "nova_first_audio_ms", "%d", ctx->latency.first_audio_ms);
+        switch_channel_set_variable_printf(channel, "nova_response_avg_ms", "%d", latency_response_avg_ms(&ctx->latency));
+        switch_channel_set_variable_printf(channel, "nova_response_max_ms", "%d", ctx->latency.response_max_ms);
+    }
 
-    /* TCP connection to Java gateway */
-    int gateway_socket;
-    char *gateway_host;
-    int gateway_port;
-    char *session_id;
-    char *caller_id;
+    if (ctx->shadow) {
+        nova_latency_t *p = &ctx->latency, *c = &ctx->shadow->latency;
 
-    /* State */
-    int running;
-    switch_thread_t *send_thread;
-    switch_thread_t *recv_thread;
+        shadow_destroy(ctx->shadow);
 
-    /* Memory pool */
-    switch_memory_pool_t *pool;
-} nova_session_t;
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+            "Shadow comparison: connect %d/%dms, first audio %d/%dms, response avg %d/%dms max %d/%dms over %u/%u turns (primary/canary), %u frames dropped\n",
+            p->connect_ms, c->connect_ms, p->first_audio_ms, c->first_audio_ms,
+            latency_response_avg_ms(p), latency_response_avg_ms(c), p->response_max_ms, c->response_max_ms,
+            p->turns, c->turns, ctx->shadow->sub->dropped);
 
-/* Forward declarations */
-static switch_status_t nova_session_init(nova_session_t *nova_ctx);
-static void nova_session_cleanup(nova_session_t *nova_ctx);
-static void *SWITCH_THREAD_FUNC nova_send_thread(switch_thread_t *thread, void *obj);
-static void *SWITCH_THREAD_FUNC nova_recv_thread(switch_thread_t *thread, void *obj);
-static switch_bool_t nova_bug_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type);
+        switch_channel_set_variable_printf(channel, "nova_shadow_connect_ms", "%d", c->connect_ms);
+        switch_channel_set_variable_printf(channel, "nova_shadow_first_audio_ms", "%d", c->first_audio_ms);
+        switch_channel_set_variable_printf(channel, "nova_shadow_response_avg_ms", "%d", latency_response_avg_ms(c));
+        switch_channel_set_variable_printf(channel, "nova_shadow_response_max_ms", "%d", c->response_max_ms);
+        switch_channel_set_variable_printf(channel, "nova_shadow_dropped", "%u", ctx->shadow->sub->dropped);
+    }
 
-/*
- * Create and initialize audio stream
- */
-static audio_stream_t *audio_stream_create(switch_memory_pool_t *pool) {
-    audio_stream_t *stream = switch_core_alloc(pool, sizeof(audio_stream_t));
+    if (ctx->fork) {
+        switch_channel_set_variable_printf(channel, "nova_fork_dropped", "%u", fork_destroy(ctx->fork));
+    }
 
-    switch_buffer_create_dynamic(&stream->audio_buffer, 1024, 65536, 0);
-    switch_mutex_init(&stream->mutex, SWITCH_MUTEX_NESTED, pool);
-    switch_thread_cond_create(&stream->cond, pool);
-    stream->finished = 0;
+    if (ctx->read_resampler) {
+        switch_resample_destroy(&ctx->read_resampler);
+    }
+    if (ctx->write_resampler) {
+        switch_resample_destroy(&ctx->write_resampler);
+    }
 
-    return stream;
-}
+    if (ctx->bot_turn_start) {
+        nova_span(ctx, "bot.turn", ctx->bot_turn_start, ctx->bot_turn_last + NOVA_FRAME_MS * 1000, NULL, NULL);
+    }
+    nova_span(ctx, "teardown", teardown_at, switch_time_now(), NULL, NULL);
+    nova_span(ctx, "nova.session", ctx->start_time, switch_time_now(), "mode", nova_mode_names[ctx->mode]);
 
-/*
- * Destroy audio stream
- */
-static void audio_stream_destroy(audio_stream_t *stream) {
-    if (stream) {
-        stream->finished = 1;
-        switch_thread_cond_broadcast(stream->cond);
-        if (stream->audio_buffer) {
-            switch_buffer_destroy(&stream->audio_buffer);
-        }
+    switch_core_destroy_memory_pool(&pool);
+    if (nova_arena_owns(ctx)) {
+        nova_arena_free(ctx);
     }
 }
 
 /*
- * Media bug callback - captures audio from the channel
+ * Frame engine: direct read/write frame loop on the session thread
  */
-static switch_bool_t nova_bug_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type) {
-    nova_session_t *nova_ctx = (nova_session_t *)user_data;
+static void nova_engine_frame(switch_core_session_t *session, const char *arg) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    nova_session_t *ctx = NULL;
+    switch_frame_t *read_frame;
 
-    switch (type) {
-        case SWITCH_ABC_TYPE_INIT:
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Nova media bug initialized\n");
-            break;
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+        "nova_ai_session started (frame engine)\n");
 
-        case SWITCH_ABC_TYPE_READ_REPLACE:
-        case SWITCH_ABC_TYPE_READ_PING: {
-            /* Get audio frame from the channel (caller speaking) */
-            switch_frame_t *frame = switch_core_media_bug_get_read_replace_frame(bug);
+    /* Leave the call unanswered so the dialplan can fall back */
+    if (!nova_admit(session)) {
+        return;
+    }
 
-            if (frame && frame->datalen > 0) {
-                /* Write audio to input stream (going to Nova) */
-                switch_mutex_lock(nova_ctx->input_stream->mutex);
-                switch_buffer_write(nova_ctx->input_stream->audio_buffer, frame->data, frame->datalen);
-                switch_thread_cond_signal(nova_ctx->input_stream->cond);
-                switch_mutex_unlock(nova_ctx->input_stream->mutex);
-            }
-            break;
+    /* Answer the call if not already answered */
+    if (!switch_channel_test_flag(channel, CF_ANSWERED)) {
+        if (switch_channel_answer(channel) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                "Failed to answer channel\n");
+            return;
         }
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+            "Channel answered\n");
+    } else {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+            "Channel already answered\n");
+    }
+
+    if (!(ctx = nova_session_create(session, NOVA_MODE_BLOCKING))) {
+        return;
+    }
+
+    /* Get the write codec for the session (needed for write_frame) */
+    const switch_codec_t *write_codec = switch_core_session_get_write_codec(session);
+    if (write_codec) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+            "Write codec: %s @ %dHz, packet=%dms\n",
+            write_codec->implementation->iananame,
+            write_codec->implementation->actual_samples_per_second,
+            (int)(write_codec->implementation->microseconds_per_packet / 1000));
+    } else {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+            "Write codec is NULL; continuing but writes may fail\n");
+    }
+
+    /* Bot audio is encoded by the I/O worker in the channel's codec and played on its wheel */
+    ctx->egress->format = egress_format_for(write_codec);
+    ctx->write_codec = write_codec;
+
+    if (nova_session_start(ctx) != SWITCH_STATUS_SUCCESS) {
+        nova_session_close(ctx);
+        return;
+    }
+
+    nova_registry_add(ctx);
 
-        case SWITCH_ABC_TYPE_WRITE_REPLACE: {
-            /* Replace outgoing audio with Nova's audio */
-            switch_frame_t *frame = switch_core_media_bug_get_write_replace_frame(bug);
+    /* Main audio loop - direct frame read/write */
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+        "Entering main audio loop\n");
+
+    while (switch_channel_ready(channel) && ctx->running) {
+        /* 1. Read caller audio from FreeSWITCH */
+        switch_status_t st = switch_core_session_read_frame(session, &read_frame, SWITCH_IO_FLAG_NONE, 0);
 
-            if (frame && nova_ctx->output_stream) {
-                switch_mutex_lock(nova_ctx->output_stream->mutex);
+        if (st == SWITCH_STATUS_SUCCESS && read_frame && read_frame->datalen > 0) {
+            /* Only process real audio frames (≥160 bytes), not comfort noise (2 bytes) */
+            if (read_frame->datalen >= 160) {
+                /* Mark media as ready on first valid frame */
+                if (!ctx->media_ready) {
+                    ctx->media_ready = 1;
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+                        "Media ready - received first real inbound frame (%d bytes)\n", read_frame->datalen);
+                }
 
-                /* Read Nova audio if available */
-                uint32_t bytes_read = switch_buffer_read(
-                    nova_ctx->output_stream->audio_buffer,
-                    frame->data,
-                    frame->datalen
-                );
+                /* Decode PCMU (160 bytes) to PCM16 (320 bytes) for Nova */
+                int16_t pcm16_buf[NOVA_FRAME_SAMPLES];
+                const int16_t *pcm16 = NULL;
 
-                if (bytes_read > 0) {
-                    frame->datalen = bytes_read;
+                if (read_frame->datalen == 160) {
+                    /* PCMU 8-bit → PCM16 16-bit */
+                    ulaw_to_pcm16((const uint8_t*)read_frame->data, NOVA_FRAME_SAMPLES, pcm16_buf);
+                    pcm16 = pcm16_buf;
+                } else if (read_frame->datalen == NOVA_FRAME_BYTES) {
+                    /* Already PCM16, send as-is */
+                    pcm16 = (const int16_t *)read_frame->data;
                 } else {
-                    /* No audio from Nova yet, send silence */
-                    memset(frame->data, 0, frame->datalen);
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                        "Unexpected frame size: %d bytes (expected 160 or 320)\n", read_frame->datalen);
                 }
 
-                switch_mutex_unlock(nova_ctx->output_stream->mutex);
-                switch_core_media_bug_set_write_replace_frame(bug, frame);
+                if (pcm16 && nova_ingress_frame(ctx, pcm16) != SWITCH_STATUS_SUCCESS) {
+                    break;
+                }
             }
-            break;
+        } else if (st != SWITCH_STATUS_SUCCESS && st != SWITCH_STATUS_BREAK) {
+            /* Log non-success status but continue */
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                "read_frame returned status: %d\n", st);
         }
 
-        case SWITCH_ABC_TYPE_CLOSE:
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Nova media bug closed\n");
-            nova_ctx->running = 0;
-            break;
+        /* Bot audio is written by the I/O worker's egress tick; read_frame paces this loop */
+        if (st != SWITCH_STATUS_SUCCESS) {
+            switch_yield(1000);
+        }
+    }
 
-        default:
-            break;
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+        "Exiting main audio loop\n");
+
+    /* Cleanup */
+    nova_registry_remove(ctx);
+    nova_session_close(ctx);
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+        "nova_ai_session ended\n");
+}
+
+/*
+ * Background mode: caller audio from the media bug
+ * Frames arrive at the read codec rate and ptime (interleaved caller/agent
+ * in assist mode); they are resampled to 8kHz and regrouped into the 20ms
+ * frames the gateway expects. The frame itself is passed through untouched.
+ */
+static switch_status_t nova_bg_read(nova_session_t *ctx, int16_t *data, uint32_t samples) {
+    uint32_t channels = (uint32_t)ctx->channels;
+
+    if (ctx->read_resampler) {
+        switch_resample_process(ctx->read_resampler, data, samples);
+        data = ctx->read_resampler->to;
+        samples = ctx->read_resampler->to_len;
     }
 
-    return SWITCH_TRUE;
+    while (samples > 0) {
+        uint32_t n = NOVA_FRAME_SAMPLES - ctx->in_len;
+
+        if (n > samples) {
+            n = samples;
+        }
+        memcpy(ctx->in_frame + ctx->in_len * channels, data, n * channels * sizeof(int16_t));
+        ctx->in_len += n;
+        data += n * channels;
+        samples -= n;
+
+        if (ctx->in_len == NOVA_FRAME_SAMPLES) {
+            switch_status_t status = channels == 2 ? nova_assist_frame(ctx, ctx->in_frame) :
+                                                     nova_ingress_frame(ctx, ctx->in_frame);
+            ctx->in_len = 0;
+            if (status != SWITCH_STATUS_SUCCESS) {
+                return SWITCH_STATUS_FALSE;
+            }
+        }
+    }
+
+    return SWITCH_STATUS_SUCCESS;
 }
 
 /*
- * Thread to send audio to Java gateway via TCP
+ * Pull up to samples 8kHz bot samples, a 20ms gateway frame at a time
  */
-static void *SWITCH_THREAD_FUNC nova_send_thread(switch_thread_t *thread, void *obj) {
-    nova_session_t *nova_ctx = (nova_session_t *)obj;
-    uint8_t audio_buffer[320]; /* 20ms at 8kHz, 16-bit = 160 samples * 2 = 320 bytes */
+static uint32_t nova_bg_pull_bot(nova_session_t *ctx, int16_t *out, uint32_t samples) {
+    uint32_t got = 0;
 
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
-        "Audio send thread started - streaming to %s:%d\n",
-        nova_ctx->gateway_host, nova_ctx->gateway_port);
-
-    while (nova_ctx->running && nova_ctx->gateway_socket > 0) {
-        switch_mutex_lock(nova_ctx->input_stream->mutex);
-
-        /* Wait for audio data or timeout */
-        if (switch_buffer_inuse(nova_ctx->input_stream->audio_buffer) == 0) {
-            switch_thread_cond_timedwait(nova_ctx->input_stream->cond,
-                                        nova_ctx->input_stream->mutex,
-                                        100000); /* 100ms timeout */
-        }
-
-        /* Read audio from buffer */
-        uint32_t bytes_read = switch_buffer_read(
-            nova_ctx->input_stream->audio_buffer,
-            audio_buffer,
-            sizeof(audio_buffer)
-        );
-
-        switch_mutex_unlock(nova_ctx->input_stream->mutex);
-
-        if (bytes_read > 0) {
-            /* Send raw PCM audio to Java gateway via TCP */
-            ssize_t sent = send(nova_ctx->gateway_socket, audio_buffer, bytes_read, 0);
-            if (sent < 0) {
-                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
-                    "Failed to send audio to gateway: %s\n", strerror(errno));
-                nova_ctx->running = 0;
+    while (got < samples) {
+        egress_slot_t *slot;
+        uint32_t n;
+
+        if (ctx->out_pos == ctx->out_len) {
+            if (!(slot = egress_ring_peek(ctx->egress))) {
                 break;
             }
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG,
-                "Sent %d bytes of PCM audio to gateway\n", bytes_read);
+            memcpy(ctx->out_frame, slot->data, NOVA_FRAME_BYTES);
+            egress_ring_release(ctx->egress);
+            ctx->frames_played++;
+            ctx->out_pos = 0;
+            ctx->out_len = NOVA_FRAME_SAMPLES;
+        }
+
+        n = ctx->out_len - ctx->out_pos;
+        if (n > samples - got) {
+            n = samples - got;
         }
+        memcpy(out + got, ctx->out_frame + ctx->out_pos, n * sizeof(int16_t));
+        ctx->out_pos += n;
+        got += n;
     }
 
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Audio send thread ended\n");
-    return NULL;
+    quality_tick(ctx, got == samples);
+    return got;
 }
 
 /*
- * Thread to receive audio from Java gateway via TCP
+ * Background mode: bot audio into the write-replace frame
  */
-static void *SWITCH_THREAD_FUNC nova_recv_thread(switch_thread_t *thread, void *obj) {
-    nova_session_t *nova_ctx = (nova_session_t *)obj;
-    uint8_t audio_buffer[320]; /* 20ms at 8kHz, 16-bit */
+static void nova_bg_write(nova_session_t *ctx, switch_frame_t *frame) {
+    int16_t bot[SWITCH_RECOMMENDED_BUFFER_SIZE / 2];
+    int16_t *data = (int16_t *)frame->data;
+    const int16_t *src = bot;
+    uint32_t samples = frame->samples;
+    uint32_t need = ctx->write_resampler ? samples * 8000 / ctx->write_rate : samples;
+    uint32_t got, n;
 
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
-        "Audio receive thread started - receiving from %s:%d\n",
-        nova_ctx->gateway_host, nova_ctx->gateway_port);
-
-    while (nova_ctx->running && nova_ctx->gateway_socket > 0) {
-        /* Receive raw PCM audio from Java gateway */
-        ssize_t received = recv(nova_ctx->gateway_socket, audio_buffer, sizeof(audio_buffer), 0);
-
-        if (received < 0) {
-            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
-                    "Failed to receive audio from gateway: %s\n", strerror(errno));
-                nova_ctx->running = 0;
-                break;
+    if (need > SWITCH_RECOMMENDED_BUFFER_SIZE / 2) {
+        need = SWITCH_RECOMMENDED_BUFFER_SIZE / 2;
+    }
+
+    got = nova_bg_pull_bot(ctx, bot, need);
+    if (ctx->mode == NOVA_MODE_LISTEN || (got == 0 && ctx->mode == NOVA_MODE_MIX)) {
+        return;
+    }
+
+    memset(bot + got, 0, (need - got) * sizeof(int16_t));
+    n = need;
+    if (ctx->write_resampler) {
+        switch_resample_process(ctx->write_resampler, bot, need);
+        src = ctx->write_resampler->to;
+        n = ctx->write_resampler->to_len;
+    }
+    if (n > samples) {
+        n = samples;
+    }
+
+    if (ctx->mode == NOVA_MODE_MIX) {
+        for (uint32_t i = 0; i < n; i++) {
+            int32_t mixed = (int32_t)data[i] + src[i];
+            data[i] = (int16_t)(mixed > 32767 ? 32767 : mixed < -32768 ? -32768 : mixed);
+        }
+    } else {
+        memcpy(data, src, n * sizeof(int16_t));
+        memset(data + n, 0, (samples - n) * sizeof(int16_t));
+    }
+}
+
+static switch_bool_t nova_bug_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type) {
+    nova_session_t *ctx = (nova_session_t *)user_data;
+    switch_frame_t *frame;
+
+    switch (type) {
+    case SWITCH_ABC_TYPE_INIT:
+        break;
+
+    case SWITCH_ABC_TYPE_CLOSE:
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(ctx->session), SWITCH_LOG_INFO,
+            "nova_ai_session_bg ended (%u frames sent, %u played)\n", ctx->frames_sent, ctx->frames_played);
+        switch_channel_set_private(ctx->channel, "nova_sonic_bg", NULL);
+        nova_registry_remove(ctx);
+        nova_session_close(ctx);
+        break;
+
+    case SWITCH_ABC_TYPE_READ_REPLACE:
+        if (!ctx->running) {
+            return SWITCH_FALSE;
+        }
+        if ((frame = switch_core_media_bug_get_read_replace_frame(bug)) &&
+            nova_bg_read(ctx, (int16_t *)frame->data, frame->samples) != SWITCH_STATUS_SUCCESS) {
+            return SWITCH_FALSE;
+        }
+        break;
+
+    case SWITCH_ABC_TYPE_READ: {
+        /* Assist mode: both directions mixed by the bug into time-aligned stereo */
+        uint8_t data[SWITCH_RECOMMENDED_BUFFER_SIZE];
+        int16_t discard[NOVA_FRAME_SAMPLES];
+        switch_frame_t stereo = { 0 };
+
+        if (!ctx->running) {
+            return SWITCH_FALSE;
+        }
+
+        stereo.data = data;
+        stereo.buflen = sizeof(data);
+        while (switch_core_media_bug_read(bug, &stereo, SWITCH_TRUE) == SWITCH_STATUS_SUCCESS && stereo.datalen) {
+            if (nova_bg_read(ctx, (int16_t *)stereo.data, stereo.datalen / (2 * sizeof(int16_t))) != SWITCH_STATUS_SUCCESS) {
+                return SWITCH_FALSE;
             }
-            switch_yield(10000); /* No data, sleep 10ms */
-            continue;
-        } else if (received == 0) {
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
-                "Gateway closed connection\n");
-            nova_ctx->running = 0;
-            break;
         }
 
-        /* Write PCM audio to output buffer (will be played back via media bug) */
-        switch_mutex_lock(nova_ctx->output_stream->mutex);
-        switch_buffer_write(nova_ctx->output_stream->audio_buffer, audio_buffer, received);
-        switch_mutex_unlock(nova_ctx->output_stream->mutex);
+        /* Nobody hears the bot here; keep its queue drained */
+        while (nova_bg_pull_bot(ctx, discard, NOVA_FRAME_SAMPLES) == NOVA_FRAME_SAMPLES);
+        break;
+    }
+
+    case SWITCH_ABC_TYPE_WRITE_REPLACE:
+        if ((frame = switch_core_media_bug_get_write_replace_frame(bug))) {
+            nova_bg_write(ctx, frame);
+            switch_core_media_bug_set_write_replace_frame(bug, frame);
+        }
+        break;
 
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG,
-            "Received %zd bytes of PCM audio from gateway\n", received);
+    default:
+        break;
     }
 
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Audio receive thread ended\n");
-    return NULL;
+    return SWITCH_TRUE;
 }
 
 /*
- * Initialize Nova session and connect to Java gateway
+ * Background application: nova_ai_session_bg [replace|mix|listen|assist]
+ * Runs the session from a media bug and returns to the dialplan at once;
+ * the session is controlled through the nova_sonic API and ends with the
+ * call, on "nova_sonic <uuid> stop", or when the gateway hangs up.
+ * assist streams both parties of a bridged call: run it on the customer
+ * leg, the left channel is the customer and the right one the agent.
  */
-static switch_status_t nova_session_init(nova_session_t *nova_ctx) {
-    switch_threadattr_t *thd_attr = NULL;
-    struct sockaddr_in gateway_addr;
+static void nova_engine_background(switch_core_session_t *session, const char *data) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    switch_codec_implementation_t read_impl = { 0 };
+    switch_codec_implementation_t write_impl = { 0 };
+    nova_mode_t mode = NOVA_MODE_REPLACE;
+    nova_session_t *ctx;
+    int quality = nova_shed(NOVA_SHED_RESAMPLER) ? 0 : SWITCH_RESAMPLE_QUALITY;
 
-    /* Create audio streams */
-    nova_ctx->input_stream = audio_stream_create(nova_ctx->pool);
-    nova_ctx->output_stream = audio_stream_create(nova_ctx->pool);
+    if (!zstr(data)) {
+        if (!strcasecmp(data, "mix")) {
+            mode = NOVA_MODE_MIX;
+        } else if (!strcasecmp(data, "listen")) {
+            mode = NOVA_MODE_LISTEN;
+        } else if (!strcasecmp(data, "assist")) {
+            mode = NOVA_MODE_ASSIST;
+        } else if (strcasecmp(data, "replace")) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                "nova_ai_session_bg: unknown mode '%s' (replace|mix|listen|assist)\n", data);
+            return;
+        }
+    }
 
-    /* Create TCP socket to Java gateway */
-    nova_ctx->gateway_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (nova_ctx->gateway_socket < 0) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
-            "Failed to create socket: %s\n", strerror(errno));
-        return SWITCH_STATUS_FALSE;
+    if (switch_channel_get_private(channel, "nova_sonic_bg")) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+            "nova_ai_session_bg already running on this channel\n");
+        return;
     }
 
-    /* Configure gateway address */
-    memset(&gateway_addr, 0, sizeof(gateway_addr));
-    gateway_addr.sin_family = AF_INET;
-    gateway_addr.sin_port = htons(nova_ctx->gateway_port);
+    if (!nova_admit(session)) {
+        return;
+    }
 
-    if (inet_pton(AF_INET, nova_ctx->gateway_host, &gateway_addr.sin_addr) <= 0) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
-            "Invalid gateway host address: %s\n", nova_ctx->gateway_host);
-        close(nova_ctx->gateway_socket);
-        return SWITCH_STATUS_FALSE;
+    if (!switch_channel_media_ready(channel) && switch_channel_pre_answer(channel) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+            "nova_ai_session_bg: channel has no media\n");
+        return;
     }
 
-    /* Connect to Java gateway */
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
-        "Connecting to Java gateway at %s:%d...\n",
-        nova_ctx->gateway_host, nova_ctx->gateway_port);
+    switch_core_session_get_read_impl(session, &read_impl);
+    switch_core_session_get_write_impl(session, &write_impl);
 
-    if (connect(nova_ctx->gateway_socket, (struct sockaddr *)&gateway_addr, sizeof(gateway_addr)) < 0) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR,
-            "Failed to connect to gateway at %s:%d: %s\n",
-            nova_ctx->gateway_host, nova_ctx->gateway_port, strerror(errno));
-        close(nova_ctx->gateway_socket);
-        return SWITCH_STATUS_FALSE;
+    if (!(ctx = nova_session_create(session, mode))) {
+        return;
     }
 
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
-        "Successfully connected to Java gateway at %s:%d\n",
-        nova_ctx->gateway_host, nova_ctx->gateway_port);
+    /* Media bug frames are L16 at the codec rate; the gateway speaks 8kHz */
+    if (read_impl.actual_samples_per_second != 8000 &&
+        switch_resample_create(&ctx->read_resampler, read_impl.actual_samples_per_second, 8000,
+                               SWITCH_RECOMMENDED_BUFFER_SIZE, quality, ctx->channels) != SWITCH_STATUS_SUCCESS) {
+        nova_session_close(ctx);
+        return;
+    }
+    ctx->write_rate = write_impl.actual_samples_per_second;
+    if (ctx->write_rate != 8000 &&
+        switch_resample_create(&ctx->write_resampler, 8000, ctx->write_rate,
+                               SWITCH_RECOMMENDED_BUFFER_SIZE, quality, 1) != SWITCH_STATUS_SUCCESS) {
+        nova_session_close(ctx);
+        return;
+    }
 
-    /* Send initial metadata to gateway (caller ID, session ID) */
-    char handshake[256];
-    snprintf(handshake, sizeof(handshake), "NOVA_SESSION:%s:CALLER:%s\n",
-             nova_ctx->session_id, nova_ctx->caller_id);
-    send(nova_ctx->gateway_socket, handshake, strlen(handshake), 0);
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+        "nova_ai_session_bg (%s): read %s@%uHz/%dms, write %s@%uHz/%dms\n",
+        nova_mode_names[mode],
+        read_impl.iananame, read_impl.actual_samples_per_second, read_impl.microseconds_per_packet / 1000,
+        write_impl.iananame, write_impl.actual_samples_per_second, write_impl.microseconds_per_packet / 1000);
 
-    nova_ctx->running = 1;
+    if (nova_session_start(ctx) != SWITCH_STATUS_SUCCESS) {
+        nova_session_close(ctx);
+        return;
+    }
 
-    /* Start send thread */
-    switch_threadattr_create(&thd_attr, nova_ctx->pool);
-    switch_threadattr_detach_set(thd_attr, 1);
-    switch_thread_create(&nova_ctx->send_thread, thd_attr, nova_send_thread, nova_ctx, nova_ctx->pool);
+    nova_registry_add(ctx);
 
-    /* Start receive thread */
-    switch_thread_create(&nova_ctx->recv_thread, thd_attr, nova_recv_thread, nova_ctx, nova_ctx->pool);
+    if (switch_core_media_bug_add(session, "nova_sonic", NULL, nova_bug_callback, ctx, 0,
+                                  mode == NOVA_MODE_ASSIST ? SMBF_READ_STREAM | SMBF_WRITE_STREAM | SMBF_STEREO :
+                                                             SMBF_READ_REPLACE | SMBF_WRITE_REPLACE,
+                                  &ctx->bug) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+            "nova_ai_session_bg: failed to add media bug\n");
+        nova_registry_remove(ctx);
+        nova_session_close(ctx);
+        return;
+    }
 
-    return SWITCH_STATUS_SUCCESS;
+    switch_channel_set_private(channel, "nova_sonic_bg", ctx);
 }
 
 /*
- * Cleanup Nova session
+ * Bug engine: the background session, with the application waiting on it
+ * Frames are read here so the bug keeps running on an otherwise idle
+ * channel; the application returns when the session stops or the call ends.
  */
-static void nova_session_cleanup(nova_session_t *nova_ctx) {
-    if (nova_ctx) {
-        nova_ctx->running = 0;
+static void nova_engine_bug(switch_core_session_t *session, const char *mode) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
 
-        /* Close socket to trigger thread exit */
-        if (nova_ctx->gateway_socket > 0) {
-            close(nova_ctx->gateway_socket);
-            nova_ctx->gateway_socket = -1;
-        }
+    nova_engine_background(session, mode);
 
-        /* Wait for threads to finish */
-        if (nova_ctx->send_thread) {
-            switch_thread_join(NULL, nova_ctx->send_thread);
-        }
-        if (nova_ctx->recv_thread) {
-            switch_thread_join(NULL, nova_ctx->recv_thread);
-        }
+    while (switch_channel_ready(channel) && switch_channel_get_private(channel, "nova_sonic_bg")) {
+        switch_ivr_sleep(session, 100, SWITCH_TRUE, NULL);
+    }
+}
 
-        /* Cleanup streams */
-        if (nova_ctx->input_stream) {
-            audio_stream_destroy(nova_ctx->input_stream);
-        }
-        if (nova_ctx->output_stream) {
-            audio_stream_destroy(nova_ctx->output_stream);
+/*
+ * Media engines
+ * How a session's audio meets the channel. Each takes the part of the
+ * application argument after ':' (the bug modes for bug and background).
+ */
+typedef struct {
+    const char *name;
+    void (*run)(switch_core_session_t *session, const char *arg);
+} nova_engine_t;
+
+static const nova_engine_t nova_engines[] = {
+    { "frame", nova_engine_frame },
+    { "bug", nova_engine_bug },
+    { "background", nova_engine_background },
+};
+
+static const nova_engine_t *nova_engine_find(const char *name, size_t len) {
+    for (size_t i = 0; i < sizeof(nova_engines) / sizeof(nova_engines[0]); i++) {
+        if (strlen(nova_engines[i].name) == len && !strncasecmp(nova_engines[i].name, name, len)) {
+            return &nova_engines[i];
         }
     }
+    return NULL;
 }
 
 /*
- * Application function: nova_sonic
- * Usage: <action application="nova_sonic" data="system_prompt='You are a helpful assistant'"/>
+ * Main application: nova_ai_session [engine[:mode]]
  */
-SWITCH_STANDARD_APP(nova_sonic_function) {
+SWITCH_STANDARD_APP(nova_ai_session_function) {
     switch_channel_t *channel = switch_core_session_get_channel(session);
-    switch_media_bug_t *bug = NULL;
-    switch_media_bug_flag_t flags = SMBF_READ_REPLACE | SMBF_WRITE_REPLACE | SMBF_NO_PAUSE;
-    nova_session_t *nova_ctx = NULL;
-    switch_memory_pool_t *pool = NULL;
-    switch_codec_implementation_t read_impl = { 0 };
-
-    /* Get codec information */
-    switch_core_session_get_read_impl(session, &read_impl);
+    const char *spec = data, *arg;
+    const nova_engine_t *engine;
+    size_t len;
 
-    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
-        "Starting Nova Sonic session - codec: %s, rate: %d, channels: %d\n",
-        read_impl.iananame, read_impl.actual_samples_per_second, read_impl.number_of_channels);
+    /* Arguments of the earlier builds (gateway_host=...) are not engines */
+    if (zstr(spec) || strchr(spec, '=')) {
+        if (!zstr(spec)) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                "Ignoring '%s' - the gateway is set in nova_sonic.conf\n", spec);
+        }
+        spec = switch_channel_get_variable(channel, "nova_engine");
+    }
+    if (zstr(spec)) {
+        spec = globals.default_engine;
+    }
 
-    /* Create memory pool */
-    if (switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+    arg = strchr(spec, ':');
+    len = arg ? (size_t)(arg++ - spec) : strlen(spec);
+    if (!(engine = nova_engine_find(spec, len))) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-            "Failed to allocate memory pool\n");
+            "Unknown media engine '%s' (frame|bug[:mode]|background[:mode])\n", spec);
         return;
     }
 
-    /* Allocate context */
-    nova_ctx = switch_core_alloc(pool, sizeof(nova_session_t));
-    nova_ctx->session = session;
-    nova_ctx->channel = channel;
-    nova_ctx->pool = pool;
+    switch_channel_set_variable(channel, "nova_engine_used", engine->name);
+    engine->run(session, arg);
+}
 
-    /* Generate session ID */
-    char uuid_str[SWITCH_UUID_FORMATTED_LENGTH + 1];
-    switch_uuid_t uuid;
-    switch_uuid_get(&uuid);
-    switch_uuid_format(uuid_str, &uuid);
-    nova_ctx->session_id = switch_core_strdup(pool, uuid_str);
+/*
+ * nova_ai_session_bg [replace|mix|listen|assist]
+ */
+SWITCH_STANDARD_APP(nova_ai_session_bg_function) {
+    switch_channel_set_variable(switch_core_session_get_channel(session), "nova_engine_used", "background");
+    nova_engine_background(session, data);
+}
 
-    /* Get caller ID */
-    const char *caller_id_number = switch_channel_get_variable(channel, "caller_id_number");
-    nova_ctx->caller_id = switch_core_strdup(pool, caller_id_number ? caller_id_number : "Unknown");
+/*
+ * One status line per session; caller holds the registry mutex
+ */
+static void nova_session_status(nova_session_t *ctx, switch_stream_handle_t *stream) {
+    const char *state;
+    uint32_t queued;
+    nova_quality_score_t score;
 
-    /* Set gateway connection details (use global defaults) */
-    nova_ctx->gateway_host = switch_core_strdup(pool, globals.gateway_host);
-    nova_ctx->gateway_port = globals.gateway_port;
+    if (!ctx->running) {
+        state = "stopping";
+    } else if (ctx->gateway_socket < 0) {
+        state = "waiting";
+    } else if (ctx->api_paused) {
+        state = "paused";
+    } else if (ctx->paused) {
+        state = "hold";
+    } else {
+        state = "streaming";
+    }
 
-    /* Initialize Nova session */
-    if (nova_session_init(nova_ctx) != SWITCH_STATUS_SUCCESS) {
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-            "Failed to initialize Nova session\n");
-        switch_core_destroy_memory_pool(&pool);
+    queued = egress_ring_count(ctx->egress) * NOVA_FRAME_MS;
+
+    quality_score(ctx, &score);
+
+    stream->write_function(stream, "%s mode=%s state=%s gateway=%s:%d uptime=%ds sent=%u played=%u queued=%ums mos=%.2f r=%.1f",
+        ctx->session_id, nova_mode_names[ctx->mode], state, ctx->gateway_host, ctx->gateway_port,
+        (int)((switch_time_now() - ctx->start_time) / 1000000), ctx->frames_sent, ctx->frames_played,
+        queued, score.mos, score.r);
+    stream->write_function(stream, " tx-frames/write=%.2f",
+        ctx->tx.total_writes ? (double)ctx->tx.total_frames / ctx->tx.total_writes : 0.0);
+    if (ctx->rtp.samples) {
+        stream->write_function(stream, " rtp-jitter=%.1fms rtp-loss=%.2f%% rtp-flaws=%u",
+            ctx->rtp.jitter_ms, ctx->rtp.loss_pct, ctx->rtp.flaws);
+    }
+    stream->write_function(stream, " blame=%s%s%s\n", nova_blame(ctx, &score),
+        ctx->conference ? " conference=" : "", ctx->conference ? ctx->conference : "");
+}
+
+#define NOVA_API_SYNTAX "status | conference <room>[@profile] start|stop | <uuid> status|stop|pause|resume"
+
+/*
+ * Conference participant
+ * A loopback channel joins the room as an ordinary member and runs
+ * nova_ai_session on its other end. mod_conference already gives every
+ * member the room mix minus its own audio, so the session hears all
+ * participants but not itself, and its bot audio is mixed to everyone.
+ * One gateway session (and one decode/encode) serves the whole room.
+ * Must be called with sessions_mutex held.
+ */
+static nova_session_t *nova_conference_find(const char *room) {
+    switch_hash_index_t *hi;
+
+    for (hi = switch_core_hash_first(globals.sessions); hi; hi = switch_core_hash_next(&hi)) {
+        nova_session_t *ctx;
+        void *val;
+
+        switch_core_hash_this(hi, NULL, NULL, &val);
+        ctx = (nova_session_t *)val;
+        if (ctx->conference && !strcasecmp(ctx->conference, room)) {
+            switch_safe_free(hi);
+            return ctx;
+        }
+    }
+
+    return NULL;
+}
+
+static void nova_conference_command(char *room, const char *action, switch_stream_handle_t *stream) {
+    char *profile = strchr(room, '@');
+    nova_session_t *ctx;
+    char *args;
+
+    if (profile) {
+        *profile++ = '\0';
+    }
+    if (zstr(room) || strpbrk(room, "\"\\,{} ")) {
+        stream->write_function(stream, "-ERR bad conference name\n");
         return;
     }
 
-    /* Add media bug to capture audio */
-    if (switch_core_media_bug_add(session, "nova_sonic", NULL,
-                                  nova_bug_callback, nova_ctx, 0, flags, &bug) != SWITCH_STATUS_SUCCESS) {
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
-            "Failed to attach media bug\n");
-        nova_session_cleanup(nova_ctx);
-        switch_core_destroy_memory_pool(&pool);
+    switch_mutex_lock(globals.sessions_mutex);
+    ctx = nova_conference_find(room);
+    if (!strcasecmp(action, "stop")) {
+        if (ctx) {
+            /* nova_ai_session returns, the loopback leg hangs up and leaves the room */
+            ctx->running = 0;
+            stream->write_function(stream, "+OK stopping %s\n", ctx->session_id);
+        } else {
+            stream->write_function(stream, "-ERR no nova session in conference %s\n", room);
+        }
+        switch_mutex_unlock(globals.sessions_mutex);
         return;
     }
+    switch_mutex_unlock(globals.sessions_mutex);
 
-    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
-        "Nova Sonic media bug attached successfully\n");
+    if (strcasecmp(action, "start")) {
+        stream->write_function(stream, "-USAGE: %s\n", NOVA_API_SYNTAX);
+        return;
+    }
+    if (ctx) {
+        stream->write_function(stream, "-ERR conference %s already has nova session %s\n", room, ctx->session_id);
+        return;
+    }
+
+    args = switch_mprintf("{nova_conference=%s,origination_caller_id_name=Nova,origination_caller_id_number=nova}"
+                          "loopback/app=conference:%s@%s &nova_ai_session", room, room, zstr(profile) ? "default" : profile);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Joining Nova to conference %s\n", room);
+    switch_api_execute("originate", args, NULL, stream);
+    switch_safe_free(args);
+}
+
+/*
+ * API: nova_sonic status | conference <room>[@profile] start|stop | <uuid> status|stop|pause|resume
+ */
+SWITCH_STANDARD_API(nova_sonic_api_function) {
+    char *mycmd = NULL;
+    char *argv[3] = { 0 };
+    int argc = 0;
+    nova_session_t *ctx;
 
-    /* Keep the call active while Nova session is running */
-    while (switch_channel_ready(channel) && nova_ctx->running) {
-        switch_yield(100000); /* Sleep 100ms */
+    if (!zstr(cmd) && (mycmd = strdup(cmd))) {
+        argc = switch_separate_string(mycmd, ' ', argv, 3);
     }
 
-    /* Cleanup */
-    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
-        "Cleaning up Nova Sonic session\n");
+    if (argc == 3 && !strcasecmp(argv[0], "conference")) {
+        nova_conference_command(argv[1], argv[2], stream);
+        goto done;
+    }
+
+    if (argc == 1 && !strcasecmp(argv[0], "status")) {
+        switch_hash_index_t *hi;
+        int count = 0;
+
+        switch_mutex_lock(globals.sessions_mutex);
+        for (hi = switch_core_hash_first(globals.sessions); hi; hi = switch_core_hash_next(&hi)) {
+            void *val;
+
+            switch_core_hash_this(hi, NULL, NULL, &val);
+            nova_session_status((nova_session_t *)val, stream);
+            count++;
+        }
+        switch_mutex_unlock(globals.sessions_mutex);
 
-    if (bug) {
-        switch_core_media_bug_remove(session, &bug);
+        nova_gateway_status(stream);
+        nova_io_status(stream);
+        nova_arena_status(stream);
+        nova_tls_status(stream);
+        nova_mediad_status(stream);
+        nova_tx_status(stream);
+        nova_degrade_status(stream);
+        egress_cache_status(stream);
+        nova_hedge_status(stream);
+        otlp_status(stream);
+        stream->write_function(stream, "+OK %d active session%s\n", count, count == 1 ? "" : "s");
+        goto done;
     }
 
-    nova_session_cleanup(nova_ctx);
-    switch_core_destroy_memory_pool(&pool);
+    if (argc != 2) {
+        stream->write_function(stream, "-USAGE: %s\n", NOVA_API_SYNTAX);
+        goto done;
+    }
+
+    switch_mutex_lock(globals.sessions_mutex);
+    if (!(ctx = switch_core_hash_find(globals.sessions, argv[0]))) {
+        stream->write_function(stream, "-ERR no nova session on %s\n", argv[0]);
+    } else if (!strcasecmp(argv[1], "status")) {
+        nova_session_status(ctx, stream);
+    } else if (!strcasecmp(argv[1], "stop")) {
+        /* The media thread (or blocking loop) notices and tears down */
+        ctx->running = 0;
+        stream->write_function(stream, "+OK stopping\n");
+    } else if (!strcasecmp(argv[1], "pause")) {
+        ctx->api_paused = SWITCH_TRUE;
+        stream->write_function(stream, "+OK paused\n");
+    } else if (!strcasecmp(argv[1], "resume")) {
+        ctx->api_paused = SWITCH_FALSE;
+        stream->write_function(stream, "+OK resumed\n");
+    } else {
+        stream->write_function(stream, "-USAGE: %s\n", NOVA_API_SYNTAX);
+    }
+    switch_mutex_unlock(globals.sessions_mutex);
+
+done:
+    switch_safe_free(mycmd);
+    return SWITCH_STATUS_SUCCESS;
 }
 
 /*
  * Load module configuration
+ * Defaults, then nova_sonic.conf settings, then environment overrides.
  */
-static switch_status_t load_config(void) {
+static switch_status_t load_config(switch_memory_pool_t *pool) {
     char *cf = "nova_sonic.conf";
     switch_xml_t cfg, xml, settings, param;
+    char *degrade_ladder = NULL;
+    char *gateways = NULL;
 
     /* Set defaults */
-    globals.gateway_host = "127.0.0.1";  /* Java gateway on localhost */
-    globals.gateway_port = 8085;          /* Port for TCP audio streaming */
-    globals.sample_rate = 8000;
-    globals.channels = 1;
-    globals.bits_per_sample = 16;
+    globals.gateway_host = "10.0.0.68";  /* Java gateway private IP */
+    globals.gateway_port = 8085;
+    globals.lazy_start = SWITCH_FALSE;
+    globals.lazy_preroll_ms = 300;
+    globals.vad_threshold_db = -45;
+    globals.vad_onset_ms = 60;
+    globals.vad_hangover_ms = 400;
+    globals.hold_detect = SWITCH_FALSE;
+    globals.hold_detect_ms = 3000;
+    globals.hold_flatness_max = 0.25f;
+    globals.hold_periodicity_min = 0.85f;
+    globals.fork_targets = NULL;
+    globals.shadow_host = NULL;
+    globals.shadow_port = 8085;
+    globals.shadow_sample_percent = 0;
+    globals.shadow_queue_frames = 50;
+    globals.io_workers = 2;
+    globals.io_cpus = NULL;
+    globals.io_sched = SCHED_OTHER;
+    globals.io_priority = 10;
+    globals.io_slab_sessions = 256;
+    globals.default_engine = "frame";
+    globals.export_poll_ms = 1000;
+    globals.tls = SWITCH_FALSE;
+    globals.tls_ca = "";
+    globals.tls_verify = SWITCH_TRUE;
+    globals.mediad_socket = "";
+    globals.mediad_timeout_ms = 3000;
+    globals.mediad_retries = 2;
+    globals.mediad_fallback = SWITCH_TRUE;
+    globals.arena_sessions = 256;
+    globals.arena_hugepages = SWITCH_TRUE;
+    globals.egress_gain_db = 0;
+    globals.egress_cache_mb = 32;
+    globals.probe_interval_ms = 2000;
+    globals.probe_timeout_ms = 1000;
+    globals.rtt_alpha = 0.2;
+    globals.load_weight_us = 20;
+    globals.rtp_stats_interval_sec = 5;
+    globals.otlp_endpoint = NULL;
+    globals.otlp_service = "freeswitch-nova";
+    globals.otlp_queue_spans = 4096;
+    globals.otlp_batch_spans = 256;
+    globals.otlp_flush_ms = 1000;
+    globals.hedge_host = "";
+    globals.hedge_port = 8085;
+    globals.hedge_after_ms = 1500;
+    globals.hedge_giveup_ms = 15000;
+    globals.dtx = SWITCH_FALSE;
+    globals.dtx_threshold_db = -55;
+    globals.dtx_hangover_ms = 200;
+    globals.dtx_sid_interval_ms = 1000;
+    globals.degrade_steps = 0;
+    globals.degrade_lateness_us = 5000;
+    globals.degrade_cpu_idle_pct = 5;
+    globals.degrade_recover_sec = 30;
+
+    if ((xml = switch_xml_open_cfg(cf, &cfg, NULL))) {
+        if ((settings = switch_xml_child(cfg, "settings"))) {
+            for (param = switch_xml_child(settings, "param"); param; param = param->next) {
+                const char *name = switch_xml_attr_soft(param, "name");
+                const char *value = switch_xml_attr_soft(param, "value");
+
+                if (zstr(value)) {
+                    continue;
+                }
+
+                if (!strcasecmp(name, "gateway-host")) {
+                    globals.gateway_host = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "gateway-port")) {
+                    globals.gateway_port = atoi(value);
+                } else if (!strcasecmp(name, "gateways")) {
+                    gateways = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "gateway-probe-interval-ms")) {
+                    globals.probe_interval_ms = atoi(value);
+                } else if (!strcasecmp(name, "gateway-probe-timeout-ms")) {
+                    globals.probe_timeout_ms = atoi(value);
+                } else if (!strcasecmp(name, "gateway-rtt-alpha")) {
+                    globals.rtt_alpha = atof(value);
+                } else if (!strcasecmp(name, "gateway-load-weight-us")) {
+                    globals.load_weight_us = atoi(value);
+                } else if (!strcasecmp(name, "lazy-start")) {
+                    globals.lazy_start = switch_true(value) ? SWITCH_TRUE : SWITCH_FALSE;
+                } else if (!strcasecmp(name, "lazy-preroll-ms")) {
+                    globals.lazy_preroll_ms = atoi(value);
+                } else if (!strcasecmp(name, "vad-threshold-db")) {
+                    globals.vad_threshold_db = atoi(value);
+                } else if (!strcasecmp(name, "vad-onset-ms")) {
+                    globals.vad_onset_ms = atoi(value);
+                } else if (!strcasecmp(name, "vad-hangover-ms")) {
+                    globals.vad_hangover_ms = atoi(value);
+                } else if (!strcasecmp(name, "hold-detect")) {
+                    globals.hold_detect = switch_true(value) ? SWITCH_TRUE : SWITCH_FALSE;
+                } else if (!strcasecmp(name, "hold-detect-ms")) {
+                    globals.hold_detect_ms = atoi(value);
+                } else if (!strcasecmp(name, "hold-flatness-max")) {
+                    globals.hold_flatness_max = (float)atof(value);
+                } else if (!strcasecmp(name, "hold-periodicity-min")) {
+                    globals.hold_periodicity_min = (float)atof(value);
+                } else if (!strcasecmp(name, "fork-targets")) {
+                    globals.fork_targets = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "shadow-gateway-host")) {
+                    globals.shadow_host = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "shadow-gateway-port")) {
+                    globals.shadow_port = atoi(value);
+                } else if (!strcasecmp(name, "shadow-sample-percent")) {
+                    globals.shadow_sample_percent = atoi(value);
+                } else if (!strcasecmp(name, "shadow-queue-frames")) {
+                    globals.shadow_queue_frames = atoi(value);
+                } else if (!strcasecmp(name, "io-workers")) {
+                    globals.io_workers = atoi(value);
+                } else if (!strcasecmp(name, "io-cpus")) {
+                    globals.io_cpus = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "io-sched")) {
+                    if (!strcasecmp(value, "fifo")) {
+                        globals.io_sched = SCHED_FIFO;
+                    } else if (!strcasecmp(value, "rr")) {
+                        globals.io_sched = SCHED_RR;
+                    } else {
+                        globals.io_sched = SCHED_OTHER;
+                    }
+                } else if (!strcasecmp(name, "io-priority")) {
+                    globals.io_priority = atoi(value);
+                } else if (!strcasecmp(name, "io-slab-sessions")) {
+                    globals.io_slab_sessions = atoi(value);
+                } else if (!strcasecmp(name, "default-engine")) {
+                    globals.default_engine = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "export-vars")) {
+                    char *names[64], *copy = switch_core_strdup(pool, value);
+                    int n = (int)switch_separate_string(copy, ',', names, 64);
+
+                    globals.export_vars = switch_core_alloc(pool, n * sizeof(char *));
+                    globals.export_count = 0;
+                    for (int i = 0; i < n; i++) {
+                        if (!zstr(names[i])) {
+                            globals.export_vars[globals.export_count++] = names[i];
+                        }
+                    }
+                } else if (!strcasecmp(name, "export-poll-ms")) {
+                    globals.export_poll_ms = atoi(value);
+                } else if (!strcasecmp(name, "gateway-tls")) {
+                    globals.tls = switch_true(value) ? SWITCH_TRUE : SWITCH_FALSE;
+                } else if (!strcasecmp(name, "gateway-tls-ca")) {
+                    globals.tls_ca = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "gateway-tls-verify")) {
+                    globals.tls_verify = switch_true(value) ? SWITCH_TRUE : SWITCH_FALSE;
+                } else if (!strcasecmp(name, "mediad-socket")) {
+                    globals.mediad_socket = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "mediad-connect-timeout-ms")) {
+                    globals.mediad_timeout_ms = atoi(value);
+                } else if (!strcasecmp(name, "mediad-retries")) {
+                    globals.mediad_retries = atoi(value);
+                } else if (!strcasecmp(name, "mediad-fallback")) {
+                    globals.mediad_fallback = switch_true(value) ? SWITCH_TRUE : SWITCH_FALSE;
+                } else if (!strcasecmp(name, "arena-sessions")) {
+                    globals.arena_sessions = atoi(value);
+                } else if (!strcasecmp(name, "arena-hugepages")) {
+                    globals.arena_hugepages = switch_true(value) ? SWITCH_TRUE : SWITCH_FALSE;
+                } else if (!strcasecmp(name, "egress-gain-db")) {
+                    globals.egress_gain_db = atof(value);
+                } else if (!strcasecmp(name, "egress-cache-mb")) {
+                    globals.egress_cache_mb = atoi(value);
+                } else if (!strcasecmp(name, "rtp-stats-interval-sec")) {
+                    globals.rtp_stats_interval_sec = atoi(value);
+                } else if (!strcasecmp(name, "otlp-endpoint")) {
+                    globals.otlp_endpoint = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "otlp-service-name")) {
+                    globals.otlp_service = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "otlp-queue-spans")) {
+                    globals.otlp_queue_spans = atoi(value);
+                } else if (!strcasecmp(name, "otlp-batch-spans")) {
+                    globals.otlp_batch_spans = atoi(value);
+                } else if (!strcasecmp(name, "otlp-flush-ms")) {
+                    globals.otlp_flush_ms = atoi(value);
+                } else if (!strcasecmp(name, "hedge-gateway-host")) {
+                    globals.hedge_host = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "hedge-gateway-port")) {
+                    globals.hedge_port = atoi(value);
+                } else if (!strcasecmp(name, "hedge-after-ms")) {
+                    globals.hedge_after_ms = atoi(value);
+                } else if (!strcasecmp(name, "hedge-giveup-ms")) {
+                    globals.hedge_giveup_ms = atoi(value);
+                } else if (!strcasecmp(name, "dtx")) {
+                    globals.dtx = switch_true(value) ? SWITCH_TRUE : SWITCH_FALSE;
+                } else if (!strcasecmp(name, "dtx-threshold-db")) {
+                    globals.dtx_threshold_db = atoi(value);
+                } else if (!strcasecmp(name, "dtx-hangover-ms")) {
+                    globals.dtx_hangover_ms = atoi(value);
+                } else if (!strcasecmp(name, "dtx-sid-interval-ms")) {
+                    globals.dtx_sid_interval_ms = atoi(value);
+                } else if (!strcasecmp(name, "degrade-ladder")) {
+                    degrade_ladder = switch_core_strdup(pool, value);
+                } else if (!strcasecmp(name, "degrade-lateness-ms")) {
+                    globals.degrade_lateness_us = (int)(atof(value) * 1000);
+                } else if (!strcasecmp(name, "degrade-cpu-idle-pct")) {
+                    globals.degrade_cpu_idle_pct = atoi(value);
+                } else if (!strcasecmp(name, "degrade-recover-sec")) {
+                    globals.degrade_recover_sec = atoi(value);
+                }
+            }
+        }
+        switch_xml_free(xml);
+    }
 
     /* Load from environment if available */
     const char *gateway_host = getenv("NOVA_GATEWAY_HOST");
     const char *gateway_port = getenv("NOVA_GATEWAY_PORT");
 
-    if (gateway_host) globals.gateway_host = strdup(gateway_host);
+    if (gateway_host) globals.gateway_host = switch_core_strdup(pool, gateway_host);
     if (gateway_port) globals.gateway_port = atoi(gateway_port);
 
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
-        "Nova Sonic Audio Proxy config: gateway=%s:%d, rate=%d, channels=%d, bits=%d\n",
+        "Nova Sonic config: gateway=%s:%d, lazy-start=%s (pre-roll %dms), vad=%ddBFS onset %dms hangover %dms\n",
         globals.gateway_host, globals.gateway_port,
-        globals.sample_rate, globals.channels, globals.bits_per_sample);
+        globals.lazy_start ? "on" : "off", globals.lazy_preroll_ms,
+        globals.vad_threshold_db, globals.vad_onset_ms, globals.vad_hangover_ms);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+        "Nova Sonic hold detection: %s (after %dms, flatness<=%.2f or periodicity>=%.2f)\n",
+        globals.hold_detect ? "on" : "off", globals.hold_detect_ms,
+        globals.hold_flatness_max, globals.hold_periodicity_min);
+    if (globals.io_workers < 1) {
+        globals.io_workers = 1;
+    }
+    if (globals.io_slab_sessions < 0) {
+        globals.io_slab_sessions = 0;
+    }
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+        "Nova Sonic I/O: %d worker(s), cpus=%s, sched=%s priority %d, %d session slots per worker\n",
+        globals.io_workers, zstr(globals.io_cpus) ? "any" : globals.io_cpus,
+        globals.io_sched == SCHED_FIFO ? "fifo" : globals.io_sched == SCHED_RR ? "rr" : "other",
+        globals.io_priority, globals.io_slab_sessions);
+
+    if (!zstr(gateways)) {
+        char *entries[32];
+        int n = (int)switch_separate_string(gateways, ',', entries, 32);
+
+        globals.gateways = switch_core_alloc(pool, n * sizeof(nova_gateway_t));
+        for (int i = 0; i < n; i++) {
+            nova_gateway_t *gw = &globals.gateways[globals.gateway_count];
+            char *colon = strrchr(entries[i], ':');
+
+            gw->port = globals.gateway_port;
+            if (colon) {
+                *colon = '\0';
+                gw->port = atoi(colon + 1);
+            }
+            if (zstr(entries[i]) || gw->port <= 0) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "gateways: ignoring bad entry\n");
+                continue;
+            }
+            gw->host = entries[i];
+            gw->up = SWITCH_TRUE;
+            globals.gateway_count++;
+        }
+        if (globals.rtt_alpha <= 0 || globals.rtt_alpha > 1) {
+            globals.rtt_alpha = 0.2;
+        }
+        if (globals.probe_interval_ms < 100) {
+            globals.probe_interval_ms = 100;
+        }
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+            "Nova Sonic gateway pool: %d gateway(s), probe every %dms, %dus RTT per active session\n",
+            globals.gateway_count, globals.probe_interval_ms, globals.load_weight_us);
+    }
+    if (!zstr(degrade_ladder)) {
+        char *steps[NOVA_SHED_COUNT * 2];
+        switch_bool_t seen[NOVA_SHED_COUNT] = { SWITCH_FALSE };
+        int n = (int)switch_separate_string(degrade_ladder, ',', steps, NOVA_SHED_COUNT * 2);
+
+        for (int i = 0; i < n; i++) {
+            int stage;
+
+            for (stage = 0; stage < NOVA_SHED_COUNT && strcasecmp(steps[i], nova_shed_names[stage]); stage++);
+            if (stage == NOVA_SHED_COUNT || seen[stage]) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                    "degrade-ladder: ignoring unknown or repeated step '%s'\n", steps[i]);
+                continue;
+            }
+            seen[stage] = SWITCH_TRUE;
+            globals.degrade_ladder[globals.degrade_steps++] = (nova_shed_t)stage;
+        }
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+            "Nova Sonic degradation: %d step(s), above %dus tick lateness or below %d%% idle CPU, recover after %ds\n",
+            globals.degrade_steps, globals.degrade_lateness_us, globals.degrade_cpu_idle_pct, globals.degrade_recover_sec);
+    }
+    if (!zstr(globals.shadow_host)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+            "Nova Sonic shadow gateway: %s:%d, sampling %d%% of calls\n",
+            globals.shadow_host, globals.shadow_port, globals.shadow_sample_percent);
+    }
 
     return SWITCH_STATUS_SUCCESS;
 }
 
 /*
- * Module load function
+ * Module load
  */
 SWITCH_MODULE_LOAD_FUNCTION(mod_nova_sonic_load) {
     switch_application_interface_t *app_interface;
+    switch_api_interface_t *api_interface;
 
-    /* Connect internal structure to global module structure */
     *module_interface = switch_loadable_module_create_module_interface(pool, modname);
 
-    /* Load configuration */
-    if (load_config() != SWITCH_STATUS_SUCCESS) {
+    if (load_config(pool) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    if (switch_event_reserve_subclass(NOVA_EVENT_QUALITY) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't register subclass %s\n", NOVA_EVENT_QUALITY);
+        return SWITCH_STATUS_TERM;
+    }
+
+    g711_tables_init();
+    switch_core_hash_init(&globals.sessions);
+    switch_mutex_init(&globals.sessions_mutex, SWITCH_MUTEX_NESTED, pool);
+    egress_cache_init(pool);
+    nova_arena_start(pool);
+    if (nova_tls_start(pool) != SWITCH_STATUS_SUCCESS) {
+        nova_arena_stop();
         return SWITCH_STATUS_FALSE;
     }
 
-    /* Register application */
-    SWITCH_ADD_APP(app_interface, "nova_sonic", "Amazon Nova Sonic Integration",
-                   "Streams call audio to Amazon Nova Sonic for AI conversation",
-                   nova_sonic_function, "", SAF_SUPPORT_NOMEDIA);
+    if (nova_io_start(pool) != SWITCH_STATUS_SUCCESS) {
+        nova_io_stop();
+        return SWITCH_STATUS_FALSE;
+    }
+    nova_mediad_start(pool);
+    nova_degrade_start(pool);
+    nova_gateway_start(pool);
+    otlp_start(pool);
 
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Nova Sonic module loaded successfully\n");
+    SWITCH_ADD_APP(app_interface, "nova_ai_session", "Nova AI Session",
+                   "Connects call to Nova Sonic AI via Java gateway",
+                   nova_ai_session_function, "[frame|bug[:mode]|background[:mode]]", SAF_NONE);
+    SWITCH_ADD_APP(app_interface, "nova_sonic", "Nova AI Session",
+                   "Connects call to Nova Sonic AI via Java gateway (earlier name of nova_ai_session)",
+                   nova_ai_session_function, "[frame|bug[:mode]|background[:mode]]", SAF_NONE);
+    SWITCH_ADD_APP(app_interface, "nova_ai_session_bg", "Nova AI Session (background)",
+                   "Runs a Nova session from a media bug and returns to the dialplan",
+                   nova_ai_session_bg_function, "[replace|mix|listen|assist]", SAF_NONE);
+    SWITCH_ADD_API(api_interface, "nova_sonic", "Nova Sonic session control",
+                   nova_sonic_api_function, NOVA_API_SYNTAX);
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+        "mod_nova_sonic loaded - nova_ai_session (default engine %s), nova_ai_session_bg and nova_sonic API registered\n",
+        globals.default_engine);
 
     return SWITCH_STATUS_SUCCESS;
 }
 
 /*
- * Module shutdown function
+ * Module shutdown
  */
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_nova_sonic_shutdown) {
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Nova Sonic Audio Proxy shutting down\n");
-
-    /* Cleanup global resources */
-    /* Nothing to cleanup - gateway_host is either static or heap-allocated */
-
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO,
+        "mod_nova_sonic shutting down\n");
+    nova_gateway_stop();
+    nova_degrade_stop();
+    otlp_stop();
+    nova_io_stop();
+    nova_mediad_stop();
+    nova_arena_stop();
+    nova_tls_stop();
+    egress_cache_destroy();
+    switch_event_free_subclass(NOVA_EVENT_QUALITY);
+    if (globals.sessions) {
+        switch_core_hash_destroy(&globals.sessions);
+    }
     return SWITCH_STATUS_SUCCESS;
 }
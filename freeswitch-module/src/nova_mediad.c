@@ -0,0 +1,1149 @@
+/*
+ * nova-mediad - gateway connection sidecar for mod_nova_sonic
+ *
+ * Owns the module's gateway connections so a misbehaving gateway, TLS stack
+ * or transport bug cannot take FreeSWITCH down, and so the transport can be
+ * restarted or upgraded without a FreeSWITCH restart. Connects (with retries
+ * and kTLS) on the module's behalf and pumps bytes between each gateway
+ * socket and the session's shared-memory rings; see nova_mediad.h.
+ *
+ * Usage:
+ *   nova-mediad [-s socket] [--tls-ca file] [--tls-verify] [--takeover]
+ *
+ * --takeover replaces a running instance on the same socket without
+ * dropping calls: start the new binary with it and the old one exits once
+ * everything is handed over. SIGTERM closes every gateway connection (calls
+ * then end as if the gateway had hung up); SIGUSR1 logs counters.
+ *
+ * Build: gcc -O2 -o nova-mediad nova_mediad.c -lssl -lcrypto -lpthread
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "nova_mediad.h"
+
+#define MEDIAD_DEFAULT_SOCKET "/run/nova-mediad.sock"
+#define MEDIAD_MAX_EVENTS 256
+#define MEDIAD_TLS_SESSIONS 16
+
+typedef enum {
+    EV_LISTENER,
+    EV_CLIENT,
+    EV_WAKE,
+    EV_UP,
+    EV_GATEWAY
+} ev_kind_t;
+
+typedef struct {
+    ev_kind_t kind;
+    void *obj;
+} ev_tag_t;
+
+typedef struct client {
+    int fd;
+    uint32_t index;
+    ev_tag_t tag;
+    struct client *next;
+} client_t;
+
+typedef struct session {
+    nova_mediad_msg_t open;         /* request as the module sent it */
+    client_t *client;
+    int gw;                         /* gateway socket, -1 when not connected */
+    int memfd;
+    int up_efd;                     /* module -> us */
+    int down_efd;                   /* us -> module */
+    nova_link_shm_t *shm;
+    int pending;                    /* connect thread still running */
+    int dead;                       /* freed at the end of this loop pass */
+    int connect_error;              /* result of the connect thread */
+    uint32_t attempts;
+    int want_out;                   /* gateway socket full; EPOLLOUT armed */
+    int down_full;                  /* down ring full; gateway reads paused */
+    ev_tag_t up_tag;
+    ev_tag_t gw_tag;
+    struct session *next;
+    struct session *prev;
+    struct session *done_next;      /* connect finished, waiting for the loop */
+} session_t;
+
+static struct {
+    const char *path;
+    int epfd;
+    int listener;
+    int wake;                       /* connect threads -> loop */
+    ev_tag_t listener_tag;
+    ev_tag_t wake_tag;
+    client_t *clients;
+    uint32_t next_client;
+    session_t *sessions;
+    uint32_t session_count;
+    session_t *graveyard;           /* unlinked, still referenced by this pass's events */
+
+    pthread_mutex_t mutex;          /* done list, connecting count, TLS cache */
+    session_t *done;
+    int connecting;
+
+    SSL_CTX *tls;
+    int tls_verify;
+    struct {
+        char key[272];                  /* host:port */
+        SSL_SESSION *session;
+    } tls_cache[MEDIAD_TLS_SESSIONS];
+    uint32_t tls_next;
+
+    volatile sig_atomic_t running;
+    volatile sig_atomic_t report;
+
+    uint64_t opened;
+    uint64_t failed;
+    uint64_t retries;
+    uint64_t closed;
+    uint64_t up_bytes;
+    uint64_t down_bytes;
+    uint64_t down_stalls;
+} md = {
+    .path = MEDIAD_DEFAULT_SOCKET,
+    .listener = -1,
+    .wake = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .running = 1,
+};
+
+static void mlog(const char *level, const char *fmt, ...) {
+    char when[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    va_list ap;
+
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&now, &tm));
+    fprintf(stderr, "%s [%s] nova-mediad: ", when, level);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+static void on_signal(int sig) {
+    if (sig == SIGUSR1) {
+        md.report = 1;
+    } else {
+        md.running = 0;
+    }
+}
+
+/*
+ * One message, with up to 4 descriptors attached
+ */
+static int send_msg(int sock, const nova_mediad_msg_t *msg, const int *fds, int nfds) {
+    char cbuf[CMSG_SPACE(sizeof(int) * 4)];
+    struct iovec iov = { (void *)msg, sizeof(*msg) };
+    struct msghdr mh = { 0 };
+
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (nfds) {
+        struct cmsghdr *cm;
+
+        memset(cbuf, 0, sizeof(cbuf));
+        mh.msg_control = cbuf;
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+    }
+
+    return sendmsg(sock, &mh, MSG_NOSIGNAL) == (ssize_t)sizeof(*msg) ? 0 : -1;
+}
+
+/*
+ * Returns the number of descriptors received, or -1 on EOF/error
+ */
+static int recv_msg(int sock, nova_mediad_msg_t *msg, int *fds, int max) {
+    char cbuf[CMSG_SPACE(sizeof(int) * 4)];
+    struct iovec iov = { msg, sizeof(*msg) };
+    struct msghdr mh = { 0 };
+    struct cmsghdr *cm;
+    int nfds = 0;
+    ssize_t r;
+
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+
+    do {
+        r = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (r < 0 && errno == EINTR);
+    if (r != (ssize_t)sizeof(*msg)) {
+        return -1;
+    }
+
+    for (cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            int n = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+
+            for (int i = 0; i < n; i++) {
+                int fd;
+
+                memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+                if (nfds < max) {
+                    fds[nfds++] = fd;
+                } else {
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    return nfds;
+}
+
+static void signal_fd(int efd) {
+    uint64_t one = 1;
+
+    if (write(efd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        mlog("WARN", "eventfd write: %s", strerror(errno));
+    }
+}
+
+/*
+ * TLS, as mod_nova_sonic does it in-process: TLS 1.2 with AES-GCM handed to
+ * kTLS, the SSL object dropped after the handshake, the last session per
+ * gateway kept for resumption
+ */
+static int tls_start(const char *ca) {
+    if (!(md.tls = SSL_CTX_new(TLS_client_method()))) {
+        return -1;
+    }
+    SSL_CTX_set_min_proto_version(md.tls, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(md.tls, TLS1_2_VERSION);
+    SSL_CTX_set_cipher_list(md.tls, "ECDHE+AESGCM");
+    SSL_CTX_set_options(md.tls, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+    SSL_CTX_set_session_cache_mode(md.tls, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+
+    if (md.tls_verify) {
+        if (ca ? !SSL_CTX_load_verify_locations(md.tls, ca, NULL) : !SSL_CTX_set_default_verify_paths(md.tls)) {
+            mlog("ERROR", "TLS CA '%s' not loaded", ca ? ca : "(system)");
+            return -1;
+        }
+        SSL_CTX_set_verify(md.tls, SSL_VERIFY_PEER, NULL);
+    }
+
+    return 0;
+}
+
+static int tls_wrap(int sock, const char *host, int port) {
+    char key[272], reason[256] = "";
+    SSL_SESSION *cached = NULL;
+    int ok = 0;
+    SSL *ssl;
+
+    snprintf(key, sizeof(key), "%s:%d", host, port);
+
+    if (!(ssl = SSL_new(md.tls))) {
+        goto done;
+    }
+    SSL_set_fd(ssl, sock);
+    SSL_set_tlsext_host_name(ssl, host);
+    if (md.tls_verify) {
+        SSL_set1_host(ssl, host);
+    }
+
+    pthread_mutex_lock(&md.mutex);
+    for (int i = 0; i < MEDIAD_TLS_SESSIONS; i++) {
+        if (md.tls_cache[i].session && !strcmp(md.tls_cache[i].key, key)) {
+            SSL_set_session(ssl, md.tls_cache[i].session);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&md.mutex);
+
+    if (SSL_connect(ssl) != 1) {
+        if (ERR_peek_last_error()) {
+            ERR_error_string_n(ERR_peek_last_error(), reason, sizeof(reason));
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            snprintf(reason, sizeof(reason), "handshake timed out");
+        }
+        if (SSL_get_verify_result(ssl) != X509_V_OK) {
+            snprintf(reason, sizeof(reason), "%s", X509_verify_cert_error_string(SSL_get_verify_result(ssl)));
+        }
+        goto done;
+    }
+    if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) || !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+        snprintf(reason, sizeof(reason), "kernel TLS not available for %s", SSL_get_cipher_name(ssl));
+        goto done;
+    }
+
+    if (!SSL_session_reused(ssl) && (cached = SSL_get1_session(ssl))) {
+        int slot = -1;
+
+        pthread_mutex_lock(&md.mutex);
+        for (int i = 0; i < MEDIAD_TLS_SESSIONS && slot < 0; i++) {
+            if (md.tls_cache[i].session && !strcmp(md.tls_cache[i].key, key)) {
+                slot = i;
+            }
+        }
+        if (slot < 0) {
+            slot = (int)md.tls_next;
+            md.tls_next = (md.tls_next + 1) % MEDIAD_TLS_SESSIONS;
+            snprintf(md.tls_cache[slot].key, sizeof(md.tls_cache[slot].key), "%s", key);
+        }
+        if (md.tls_cache[slot].session) {
+            SSL_SESSION_free(md.tls_cache[slot].session);
+        }
+        md.tls_cache[slot].session = cached;
+        pthread_mutex_unlock(&md.mutex);
+    }
+    ok = 1;
+
+done:
+    if (!ok) {
+        mlog("ERROR", "TLS to gateway %s failed: %s", key, reason[0] ? reason : "handshake error");
+    }
+    ERR_clear_error();
+    if (ssl) {
+        SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        SSL_free(ssl);
+    }
+    return ok ? 0 : -1;
+}
+
+/*
+ * One connect attempt, TCP and TLS handshakes together bounded by timeout_ms
+ */
+static int gateway_connect(const session_t *s, int *error) {
+    struct addrinfo hints = { 0 }, *res = NULL;
+    struct timespec start, now;
+    struct timeval tv = { 0 };
+    char port[16];
+    int sock = -1, one = 1, err = 0, left_ms;
+    socklen_t len = sizeof(err);
+    struct pollfd pfd;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", s->open.port);
+
+    if (getaddrinfo(s->open.host, port, &hints, &res) != 0 || !res) {
+        *error = EHOSTUNREACH;
+        return -1;
+    }
+
+    if ((sock = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        *error = errno;
+        freeaddrinfo(res);
+        return -1;
+    }
+    if (connect(sock, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        err = errno;
+    } else {
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, (int)s->open.timeout_ms) != 1) {
+            err = ETIMEDOUT;
+        } else if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+            err = errno;
+        }
+    }
+    freeaddrinfo(res);
+
+    if (err) {
+        close(sock);
+        *error = err;
+        return -1;
+    }
+
+    /* Blocking for the TLS handshake; the pump sends with MSG_DONTWAIT */
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (s->open.tls) {
+        /* A gateway that accepts and then stalls must not hold the thread past the attempt */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left_ms = (int)s->open.timeout_ms - (int)((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+        if (left_ms <= 0) {
+            close(sock);
+            *error = ETIMEDOUT;
+            return -1;
+        }
+        tv.tv_sec = left_ms / 1000;
+        tv.tv_usec = (left_ms % 1000) * 1000;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        if (!md.tls || tls_wrap(sock, s->open.host, s->open.port) < 0) {
+            close(sock);
+            *error = EPROTO;
+            return -1;
+        }
+
+        memset(&tv, 0, sizeof(tv));
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    return sock;
+}
+
+/*
+ * Connect thread: attempts with backoff, then hand the session to the loop
+ */
+static void *connect_thread(void *obj) {
+    session_t *s = (session_t *)obj;
+    int backoff_ms = 100;
+
+    for (s->attempts = 0; s->attempts <= s->open.retries && md.running; s->attempts++) {
+        if (s->attempts) {
+            __atomic_add_fetch(&md.retries, 1, __ATOMIC_RELAXED);
+            usleep((useconds_t)backoff_ms * 1000);
+            backoff_ms = backoff_ms * 2 > 1000 ? 1000 : backoff_ms * 2;
+        }
+        if ((s->gw = gateway_connect(s, &s->connect_error)) >= 0) {
+            break;
+        }
+        mlog("WARN", "link %u/%u: connect to %s:%u failed (attempt %u): %s", s->open.client, s->open.id, s->open.host,
+            s->open.port, s->attempts + 1, strerror(s->connect_error));
+    }
+
+    pthread_mutex_lock(&md.mutex);
+    s->done_next = md.done;
+    md.done = s;
+    md.connecting--;
+    pthread_mutex_unlock(&md.mutex);
+    signal_fd(md.wake);
+
+    return NULL;
+}
+
+static void session_link(session_t *s) {
+    s->next = md.sessions;
+    s->prev = NULL;
+    if (md.sessions) {
+        md.sessions->prev = s;
+    }
+    md.sessions = s;
+    md.session_count++;
+}
+
+/*
+ * Gateway connection is gone; the module sees CLOSED and sends CLOSE
+ */
+static void session_gateway_closed(session_t *s, const char *why) {
+    if (s->gw < 0) {
+        return;
+    }
+    mlog("INFO", "link %u/%u: gateway %s:%u %s", s->open.client, s->open.id, s->open.host, s->open.port, why);
+    epoll_ctl(md.epfd, EPOLL_CTL_DEL, s->gw, NULL);
+    epoll_ctl(md.epfd, EPOLL_CTL_DEL, s->up_efd, NULL);
+    close(s->gw);
+    s->gw = -1;
+    __atomic_store_n(&s->shm->state, NOVA_LINK_CLOSED, __ATOMIC_RELEASE);
+    signal_fd(s->down_efd);
+    md.closed++;
+}
+
+static void session_free(session_t *s) {
+    if (s->gw >= 0) {
+        epoll_ctl(md.epfd, EPOLL_CTL_DEL, s->gw, NULL);
+        close(s->gw);
+    }
+    epoll_ctl(md.epfd, EPOLL_CTL_DEL, s->up_efd, NULL);
+    if (s->prev) {
+        s->prev->next = s->next;
+    } else {
+        md.sessions = s->next;
+    }
+    if (s->next) {
+        s->next->prev = s->prev;
+    }
+    md.session_count--;
+    munmap(s->shm, sizeof(nova_link_shm_t));
+    close(s->memfd);
+    close(s->up_efd);
+    close(s->down_efd);
+    s->dead = 1;
+    s->next = md.graveyard;
+    md.graveyard = s;
+}
+
+static void session_arm(session_t *s) {
+    struct epoll_event ev = { 0 };
+
+    ev.events = (s->down_full ? 0 : EPOLLIN) | (s->want_out ? EPOLLOUT : 0) | EPOLLRDHUP;
+    ev.data.ptr = &s->gw_tag;
+    epoll_ctl(md.epfd, EPOLL_CTL_MOD, s->gw, &ev);
+}
+
+/*
+ * Up ring -> gateway socket, sending straight from the ring
+ */
+static void pump_up(session_t *s) {
+    nova_ring_t *ring = &s->shm->up;
+
+    while (s->gw >= 0) {
+        uint32_t used = nova_ring_used(ring);
+        uint32_t off = ring->head & (NOVA_MEDIAD_RING - 1);
+        uint32_t chunk = used < NOVA_MEDIAD_RING - off ? used : NOVA_MEDIAD_RING - off;
+        ssize_t sent;
+
+        if (!used) {
+            if (nova_ring_wait(ring)) {
+                continue;
+            }
+            break;
+        }
+
+        sent = send(s->gw, ring->data + off, chunk, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!s->want_out) {
+                s->want_out = 1;
+                session_arm(s);
+            }
+            return;
+        }
+        if (sent < 0) {
+            session_gateway_closed(s, strerror(errno));
+            return;
+        }
+        __atomic_store_n(&ring->head, ring->head + (uint32_t)sent, __ATOMIC_RELEASE);
+        md.up_bytes += (uint64_t)sent;
+    }
+
+    if (s->gw >= 0 && s->want_out) {
+        s->want_out = 0;
+        session_arm(s);
+    }
+}
+
+/*
+ * Gateway socket -> down ring, receiving straight into the ring
+ */
+static void pump_down(session_t *s) {
+    nova_ring_t *ring = &s->shm->down;
+    uint32_t moved = 0;
+
+    while (s->gw >= 0) {
+        uint32_t tail = ring->tail;
+        uint32_t room = NOVA_MEDIAD_RING - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+        uint32_t off = tail & (NOVA_MEDIAD_RING - 1);
+        uint32_t chunk = room < NOVA_MEDIAD_RING - off ? room : NOVA_MEDIAD_RING - off;
+        ssize_t r;
+
+        if (!room) {
+            /* Module is behind; let TCP push back on the gateway */
+            if (!s->down_full) {
+                s->down_full = 1;
+                md.down_stalls++;
+                session_arm(s);
+            }
+            break;
+        }
+        if (s->down_full) {
+            s->down_full = 0;
+            session_arm(s);
+        }
+
+        r = recv(s->gw, ring->data + off, chunk, MSG_DONTWAIT);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (r <= 0) {
+            if (moved && nova_ring_wake(ring)) {
+                signal_fd(s->down_efd);
+            }
+            session_gateway_closed(s, r == 0 ? "closed the connection" : strerror(errno));
+            return;
+        }
+        __atomic_store_n(&ring->tail, tail + (uint32_t)r, __ATOMIC_RELEASE);
+        moved += (uint32_t)r;
+    }
+
+    md.down_bytes += moved;
+    if (moved && nova_ring_wake(ring)) {
+        signal_fd(s->down_efd);
+    }
+}
+
+/*
+ * Start pumping a connected session
+ */
+static void session_attach(session_t *s) {
+    struct epoll_event ev = { 0 };
+
+    s->up_tag.kind = EV_UP;
+    s->up_tag.obj = s;
+    s->gw_tag.kind = EV_GATEWAY;
+    s->gw_tag.obj = s;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &s->up_tag;
+    epoll_ctl(md.epfd, EPOLL_CTL_ADD, s->up_efd, &ev);
+
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = &s->gw_tag;
+    epoll_ctl(md.epfd, EPOLL_CTL_ADD, s->gw, &ev);
+
+    /* Anything queued before we were watching */
+    pump_up(s);
+    pump_down(s);
+}
+
+static void connect_finished(void) {
+    session_t *done;
+    uint64_t v;
+
+    if (read(md.wake, &v, sizeof(v)) < 0) {
+        /* spurious */
+    }
+
+    pthread_mutex_lock(&md.mutex);
+    done = md.done;
+    md.done = NULL;
+    pthread_mutex_unlock(&md.mutex);
+
+    while (done) {
+        session_t *s = done;
+
+        done = s->done_next;
+        s->pending = 0;
+        if (!s->client) {
+            /* Module closed it (or went away) while it was connecting */
+            if (s->gw >= 0) {
+                close(s->gw);
+                s->gw = -1;
+            }
+            session_free(s);
+            continue;
+        }
+        if (s->gw < 0) {
+            s->shm->error = s->connect_error;
+            __atomic_store_n(&s->shm->state, NOVA_LINK_FAILED, __ATOMIC_RELEASE);
+            signal_fd(s->down_efd);
+            md.failed++;
+            continue;
+        }
+        __atomic_store_n(&s->shm->state, NOVA_LINK_OPEN, __ATOMIC_RELEASE);
+        signal_fd(s->down_efd);
+        md.opened++;
+        mlog("INFO", "link %u/%u: connected to %s:%u%s%s", s->open.client, s->open.id, s->open.host, s->open.port,
+            s->open.tls ? " (kTLS)" : "", s->attempts ? " after retries" : "");
+        session_attach(s);
+    }
+}
+
+/*
+ * Start the connect thread of a linked session
+ */
+static void session_connect(session_t *s) {
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    s->pending = 1;
+
+    pthread_mutex_lock(&md.mutex);
+    md.connecting++;
+    pthread_mutex_unlock(&md.mutex);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, connect_thread, s) != 0) {
+        s->connect_error = errno;
+        pthread_mutex_lock(&md.mutex);
+        s->done_next = md.done;
+        md.done = s;
+        md.connecting--;
+        pthread_mutex_unlock(&md.mutex);
+        signal_fd(md.wake);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static void session_open(client_t *c, const nova_mediad_msg_t *msg, int *fds, int nfds) {
+    session_t *s;
+
+    if (nfds != 3 || !(s = calloc(1, sizeof(*s)))) {
+        mlog("WARN", nfds != 3 ? "open without its descriptors; ignored" : "open: out of memory; ignored");
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        return;
+    }
+
+    s->open = *msg;
+    s->open.host[sizeof(s->open.host) - 1] = '\0';
+    s->open.client = c->index;
+    s->client = c;
+    s->gw = -1;
+    s->memfd = fds[0];
+    s->up_efd = fds[1];
+    s->down_efd = fds[2];
+
+    s->shm = mmap(NULL, sizeof(nova_link_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, s->memfd, 0);
+    if (s->shm == MAP_FAILED || s->shm->magic != NOVA_MEDIAD_MAGIC) {
+        mlog("WARN", "link %u/%u: shared ring not usable; ignored", c->index, msg->id);
+        if (s->shm != MAP_FAILED) {
+            munmap(s->shm, sizeof(nova_link_shm_t));
+        }
+        close(s->memfd);
+        close(s->up_efd);
+        close(s->down_efd);
+        free(s);
+        return;
+    }
+    session_link(s);
+    session_connect(s);
+}
+
+static session_t *session_find(client_t *c, uint32_t id) {
+    for (session_t *s = md.sessions; s; s = s->next) {
+        if (s->client == c && s->open.id == id) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static client_t *client_add(int fd, uint32_t index) {
+    client_t *c = calloc(1, sizeof(*c));
+    struct epoll_event ev = { 0 };
+
+    if (!c) {
+        mlog("ERROR", "module connection %u: out of memory; dropped", index);
+        close(fd);
+        return NULL;
+    }
+    c->fd = fd;
+    c->index = index;
+    c->tag.kind = EV_CLIENT;
+    c->tag.obj = c;
+    c->next = md.clients;
+    md.clients = c;
+    if (index >= md.next_client) {
+        md.next_client = index + 1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &c->tag;
+    epoll_ctl(md.epfd, EPOLL_CTL_ADD, fd, &ev);
+    return c;
+}
+
+/*
+ * Drop a module connection (FreeSWITCH stopped or the module unloaded)
+ */
+static void client_remove(client_t *c, int close_sessions) {
+    client_t **pp = &md.clients;
+
+    while (*pp && *pp != c) {
+        pp = &(*pp)->next;
+    }
+    if (*pp) {
+        *pp = c->next;
+    }
+
+    for (session_t *s = md.sessions, *next; s; s = next) {
+        next = s->next;
+        if (s->client != c) {
+            continue;
+        }
+        s->client = NULL;
+        /* A session still connecting is freed once its thread reports */
+        if (close_sessions && !s->pending) {
+            session_free(s);
+        }
+    }
+
+    epoll_ctl(md.epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c);
+}
+
+/*
+ * Hand everything to the instance on c and exit
+ */
+static void handover(client_t *c) {
+    nova_mediad_msg_t msg = { 0 };
+    int fd = c->fd;
+
+    mlog("INFO", "takeover requested; handing over %u sessions", md.session_count);
+
+    /* The new instance is not a module connection */
+    epoll_ctl(md.epfd, EPOLL_CTL_DEL, fd, NULL);
+    {
+        client_t **pp = &md.clients;
+
+        while (*pp && *pp != c) {
+            pp = &(*pp)->next;
+        }
+        if (*pp) {
+            *pp = c->next;
+        }
+        free(c);
+    }
+
+    /* Settle connects that already reported; the rest go over as pending */
+    connect_finished();
+
+    msg.type = NOVA_MEDIAD_LISTENER;
+    if (send_msg(fd, &msg, &md.listener, 1) < 0) {
+        mlog("ERROR", "takeover failed: %s; carrying on", strerror(errno));
+        close(fd);
+        return;
+    }
+
+    for (client_t *cl = md.clients; cl; cl = cl->next) {
+        msg.type = NOVA_MEDIAD_CLIENT;
+        msg.client = cl->index;
+        send_msg(fd, &msg, &cl->fd, 1);
+    }
+
+    for (session_t *s = md.sessions; s; s = s->next) {
+        int fds[4] = { s->memfd, s->up_efd, s->down_efd, s->gw };
+
+        if (!s->client) {
+            continue;
+        }
+        msg = s->open;
+        msg.type = NOVA_MEDIAD_SESSION;
+        msg.client = s->client->index;
+        if (s->pending) {
+            /* Still connecting (shm state says so): the new instance connects again with what is left */
+            uint32_t attempts = __atomic_load_n(&s->attempts, __ATOMIC_RELAXED);
+
+            msg.retries = msg.retries > attempts ? msg.retries - attempts : 0;
+            send_msg(fd, &msg, fds, 3);
+            continue;
+        }
+        send_msg(fd, &msg, fds, s->gw >= 0 ? 4 : 3);
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = NOVA_MEDIAD_DONE;
+    send_msg(fd, &msg, NULL, 0);
+
+    /* Our copies close on exit; the new instance holds its own */
+    mlog("INFO", "handover complete; exiting");
+    exit(0);
+}
+
+/*
+ * Receive everything from the running instance on path
+ */
+static int takeover(void) {
+    struct sockaddr_un addr = { 0 };
+    nova_mediad_msg_t msg = { 0 };
+    int sock, fds[4], nfds;
+    uint32_t sessions = 0, clients = 0;
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", md.path);
+
+    if ((sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0 ||
+        connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        mlog("ERROR", "takeover: no instance on %s: %s", md.path, strerror(errno));
+        return -1;
+    }
+
+    msg.type = NOVA_MEDIAD_TAKEOVER;
+    if (send_msg(sock, &msg, NULL, 0) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    while ((nfds = recv_msg(sock, &msg, fds, 4)) >= 0) {
+        if (msg.type == NOVA_MEDIAD_DONE) {
+            break;
+        }
+        if (msg.type == NOVA_MEDIAD_LISTENER && nfds == 1) {
+            md.listener = fds[0];
+        } else if (msg.type == NOVA_MEDIAD_CLIENT && nfds == 1) {
+            client_add(fds[0], msg.client);
+            clients++;
+        } else if (msg.type == NOVA_MEDIAD_SESSION && nfds >= 3) {
+            session_t *s = calloc(1, sizeof(*s));
+            client_t *c = md.clients;
+
+            while (c && c->index != msg.client) {
+                c = c->next;
+            }
+            if (!s) {
+                mlog("ERROR", "takeover: link %u/%u: out of memory; dropped", msg.client, msg.id);
+                for (int i = 0; i < nfds; i++) {
+                    close(fds[i]);
+                }
+                continue;
+            }
+            s->open = msg;
+            s->open.type = NOVA_MEDIAD_OPEN;
+            s->client = c;
+            s->memfd = fds[0];
+            s->up_efd = fds[1];
+            s->down_efd = fds[2];
+            s->gw = nfds == 4 ? fds[3] : -1;
+            s->shm = mmap(NULL, sizeof(nova_link_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, s->memfd, 0);
+            if (s->shm == MAP_FAILED || !c) {
+                for (int i = 0; i < nfds; i++) {
+                    close(fds[i]);
+                }
+                free(s);
+                continue;
+            }
+            session_link(s);
+            if (s->gw >= 0) {
+                session_attach(s);
+            } else if (__atomic_load_n(&s->shm->state, __ATOMIC_ACQUIRE) == NOVA_LINK_CONNECTING) {
+                session_connect(s);
+            }
+            sessions++;
+        } else {
+            for (int i = 0; i < nfds; i++) {
+                close(fds[i]);
+            }
+        }
+    }
+    close(sock);
+
+    if (md.listener < 0) {
+        mlog("ERROR", "takeover: listening socket not received");
+        return -1;
+    }
+    mlog("INFO", "took over %u sessions from %u module connections", sessions, clients);
+    return 0;
+}
+
+static int listen_socket(void) {
+    struct sockaddr_un addr = { 0 };
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", md.path);
+
+    if ((md.listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+        return -1;
+    }
+    unlink(md.path);
+    if (bind(md.listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(md.listener, 64) < 0) {
+        return -1;
+    }
+    /* FreeSWITCH's group connects; run as the freeswitch user */
+    chmod(md.path, 0660);
+    return 0;
+}
+
+static void client_readable(client_t *c) {
+    nova_mediad_msg_t msg;
+    int fds[4];
+    int nfds = recv_msg(c->fd, &msg, fds, 4);
+    session_t *s;
+
+    if (nfds < 0) {
+        mlog("INFO", "module connection %u closed", c->index);
+        client_remove(c, 1);
+        return;
+    }
+
+    switch (msg.type) {
+    case NOVA_MEDIAD_OPEN:
+        session_open(c, &msg, fds, nfds);
+        return;
+    case NOVA_MEDIAD_CLOSE:
+        if ((s = session_find(c, msg.id))) {
+            if (s->pending) {
+                s->client = NULL;       /* freed when its connect reports */
+            } else {
+                session_free(s);
+            }
+        }
+        break;
+    case NOVA_MEDIAD_TAKEOVER:
+        handover(c);
+        return;
+    default:
+        break;
+    }
+
+    for (int i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+}
+
+static void report(void) {
+    uint32_t modules = 0;
+
+    for (client_t *c = md.clients; c; c = c->next) {
+        modules++;
+    }
+    mlog("INFO", "sessions=%u modules=%u opened=%llu failed=%llu retries=%llu closed=%llu up=%lluKB down=%lluKB down-stalls=%llu",
+        md.session_count, modules, (unsigned long long)md.opened, (unsigned long long)md.failed,
+        (unsigned long long)md.retries, (unsigned long long)md.closed,
+        (unsigned long long)(md.up_bytes / 1024), (unsigned long long)(md.down_bytes / 1024),
+        (unsigned long long)md.down_stalls);
+}
+
+int main(int argc, char **argv) {
+    struct epoll_event events[MEDIAD_MAX_EVENTS], ev = { 0 };
+    struct sigaction sa = { 0 };
+    const char *ca = NULL;
+    int take = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            md.path = argv[++i];
+        } else if (!strcmp(argv[i], "--tls-ca") && i + 1 < argc) {
+            ca = argv[++i];
+        } else if (!strcmp(argv[i], "--tls-verify")) {
+            md.tls_verify = 1;
+        } else if (!strcmp(argv[i], "--takeover")) {
+            take = 1;
+        } else {
+            fprintf(stderr, "usage: %s [-s socket] [--tls-ca file] [--tls-verify] [--takeover]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    sa.sa_handler = on_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (tls_start(ca) < 0) {
+        mlog("WARN", "TLS unavailable; links asking for TLS will fail");
+        if (md.tls) {
+            SSL_CTX_free(md.tls);
+            md.tls = NULL;
+        }
+    }
+
+    if ((md.epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        (md.wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        mlog("ERROR", "epoll/eventfd: %s", strerror(errno));
+        return 1;
+    }
+    md.wake_tag.kind = EV_WAKE;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &md.wake_tag;
+    epoll_ctl(md.epfd, EPOLL_CTL_ADD, md.wake, &ev);
+
+    if (take ? takeover() < 0 : listen_socket() < 0) {
+        mlog("ERROR", "cannot serve %s: %s", md.path, strerror(errno));
+        return 1;
+    }
+    md.listener_tag.kind = EV_LISTENER;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &md.listener_tag;
+    epoll_ctl(md.epfd, EPOLL_CTL_ADD, md.listener, &ev);
+
+    mlog("INFO", "serving %s%s", md.path, md.tls ? " (TLS available)" : "");
+
+    while (md.running) {
+        int stalled = 0;
+        int n;
+
+        for (session_t *s = md.sessions; s; s = s->next) {
+            stalled |= s->down_full;
+        }
+        n = epoll_wait(md.epfd, events, MEDIAD_MAX_EVENTS, stalled ? 10 : 1000);
+
+        if (md.report) {
+            md.report = 0;
+            report();
+        }
+
+        for (int i = 0; i < n; i++) {
+            ev_tag_t *tag = (ev_tag_t *)events[i].data.ptr;
+            session_t *s = (session_t *)tag->obj;
+
+            if ((tag->kind == EV_UP || tag->kind == EV_GATEWAY) && s->dead) {
+                continue;
+            }
+
+            switch (tag->kind) {
+            case EV_LISTENER: {
+                int fd = accept4(md.listener, NULL, NULL, SOCK_CLOEXEC);
+
+                if (fd >= 0) {
+                    client_add(fd, md.next_client);
+                }
+                break;
+            }
+            case EV_CLIENT:
+                client_readable((client_t *)tag->obj);
+                break;
+            case EV_WAKE:
+                connect_finished();
+                break;
+            case EV_UP: {
+                uint64_t v;
+
+                if (read(s->up_efd, &v, sizeof(v)) < 0) {
+                    /* already drained */
+                }
+                pump_up(s);
+                break;
+            }
+            case EV_GATEWAY:
+                if (events[i].events & EPOLLOUT) {
+                    pump_up(s);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    pump_down(s);
+                }
+                break;
+            }
+        }
+
+        /* Paused gateway reads resume once the module has drained */
+        if (stalled) {
+            for (session_t *s = md.sessions; s; s = s->next) {
+                if (s->down_full && s->gw >= 0) {
+                    pump_down(s);
+                }
+            }
+        }
+
+        while (md.graveyard) {
+            session_t *s = md.graveyard;
+
+            md.graveyard = s->next;
+            free(s);
+        }
+    }
+
+    mlog("INFO", "stopping; closing %u gateway connections", md.session_count);
+    for (session_t *s = md.sessions; s; s = s->next) {
+        session_gateway_closed(s, "closed by shutdown");
+    }
+    unlink(md.path);
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * nova_mediad.h - shared between mod_nova_sonic and the nova-mediad sidecar
+ *
+ * With mediad-socket set, mod_nova_sonic does not open gateway connections
+ * itself. For each one it creates a shared-memory segment (memfd) holding
+ * two byte rings and two eventfds, and passes them to nova-mediad over a
+ * SOCK_SEQPACKET unix socket in a NOVA_MEDIAD_OPEN message. The sidecar
+ * connects (with retries, and TLS when asked), then pumps bytes: the up
+ * ring to the gateway socket, the gateway socket into the down ring. The
+ * rings carry exactly the bytes the gateway socket would (handshake line,
+ * then typed messages up and frames plus control down), so framing stays in
+ * the module.
+ *
+ * Each ring is single-producer, single-consumer. A consumer that finds its
+ * ring empty sets waiting and re-checks; a producer that sees waiting after
+ * committing clears it and writes the ring's eventfd. Busy rings therefore
+ * cost no syscalls on either side.
+ *
+ * An upgrade is a takeover: the new sidecar connects to the same socket and
+ * sends NOVA_MEDIAD_TAKEOVER; the old one stops pumping and hands over its
+ * listening socket, its module connections and every session (gateway
+ * socket, memfd, eventfds) with SCM_RIGHTS, then exits; a session still
+ * connecting goes over without its gateway socket and the new one connects
+ * it again. Ring positions live in the shared segment and kTLS keeps record
+ * state in the socket, so no byte is lost and neither FreeSWITCH nor the
+ * gateway sees a reconnect.
+ */
+#ifndef NOVA_MEDIAD_H
+#define NOVA_MEDIAD_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#define NOVA_MEDIAD_MAGIC 0x4e4d4431u      /* "NMD1" */
+#define NOVA_MEDIAD_RING (64 * 1024)       /* power of two, ~4s of caller audio */
+
+typedef enum {
+    NOVA_LINK_CONNECTING,
+    NOVA_LINK_OPEN,
+    NOVA_LINK_FAILED,                      /* connect, retries or TLS failed; error is set */
+    NOVA_LINK_CLOSED                       /* gateway or sidecar went away */
+} nova_link_state_t;
+
+typedef struct {
+    volatile uint32_t head __attribute__((aligned(64)));   /* consumer position */
+    volatile uint32_t waiting;                              /* consumer found it empty */
+    volatile uint32_t tail __attribute__((aligned(64)));   /* producer position */
+    uint8_t data[NOVA_MEDIAD_RING] __attribute__((aligned(64)));
+} nova_ring_t;
+
+typedef struct {
+    uint32_t magic;
+    volatile uint32_t state;               /* nova_link_state_t */
+    volatile int32_t error;                /* errno of the failure */
+    nova_ring_t up;                        /* module -> gateway */
+    nova_ring_t down;                      /* gateway -> module */
+} nova_link_shm_t;
+
+typedef enum {
+    NOVA_MEDIAD_OPEN = 1,                  /* module: fds memfd, up eventfd, down eventfd */
+    NOVA_MEDIAD_CLOSE,                     /* module: link id is done */
+    NOVA_MEDIAD_TAKEOVER,                  /* new sidecar: hand everything over */
+    NOVA_MEDIAD_LISTENER,                  /* old sidecar: fd listening socket */
+    NOVA_MEDIAD_CLIENT,                    /* old sidecar: fd module connection */
+    NOVA_MEDIAD_SESSION,                   /* old sidecar: fds gateway, memfd, up, down */
+    NOVA_MEDIAD_DONE                       /* old sidecar: handover complete */
+} nova_mediad_type_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t id;                           /* link id, unique per module connection */
+    uint32_t client;                       /* handover: module connection the session belongs to */
+    uint32_t retries;                      /* connect attempts after the first */
+    uint32_t timeout_ms;                   /* per connect attempt */
+    uint16_t port;
+    uint8_t tls;
+    uint8_t pad;
+    char host[256];
+} nova_mediad_msg_t;
+
+static inline uint32_t nova_ring_used(const nova_ring_t *ring) {
+    return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+}
+
+/*
+ * Append all of iov or nothing; returns 0 when there is no room
+ */
+static inline int nova_ring_writev(nova_ring_t *ring, const struct iovec *iov, int n) {
+    uint32_t tail = ring->tail;
+    uint32_t room = NOVA_MEDIAD_RING - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+    size_t want = 0;
+
+    for (int i = 0; i < n; i++) {
+        want += iov[i].iov_len;
+    }
+    if (want > room) {
+        return 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        const uint8_t *p = (const uint8_t *)iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+
+        while (len) {
+            uint32_t off = tail & (NOVA_MEDIAD_RING - 1);
+            size_t chunk = NOVA_MEDIAD_RING - off < len ? NOVA_MEDIAD_RING - off : len;
+
+            memcpy(ring->data + off, p, chunk);
+            tail += (uint32_t)chunk;
+            p += chunk;
+            len -= chunk;
+        }
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * Copy up to len bytes out; consume them unless peeking
+ */
+static inline size_t nova_ring_read(nova_ring_t *ring, void *buf, size_t len, int peek) {
+    uint32_t head = ring->head;
+    uint32_t used = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - head;
+    size_t got = 0;
+
+    if (len > used) {
+        len = used;
+    }
+    while (got < len) {
+        uint32_t off = (head + (uint32_t)got) & (NOVA_MEDIAD_RING - 1);
+        size_t chunk = NOVA_MEDIAD_RING - off < len - got ? NOVA_MEDIAD_RING - off : len - got;
+
+        memcpy((uint8_t *)buf + got, ring->data + off, chunk);
+        got += chunk;
+    }
+
+    if (!peek) {
+        __atomic_store_n(&ring->head, head + (uint32_t)got, __ATOMIC_RELEASE);
+    }
+    return got;
+}
+
+/*
+ * Consumer side: about to sleep on the eventfd. Returns non-zero if data
+ * arrived meanwhile and the consumer should not sleep.
+ */
+static inline int nova_ring_wait(nova_ring_t *ring) {
+    __atomic_store_n(&ring->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return nova_ring_used(ring) != 0;
+}
+
+/*
+ * Producer side, after committing: non-zero if the eventfd must be written
+ */
+static inline int nova_ring_wake(nova_ring_t *ring) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return __atomic_exchange_n(&ring->waiting, 0, __ATOMIC_ACQ_REL) != 0;
+}
+
+#endif
@@ -9,20 +9,29 @@ import com.example.s2s.voipgateway.nova.event.*;
 import com.example.s2s.voipgateway.nova.observer.InteractObserver;
 import com.example.s2s.voipgateway.nova.tools.ModularNovaS2SEventHandler;
 import com.example.s2s.voipgateway.nova.tools.PromptConfiguration;
+import com.fasterxml.jackson.databind.JsonNode;
+import com.fasterxml.jackson.databind.ObjectMapper;
 import org.slf4j.Logger;
 import org.slf4j.LoggerFactory;
+import org.slf4j.MDC;
 import software.amazon.awssdk.http.Protocol;
 import software.amazon.awssdk.http.ProtocolNegotiation;
 import software.amazon.awssdk.http.nio.netty.NettyNioAsyncHttpClient;
 import software.amazon.awssdk.regions.Region;
 import software.amazon.awssdk.services.bedrockruntime.BedrockRuntimeAsyncClient;
 
+import javax.net.ssl.SSLHandshakeException;
+import javax.net.ssl.SSLSocket;
 import java.io.*;
 import java.net.Socket;
 import java.time.Duration;
 import java.time.temporal.ChronoUnit;
 import java.util.Base64;
+import java.util.Collections;
+import java.util.Iterator;
+import java.util.Map;
 import java.util.UUID;
+import java.util.concurrent.ConcurrentHashMap;
 
 /**
  * Handles a single audio session from FreeSWITCH via TCP.
@@ -34,18 +43,32 @@ import java.util.UUID;
  *
  * Protocol:
  *   - Handshake: "NOVA_SESSION:<session_id>:CALLER:<caller_id>\n"
- *   - Then: Raw PCM audio bytes (8kHz, 16-bit, mono)
+ *   - Then: PCM audio (8kHz, 16-bit, mono; or interleaved stereo caller/agent
+ *     when the handshake says "channels":2, downmixed for Nova)
+ *   - From FreeSWITCH, when the handshake says "framing":"typed": every message is
+ *     a type byte (1 = audio, 2 = control), a 4-byte big-endian length and the
+ *     payload. Older modules send raw frames and bare length-prefixed control.
+ *   - Control messages to FreeSWITCH: 4-byte big-endian length (never 320)
+ *     followed by a JSON payload, e.g. {"type":"paused","reason":"music"}
  */
 public class FreeSwitchAudioHandler implements Runnable {
     private static final Logger LOG = LoggerFactory.getLogger(FreeSwitchAudioHandler.class);
     private static final String ROLE_SYSTEM = "SYSTEM";
+    private static final ObjectMapper JSON = new ObjectMapper();
+    private static final int MSG_AUDIO = 0x01;
+    private static final int MSG_CONTROL = 0x02;
+    private static final int MAX_CONTROL_BYTES = 64 * 1024;
 
     private final Socket socket;
     private final NovaMediaConfig mediaConfig;
     private String sessionId;
     private String callerId;
     private volatile boolean active;
+    // Caller stream uses typed framing (negotiated in the handshake)
+    private boolean typedFraming;
     private OutputStream socketOutput;
+    // Channel variables exported by FreeSWITCH (handshake "vars", updated by "vars" messages)
+    private final Map<String, String> callVars = new ConcurrentHashMap<>();
 
     /**
      * Represents session information parsed from handshake.
@@ -57,6 +80,11 @@ public class FreeSwitchAudioHandler implements Runnable {
         int channels;
         String format;
         String uui; // User-to-User Information header
+        boolean shadow; // Listen-only mirror of a live call (canary comparison)
+        String conference; // mod_conference room this session is a member of
+        String traceparent; // W3C trace context of the FreeSWITCH session span
+        boolean typedFraming; // Caller audio and control carry a type byte ("framing":"typed")
+        JsonNode vars; // Exported channel variables (export-vars), may be null
     }
 
     public FreeSwitchAudioHandler(Socket socket, NovaMediaConfig mediaConfig) {
@@ -70,6 +98,16 @@ public class FreeSwitchAudioHandler implements Runnable {
         try {
             LOG.info("FreeSWITCH audio session started from {}", socket.getRemoteSocketAddress());
 
+            // RTT probes connect and close without a ClientHello
+            if (socket instanceof SSLSocket) {
+                try {
+                    ((SSLSocket) socket).startHandshake();
+                } catch (SSLHandshakeException e) {
+                    LOG.debug("TLS handshake not completed (RTT probe?): {}", e.getMessage());
+                    return;
+                }
+            }
+
             // Get raw streams - CRITICAL: Do NOT wrap with BufferedReader
             InputStream socketInput = socket.getInputStream();
             socketOutput = socket.getOutputStream();
@@ -79,7 +117,12 @@ public class FreeSwitchAudioHandler implements Runnable {
             while (true) {
                 int b = socketInput.read();
                 if (b == -1) {
-                    LOG.error("Socket closed during handshake");
+                    if (headerBuf.size() == 0) {
+                        // FreeSWITCH times a bare connect to measure RTT to this gateway
+                        LOG.debug("Connection closed before handshake (RTT probe)");
+                    } else {
+                        LOG.error("Socket closed during handshake");
+                    }
                     return;
                 }
                 if (b == '\n') break;
@@ -94,8 +137,9 @@ public class FreeSwitchAudioHandler implements Runnable {
             }
 
             SessionInfo sessionInfo;
+            boolean jsonHandshake = handshake.trim().startsWith("{");
 
-            if (handshake.trim().startsWith("{")) {
+            if (jsonHandshake) {
                 // New JSON handshake from FreeSWITCH
                 try {
                     sessionInfo = parseJsonHandshake(handshake);
@@ -118,10 +162,18 @@ public class FreeSwitchAudioHandler implements Runnable {
 
             sessionId = sessionInfo.callUuid;
             callerId = sessionInfo.caller;
+            typedFraming = sessionInfo.typedFraming;
+            mergeCallVars(sessionInfo.vars);
 
-            LOG.info("Handshake received - Session: {}, Caller: {}, SampleRate: {}, Channels: {}, Format: {}, UUI: {}",
+            // Log lines on this thread carry the FreeSWITCH trace ID, so they can be joined with its spans
+            if (sessionInfo.traceparent != null && sessionInfo.traceparent.length() >= 35) {
+                MDC.put("trace_id", sessionInfo.traceparent.substring(3, 35));
+            }
+
+            LOG.info("Handshake received - Session: {}, Caller: {}, SampleRate: {}, Channels: {}, Format: {}, UUI: {}, Trace: {}, Vars: {}",
                     sessionId, callerId, sessionInfo.sampleRate, sessionInfo.channels, sessionInfo.format,
-                    sessionInfo.uui != null ? sessionInfo.uui : "none");
+                    sessionInfo.uui != null ? sessionInfo.uui : "none",
+                    sessionInfo.traceparent != null ? sessionInfo.traceparent : "none", callVars);
 
             // Initialize Nova Sonic connection (use same setup as NovaStreamerFactory)
             NettyNioAsyncHttpClient.Builder nettyBuilder = NettyNioAsyncHttpClient.builder()
@@ -161,7 +213,7 @@ public class FreeSwitchAudioHandler implements Runnable {
 
             // Fall back to PromptSelector if no UUI prompt
             if (promptConfigPath == null) {
-                String calledNumber = null; // TODO: Extract from handshake if available
+                String calledNumber = callVars.get("destination_number"); // when exported
                 promptConfigPath = com.example.s2s.voipgateway.nova.tools.PromptSelector.selectPrompt(
                         callerId, calledNumber);
                 LOG.info("Using prompt from PromptSelector: {}", promptConfigPath);
@@ -180,6 +232,24 @@ public class FreeSwitchAudioHandler implements Runnable {
                         promptConfigPath, e.getMessage());
             }
 
+            // Shadow sessions mirror a live call: same prompt, but no tools so
+            // nothing with side effects (SMS, hangup, ...) runs twice
+            if (sessionInfo.shadow) {
+                LOG.info("Shadow session {} - tools disabled, output is discarded by FreeSWITCH", sessionId);
+                promptConfig = new PromptConfiguration(systemPrompt, Collections.emptyList());
+            }
+
+            // A conference session hears the whole room mixed together, not one caller
+            if (sessionInfo.conference != null) {
+                LOG.info("Conference session {} in room {}", sessionId, sessionInfo.conference);
+                systemPrompt = systemPrompt + "\n\nYou are a participant in a group call with several people, "
+                        + "and you hear everyone in the room mixed together. Only respond when you are addressed "
+                        + "or when the discussion needs your input.";
+                if (promptConfig != null) {
+                    promptConfig = new PromptConfiguration(systemPrompt, promptConfig.getToolNames());
+                }
+            }
+
             // Create event handler with prompt config if available, otherwise use all tools
             ModularNovaS2SEventHandler eventHandler;
             if (promptConfig != null) {
@@ -189,10 +259,12 @@ public class FreeSwitchAudioHandler implements Runnable {
             }
 
             eventHandler.setSessionId(sessionId);
-            eventHandler.setHangupCallback(() -> {
-                LOG.info("Nova requested hangup for session {}", sessionId);
-                sendHangupControlMessage();
-            });
+            if (!sessionInfo.shadow) {
+                eventHandler.setHangupCallback(() -> {
+                    LOG.info("Nova requested hangup for session {}", sessionId);
+                    sendHangupControlMessage();
+                });
+            }
 
             LOG.info("Using system prompt: {}", systemPrompt);
 
@@ -207,8 +279,14 @@ public class FreeSwitchAudioHandler implements Runnable {
 
             LOG.info("Nova Sonic streaming initialized for FreeSWITCH session {}", sessionId);
 
+            // Lets a hedged start on the FreeSWITCH side pick the first gateway that is
+            // ready. Legacy modules don't parse control messages, so only JSON handshakes get it.
+            if (jsonHandshake) {
+                sendControlMessage("{\"type\":\"ready\"}");
+            }
+
             // Start bidirectional audio streaming
-            startAudioStreaming(socket, inputObserver, eventHandler);
+            startAudioStreaming(socket, inputObserver, eventHandler, sessionInfo.channels);
 
             LOG.info("FreeSWITCH audio session ended: {}", sessionId);
 
@@ -216,6 +294,7 @@ public class FreeSwitchAudioHandler implements Runnable {
             LOG.error("Error handling FreeSWITCH audio session", e);
         } finally {
             cleanup();
+            MDC.remove("trace_id");
         }
     }
 
@@ -239,12 +318,158 @@ public class FreeSwitchAudioHandler implements Runnable {
         return 320;
     }
 
+    /**
+     * Reads exactly len bytes from a socket stream.
+     * @return len if successful, or the number of bytes read before EOF
+     */
+    private int readFully(InputStream in, byte[] buf, int off, int len) throws IOException {
+        int got = 0;
+        while (got < len) {
+            int r = in.read(buf, off + got, len - got);
+            if (r < 0) return got;
+            got += r;
+        }
+        return got;
+    }
+
+    /**
+     * Reads the next caller frame from FreeSWITCH (320 bytes per channel), handling
+     * any control messages that arrive in between.
+     * @return frame.length for an audio frame, -1 on EOF
+     */
+    private int readCallerFrame(InputStream in, byte[] frame) throws IOException {
+        if (typedFraming) {
+            return readTypedCallerFrame(in, frame);
+        }
+
+        // Untyped modules: a 4-byte big-endian length, never the frame size, + JSON
+        while (true) {
+            if (readFully(in, frame, 0, 4) < 4) return -1;
+
+            int length = ((frame[0] & 0xFF) << 24) | ((frame[1] & 0xFF) << 16)
+                    | ((frame[2] & 0xFF) << 8) | (frame[3] & 0xFF);
+
+            if (length > 0 && length < 1024 && length != frame.length) {
+                byte[] message = new byte[length];
+                if (readFully(in, message, 0, length) < length) return -1;
+                handleControlMessage(new String(message, "UTF-8"));
+                continue;
+            }
+
+            if (readFully(in, frame, 4, frame.length - 4) < frame.length - 4) return -1;
+            return frame.length;
+        }
+    }
+
+    /**
+     * Typed framing: type byte, 4-byte big-endian length, payload.
+     * @return frame.length for an audio frame, -1 on EOF or a corrupt stream
+     */
+    private int readTypedCallerFrame(InputStream in, byte[] frame) throws IOException {
+        byte[] header = new byte[5];
+
+        while (true) {
+            if (readFully(in, header, 0, 5) < 5) return -1;
+
+            int type = header[0] & 0xFF;
+            int length = ((header[1] & 0xFF) << 24) | ((header[2] & 0xFF) << 16)
+                    | ((header[3] & 0xFF) << 8) | (header[4] & 0xFF);
+
+            if (length < 0 || length > MAX_CONTROL_BYTES) {
+                LOG.error("Corrupt caller stream: message type {} length {}", type, length);
+                return -1;
+            }
+
+            if (type == MSG_AUDIO && length == frame.length) {
+                if (readFully(in, frame, 0, length) < length) return -1;
+                return frame.length;
+            }
+
+            byte[] message = new byte[length];
+            if (readFully(in, message, 0, length) < length) return -1;
+
+            if (type == MSG_CONTROL) {
+                handleControlMessage(new String(message, "UTF-8"));
+            } else {
+                LOG.warn("Skipping caller message type {} length {} (expected {}-byte audio)",
+                        type, length, frame.length);
+            }
+        }
+    }
+
+    /**
+     * Downmixes an interleaved stereo PCM16LE frame (caller left, agent right) to mono.
+     */
+    private static void downmixStereo(byte[] stereo, byte[] mono) {
+        for (int i = 0, o = 0; o < mono.length; i += 4, o += 2) {
+            int left = (short) ((stereo[i] & 0xFF) | (stereo[i + 1] << 8));
+            int right = (short) ((stereo[i + 2] & 0xFF) | (stereo[i + 3] << 8));
+            int mixed = (left + right) / 2;
+            mono[o] = (byte) mixed;
+            mono[o + 1] = (byte) (mixed >> 8);
+        }
+    }
+
+    /**
+     * Handles a control message sent by the FreeSWITCH module.
+     */
+    private void handleControlMessage(String json) {
+        String type = extractJsonString(json, "type");
+        if ("paused".equals(type)) {
+            LOG.info("FreeSWITCH paused caller audio for session {} ({})", sessionId, extractJsonString(json, "reason"));
+        } else if ("resumed".equals(type)) {
+            LOG.info("FreeSWITCH resumed caller audio for session {}", sessionId);
+        } else if ("cache_miss".equals(type)) {
+            LOG.info("FreeSWITCH has no cached audio {} for session {}", extractJsonString(json, "hash"), sessionId);
+        } else if ("play_done".equals(type)) {
+            LOG.debug("FreeSWITCH queued cached audio {} for session {}", extractJsonString(json, "hash"), sessionId);
+        } else if ("vars".equals(type)) {
+            try {
+                mergeCallVars(JSON.readTree(json).get("vars"));
+                LOG.info("Channel variables updated for session {}: {}", sessionId, callVars);
+            } catch (IOException e) {
+                LOG.warn("Bad vars message from FreeSWITCH: {}", json, e);
+            }
+        } else if ("vad".equals(type)) {
+            LOG.debug("Session {} {} speech: {}", sessionId, extractJsonString(json, "leg"),
+                    json.contains("\"speech\":true"));
+        } else {
+            LOG.debug("Ignoring control message from FreeSWITCH: {}", json);
+        }
+    }
+
+    /**
+     * Applies exported channel variables; a null value means the variable was unset.
+     */
+    private void mergeCallVars(JsonNode vars) {
+        if (vars == null || !vars.isObject()) {
+            return;
+        }
+        Iterator<Map.Entry<String, JsonNode>> fields = vars.fields();
+        while (fields.hasNext()) {
+            Map.Entry<String, JsonNode> field = fields.next();
+            if (field.getValue().isNull()) {
+                callVars.remove(field.getKey());
+            } else {
+                callVars.put(field.getKey(), field.getValue().asText());
+            }
+        }
+    }
+
+    /**
+     * Gets the channel variables FreeSWITCH exported for this call.
+     */
+    public Map<String, String> getCallVars() {
+        return callVars;
+    }
+
     /**
      * Streams audio bidirectionally between FreeSWITCH and Nova.
      */
     private void startAudioStreaming(Socket socket,
                                      InteractObserver<NovaSonicEvent> inputObserver,
-                                     ModularNovaS2SEventHandler eventHandler) {
+                                     ModularNovaS2SEventHandler eventHandler,
+                                     int channels) {
 
         // Thread 1: FreeSWITCH → Nova
         Thread freeswitchToNova = new Thread(() -> {
@@ -252,6 +477,7 @@ public class FreeSwitchAudioHandler implements Runnable {
                 InputStream socketInput = socket.getInputStream();
                 Base64.Encoder encoder = Base64.getEncoder();
                 byte[] buffer = new byte[320]; // 20ms @ 8kHz, 16-bit mono
+                byte[] stereo = channels == 2 ? new byte[640] : null; // caller + agent, interleaved
                 String contentName = UUID.randomUUID().toString();
                 boolean startSent = false;
 
@@ -261,7 +487,16 @@ public class FreeSwitchAudioHandler implements Runnable {
                 int chunkCount = 0;
 
                 while (active && !socket.isClosed()) {
-                    int bytesRead = readFully320(socketInput, buffer);
+                    int bytesRead;
+                    if (stereo != null) {
+                        bytesRead = readCallerFrame(socketInput, stereo);
+                        if (bytesRead > 0) {
+                            downmixStereo(stereo, buffer);
+                            bytesRead = buffer.length;
+                        }
+                    } else {
+                        bytesRead = readCallerFrame(socketInput, buffer);
+                    }
                     if (bytesRead < 0) {
                         LOG.info("FreeSWITCH audio stream ended (total: {} bytes in {} chunks)", totalBytesRead, chunkCount);
                         break;
@@ -424,11 +659,26 @@ public class FreeSwitchAudioHandler implements Runnable {
 
     /**
      * Sends a hangup control message to FreeSWITCH.
-     * Control messages are 4-byte length-prefixed JSON payloads.
      */
     private void sendHangupControlMessage() {
+        if (!sendControlMessage("{\"type\":\"hangup\"}")) {
+            return;
+        }
+        try {
+            // Give FreeSWITCH time to process the hangup
+            Thread.sleep(500);
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+        }
+    }
+
+    /**
+     * Sends a control message to FreeSWITCH.
+     * Control messages are 4-byte length-prefixed JSON payloads.
+     * @return true if the message was written
+     */
+    private boolean sendControlMessage(String controlMessage) {
         try {
-            String controlMessage = "{\"type\":\"hangup\"}";
             byte[] messageBytes = controlMessage.getBytes("UTF-8");
 
             // Send length prefix (4 bytes, big-endian)
@@ -444,13 +694,12 @@ public class FreeSwitchAudioHandler implements Runnable {
                 socketOutput.flush();
             }
 
-            LOG.info("Sent hangup control message to FreeSWITCH: {}", controlMessage);
-
-            // Give FreeSWITCH time to process the hangup
-            Thread.sleep(500);
+            LOG.info("Sent control message to FreeSWITCH: {}", controlMessage);
+            return true;
 
         } catch (Exception e) {
-            LOG.error("Failed to send hangup control message", e);
+            LOG.error("Failed to send control message {}", controlMessage, e);
+            return false;
         }
     }
 
@@ -469,6 +718,12 @@ public class FreeSwitchAudioHandler implements Runnable {
         info.caller     = extractJsonString(body, "caller");
         info.format     = extractJsonString(body, "format");
         info.uui        = extractJsonString(body, "uui");
+        info.shadow     = extractJsonBoolean(body, "shadow");
+        info.conference = extractJsonString(body, "conference");
+        info.traceparent = extractJsonString(body, "traceparent");
+        info.typedFraming = "typed".equals(extractJsonString(body, "framing"));
+        // Exported values may hold any characters, so they get a real parser
+        info.vars       = body.contains("\"vars\"") ? JSON.readTree(body).get("vars") : null;
 
         String srStr    = extractJsonNumber(body, "sample_rate");
         String chStr    = extractJsonNumber(body, "channels");
@@ -543,6 +798,19 @@ public class FreeSwitchAudioHandler implements Runnable {
         return json.substring(firstQuote + 1, secondQuote);
     }
 
+    /**
+     * Extracts a boolean value from JSON for a given key.
+     * Matches "shadow": true; anything else is false.
+     */
+    private boolean extractJsonBoolean(String json, String key) {
+        String pattern = "\"" + key + "\"";
+        int idx = json.indexOf(pattern);
+        if (idx < 0) return false;
+        int colon = json.indexOf(":", idx);
+        if (colon < 0) return false;
+        return json.substring(colon + 1).trim().startsWith("true");
+    }
+
     /**
      * Extracts a numeric value from JSON for a given key.
      * Matches something like "sample_rate": 8000
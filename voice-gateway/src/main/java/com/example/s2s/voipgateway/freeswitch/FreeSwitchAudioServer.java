@@ -4,9 +4,16 @@ import com.example.s2s.voipgateway.NovaMediaConfig;
 import org.slf4j.Logger;
 import org.slf4j.LoggerFactory;
 
+import javax.net.ssl.KeyManagerFactory;
+import javax.net.ssl.SSLContext;
+import javax.net.ssl.SSLServerSocket;
+import java.io.FileInputStream;
 import java.io.IOException;
+import java.io.InputStream;
 import java.net.ServerSocket;
 import java.net.Socket;
+import java.security.GeneralSecurityException;
+import java.security.KeyStore;
 import java.util.concurrent.ExecutorService;
 import java.util.concurrent.Executors;
 
@@ -20,6 +27,10 @@ import java.util.concurrent.Executors;
  *   FreeSWITCH (SIP/RTP) → mod_nova_sonic (TCP client) → FreeSwitchAudioServer (TCP server)
  *                                                         ↓
  *                                                      Nova Sonic (Bedrock)
+ *
+ * With GATEWAY_TLS_KEYSTORE (PKCS12, password in GATEWAY_TLS_KEYSTORE_PASSWORD)
+ * the listener speaks TLS 1.2 with AES-GCM only, the profile mod_nova_sonic
+ * hands to kernel TLS after the handshake.
  */
 public class FreeSwitchAudioServer implements Runnable {
     private static final Logger LOG = LoggerFactory.getLogger(FreeSwitchAudioServer.class);
@@ -45,9 +56,10 @@ public class FreeSwitchAudioServer implements Runnable {
     @Override
     public void run() {
         try {
-            serverSocket = new ServerSocket(port);
+            serverSocket = createServerSocket();
             running = true;
-            LOG.info("FreeSWITCH Audio Server listening on port {}", port);
+            LOG.info("FreeSWITCH Audio Server listening on port {}{}", port,
+                    serverSocket instanceof SSLServerSocket ? " (TLS)" : "");
             LOG.info("Waiting for audio connections from mod_nova_sonic...");
 
             while (running) {
@@ -80,6 +92,40 @@ public class FreeSwitchAudioServer implements Runnable {
         }
     }
 
+    /**
+     * Creates the listening socket, TLS when a keystore is configured.
+     * mod_nova_sonic's kernel TLS can only take TLS 1.2 AES-GCM sessions,
+     * so the listener offers nothing else.
+     */
+    private ServerSocket createServerSocket() throws IOException {
+        String keystore = System.getenv().getOrDefault("GATEWAY_TLS_KEYSTORE", "");
+        if (keystore.isEmpty()) {
+            return new ServerSocket(port);
+        }
+
+        try (InputStream in = new FileInputStream(keystore)) {
+            char[] password = System.getenv().getOrDefault("GATEWAY_TLS_KEYSTORE_PASSWORD", "").toCharArray();
+            KeyStore ks = KeyStore.getInstance("PKCS12");
+            ks.load(in, password);
+            KeyManagerFactory kmf = KeyManagerFactory.getInstance(KeyManagerFactory.getDefaultAlgorithm());
+            kmf.init(ks, password);
+            SSLContext context = SSLContext.getInstance("TLS");
+            context.init(kmf.getKeyManagers(), null, null);
+
+            SSLServerSocket socket = (SSLServerSocket) context.getServerSocketFactory().createServerSocket(port);
+            socket.setEnabledProtocols(new String[] { "TLSv1.2" });
+            socket.setEnabledCipherSuites(new String[] {
+                    "TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256",
+                    "TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256",
+                    "TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384",
+                    "TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384"
+            });
+            return socket;
+        } catch (GeneralSecurityException e) {
+            throw new IOException("Cannot load TLS keystore " + keystore, e);
+        }
+    }
+
     /**
      * Starts the server in a new thread.
      */